@@ -3,91 +3,694 @@
 #include <ctype.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
 #include "fastq-io.h"
 #include "kmer.h"
+#include "read-hash.h"
+#include "yield-curve.h"
+#include "kha-file.h"
+#include "pgzip-io.h"
 #define VERSION (1)
 #define DEF_KMER_LEN (6)
 #define MAX_TO_READ (1000000)
+#define DEF_MAX_MB (4096)
+#define CURVE_LEVELS (8) // subsamples of 1/2, 1/4, ..., 1/128
+#define DEF_SEED (1)
+
+/* Astrea_Progress is shared by the workers for -P reports. Each
+   worker adds what it has done since its last batch; unique
+   counts are per worker, so with more than one thread their sum
+   is an upper bound. With -H the workers' HyperLogLogs are also
+   merged into hll, which gives an estimate for all of them. */
+typedef struct astrea_progress {
+  pthread_mutex_t lock;
+  uint64_t every; // report each time this many more are read
+  uint64_t next;
+  uint64_t reads;
+  uint64_t uniq;
+  int exact; // unique counts are still being made
+  int n_threads;
+  HLL* hll; // -H only
+} Astrea_Progress;
+
+/* Astrea_Opts is what the workers need to know */
+typedef struct astrea_opts {
+  unsigned int k;
+  int whole; // hash whole reads instead of start and end kmers
+  unsigned int hll_p;
+  int insert; // key read pairs on insert length too
+  size_t max_bytes; // per worker, for exact whole-read counts
+  size_t total_bytes; // for all of them
+  unsigned int n_levels; // 1, or CURVE_LEVELS for a yield curve
+  uint64_t seed; // for picking subsamples
+  double max_fold; // furthest the yield curve goes
+  Astrea_Progress* progress; // NULL => no -P reports
+} Astrea_Opts;
+
+/* Astrea_State is what each worker counts into. kha[0] counts
+   every read; for a yield curve, kha[j] counts only the reads
+   whose name hashes to a number below 2^(64-j), so each one is a
+   random subsample of 1/2^j of the reads, and each is part of
+   the one before. Picking by name rather than by sequence means
+   copies of the same molecule are picked, or not, independently.
+   In whole-read mode the khas are freed, and set to NULL, once
+   they take more than max_bytes; from then on only the HLL
+   estimate is made. */
+typedef struct astrea_state {
+  KHA* kha[CURVE_LEVELS];
+  HLL* hll; // whole-read mode only
+  uint64_t total;
+  uint64_t unreadable;
+  uint64_t reported_reads; // what this worker has put in progress
+  uint64_t reported_uniq;
+} Astrea_State;
 
 void help( void );
+void* astrea_init_state( void* arg );
+int astrea_use_rec( const FQ_Rec* rec, void* arg );
+void astrea_do_batch( void* state, const FQ_Rec* recs, size_t n_recs,
+		      void* arg );
+void astrea_merge_state( void* total, void* state, void* arg );
+void astrea_do_pair_batch( Astrea_State* as, const FQ_Rec* recs1,
+			   const FQ_Rec* recs2, size_t n_recs,
+			   uint64_t max_total, const Astrea_Opts* opts );
+Astrea_State* count_pairs( FQPair_Src* ps, uint64_t max_to_read,
+			   Astrea_Opts* opts );
+void output_yield_curve( Astrea_State* result, const Astrea_Opts* opts );
 
 int main ( int argc, char* argv[] ) {
   extern char* optarg;
   char fq_fn[MAX_FN_LEN + 1];
-  KHA* kha;
-  FILE* fq;
-  gzFile fqgz;
-  FQ_Src* fq_source;
-  FQ fq_seq;
-  int i;
+  char r2_fn[MAX_FN_LEN + 1] = {'\0'};
+  char out_fn[MAX_FN_LEN + 1] = {'\0'};
+  char** saved_fns;
+  KHA_File** saved = NULL;
+  KHA_File_Header info;
+  HLL* merged_hll;
+  size_t n_saved = 0, f;
+  int paired = 0;
+  FQ_Src* fq_source = NULL;
+  FQPair_Src* pair_source = NULL;
+  FQ_Pipe pipe;
+  Astrea_Opts opts;
+  Astrea_Progress progress;
+  Astrea_State* result;
   int ich;
-  unsigned int k           = DEF_KMER_LEN;
-  unsigned int total       = 0;
-  unsigned int unreadable  = 0;
-  unsigned int max_to_read = MAX_TO_READ;
+  int n_threads            = 1;
+  size_t max_mb            = DEF_MAX_MB;
+  uint64_t max_to_read     = MAX_TO_READ;
   if ( argc == 1 ) {
     help();
   }
+  opts.k     = DEF_KMER_LEN;
+  opts.whole = 0;
+  opts.insert = 0;
+  opts.hll_p = HLL_DEF_P;
+  opts.n_levels = 1;
+  opts.seed     = DEF_SEED;
+  opts.max_fold = 0.0;
+  opts.progress = NULL;
+  progress.every = 0;
+  saved_fns = (char**)malloc(sizeof(char*) * argc);
 
-  while( (ich=getopt( argc, argv, "f:k:m:" )) != -1 ) {
+  while( (ich=getopt( argc, argv, "f:2:Ik:m:t:HM:p:c:s:P:o:r:" )) != -1 ) {
     switch(ich) {
     case 'f' :
       strcpy( fq_fn, optarg );
       break;
+    case '2' :
+      strcpy( r2_fn, optarg );
+      break;
+    case 'I' :
+      opts.insert = 1;
+      break;
     case 'k' :
-      k = atoi( optarg );
+      opts.k = atoi( optarg );
       break;
     case 'm' :
-      max_to_read = atoi( optarg );
+      max_to_read = strtoull( optarg, NULL, 10 );
+      break;
+    case 't' :
+      n_threads = atoi( optarg );
+      break;
+    case 'H' :
+      opts.whole = 1;
+      break;
+    case 'M' :
+      max_mb = strtoul( optarg, NULL, 10 );
+      break;
+    case 'p' :
+      opts.hll_p = atoi( optarg );
+      break;
+    case 'c' :
+      opts.max_fold = atof( optarg );
+      opts.n_levels = CURVE_LEVELS;
+      break;
+    case 's' :
+      opts.seed = strtoull( optarg, NULL, 10 );
+      break;
+    case 'P' :
+      progress.every = strtoull( optarg, NULL, 10 );
+      break;
+    case 'o' :
+      strcpy( out_fn, optarg );
+      break;
+    case 'r' :
+      saved_fns[n_saved++] = optarg;
       break;
     default :
       help();
     }
   }
 
-  fq_source = init_fastq_src( fq_fn );
-  if ( fq_source == NULL ) {
-    help();
+  if ( n_saved > 0 ) {
+    /* Merging saved counts; there is nothing to read */
+    saved = (KHA_File**)malloc(sizeof(KHA_File*) * n_saved);
+    for( f = 0; f < n_saved; f++ ) {
+      saved[f] = open_KHA_file( saved_fns[f] );
+      if ( saved[f] == NULL ) {
+	exit( 1 );
+      }
+    }
+    opts.k      = saved[0]->hdr->k;
+    opts.whole  = saved[0]->hdr->mode == KHA_MODE_WHOLE;
+    opts.insert = saved[0]->hdr->mode == KHA_MODE_PAIRS_INSERT;
+    paired      = saved[0]->hdr->mode >= KHA_MODE_PAIRS;
+  }
+  else if ( strlen( r2_fn ) > 0 ) {
+    /* The two files are already read by a thread each */
+    pair_source = init_fastq_pair_src( fq_fn, r2_fn );
+    if ( pair_source == NULL ) {
+      help();
+    }
+    paired    = 1;
+    n_threads = 1;
+  }
+  else {
+    fq_source = init_fastq_src( fq_fn );
+    if ( fq_source == NULL ) {
+      help();
+    }
   }
 
-  kha = init_KHA( k );
-  if ( kha == NULL ) {
+  if ( (opts.k < 1) || (opts.k > MAX_KHA_K) ||
+       (opts.hll_p < HLL_MIN_P) || (opts.hll_p > HLL_MAX_P) ||
+       ((opts.n_levels > 1) && (opts.max_fold <= 1.0)) ) {
     help();
   }
-  
-  while( (get_next_fq( fq_source, &fq_seq ) == 0) &&
-	 (total < max_to_read) ) {
-    if ( add_seq_to_KHA( kha, &fq_seq ) ) {
-      total++;
+  if ( n_threads <= 0 ) {
+    n_threads = default_pgz_threads();
+  }
+  opts.total_bytes = max_mb << 20;
+  opts.max_bytes   = opts.total_bytes / n_threads;
+  if ( progress.every > 0 ) {
+    pthread_mutex_init( &progress.lock, NULL );
+    progress.next      = progress.every;
+    progress.reads     = 0;
+    progress.uniq      = 0;
+    progress.exact     = 1;
+    progress.n_threads = n_threads;
+    progress.hll       = opts.whole ? init_hll( opts.hll_p ) : NULL;
+    opts.progress      = &progress;
+  }
+
+  /* Each worker counts into its own KHA; they are summed at the
+     end, so the counts do not depend on n_threads */
+  pipe.n_threads   = n_threads;
+  pipe.batch_recs  = 0;
+  pipe.max_recs    = max_to_read;
+  pipe.use_rec     = astrea_use_rec;
+  pipe.arg         = &opts;
+  pipe.init_state  = astrea_init_state;
+  pipe.do_batch    = astrea_do_batch;
+  pipe.merge_state = astrea_merge_state;
+  if ( n_saved > 0 ) {
+    /* Only the histogram of the merged counts is kept */
+    opts.n_levels = 1;
+    result = (Astrea_State*)astrea_init_state( &opts );
+    opts.n_levels = ( opts.max_fold > 0.0 ) ? CURVE_LEVELS : 1;
+    if ( merge_KHA_files( saved, n_saved,
+			  ( strlen( out_fn ) > 0 ) ? out_fn : NULL,
+			  result->kha[0], &info, &merged_hll ) != 0 ) {
+      exit( 1 );
+    }
+    for( f = 0; f < n_saved; f++ ) {
+      close_KHA_file( saved[f] );
+    }
+    result->total      = info.total;
+    result->unreadable = info.unreadable;
+    if ( result->hll != NULL ) {
+      free_hll( result->hll );
+    }
+    result->hll = merged_hll;
+    printf( "# Complexity analysis of merged saved counts\n" );
+    for( f = 0; f < n_saved; f++ ) {
+      printf( "# Saved counts: %s\n", saved_fns[f] );
+    }
+    if ( paired && !opts.whole ) {
+      printf( "# Pairs are the same if both reads start with the same kmer%s\n",
+	      opts.insert ? " and the insert length is the same" : "" );
+    }
+  }
+  else if ( pair_source != NULL ) {
+    result = count_pairs( pair_source, max_to_read, &opts );
+    if ( pair_source->error ) {
+      exit( 1 );
+    }
+    printf( "# Complexity analysis of read pairs in %s and %s\n",
+	    fq_fn, r2_fn );
+    if ( !opts.whole ) {
+      printf( "# Pairs are the same if both reads start with the same kmer%s\n",
+	      opts.insert ? " and the insert length is the same" : "" );
+    }
+  }
+  else {
+    result = (Astrea_State*)run_fq_pipeline( fq_source, &pipe );
+    if ( fq_source->error ) {
+      exit( 1 );
+    }
+    printf( "# Complexity analysis of %s\n", fq_fn );
+  }
+  if ( (n_saved == 0) && (strlen( out_fn ) > 0) ) {
+    if ( result->kha[0] == NULL ) {
+      fprintf( stderr, "No exact counts to save to %s\n", out_fn );
     }
     else {
-      unreadable++;
+      info.mode = opts.whole ? KHA_MODE_WHOLE :
+	( opts.insert && paired ) ? KHA_MODE_PAIRS_INSERT :
+	paired ? KHA_MODE_PAIRS : KHA_MODE_ENDS;
+      info.total      = result->total;
+      info.unreadable = result->unreadable;
+      if ( save_KHA( result->kha[0], &info, result->hll, out_fn ) != 0 ) {
+	exit( 1 );
+      }
+    }
+  }
+  if ( opts.whole ) {
+    printf( "# Whole-read hashing\n" );
+    printf( "# Total sequences: %lu\n", result->total );
+    printf( "# Total empty sequences: %lu\n", result->unreadable );
+    if ( result->hll != NULL ) {
+      printf( "# Estimated unique sequences (HyperLogLog): %.0f\n",
+	      estimate_hll( result->hll ) );
     }
+    if ( result->kha[0] == NULL ) {
+      printf( "# Exact counts took more than %lu MB (-M); not made\n",
+	      max_mb );
+      exit( 0 );
+    }
+  }
+  else if ( paired ) {
+    printf( "# Total pairs with start kmers: %lu\n", result->total );
+    printf( "# Total pairs without start kmers: %lu\n",
+	    result->unreadable );
+  }
+  else {
+    printf( "# Total sequences with start and end kmers: %lu\n",
+	    result->total );
+    printf( "# Total sequences without start or end kmers: %lu\n",
+	    result->unreadable );
   }
+  output_kmer_table( result->kha[0] );
+  if ( opts.n_levels > 1 ) {
+    output_yield_curve( result, &opts );
+  }
+  exit( 0 );
+}
 
+/* Callbacks for run_fq_pipeline; arg points at the Astrea_Opts */
+void* astrea_init_state( void* arg ) {
+  Astrea_Opts* opts = (Astrea_Opts*)arg;
+  Astrea_State* state;
+  unsigned int j;
+  state = (Astrea_State*)malloc(sizeof(Astrea_State));
+  for( j = 0; j < CURVE_LEVELS; j++ ) {
+    state->kha[j] = ( j < opts->n_levels ) ? init_KHA( opts->k ) : NULL;
+  }
+  state->hll        = opts->whole ? init_hll( opts->hll_p ) : NULL;
+  state->total      = 0;
+  state->unreadable = 0;
+  state->reported_reads = 0;
+  state->reported_uniq  = 0;
+  return state;
+}
 
-  printf( "# Complexity analysis of %s\n", fq_fn );
-  printf( "# Total sequences with start and end kmers: %u\n",
-	  total );
-  printf( "# Total sequences without start or end kmers: %u\n",
-	  unreadable );
-  output_kmer_table( kha );
-  exit( 0 );
+/* free_khas
+   Frees all the khas of a state
+*/
+static void free_khas( Astrea_State* as ) {
+  unsigned int j;
+  for( j = 0; j < CURVE_LEVELS; j++ ) {
+    if ( as->kha[j] != NULL ) {
+      free_KHA( as->kha[j] );
+      as->kha[j] = NULL;
+    }
+  }
+}
+
+/* drop_exact
+   Frees the exact counts of a whole-read state when they take
+   more than max_bytes
+*/
+static void drop_exact( Astrea_State* as, size_t max_bytes ) {
+  size_t bytes = 0;
+  unsigned int j;
+  if ( as->kha[0] == NULL ) {
+    return;
+  }
+  for( j = 0; (j < CURVE_LEVELS) && (as->kha[j] != NULL); j++ ) {
+    bytes += KHA_bytes( as->kha[j] );
+  }
+  if ( bytes > max_bytes ) {
+    free_khas( as );
+  }
+}
+
+/* subsample_levels
+   Returns how many of the khas the read goes in: 1 + the number
+   of leading 0 bits in the hash of its name, up to n_levels
+*/
+static inline unsigned int subsample_levels( const FQ_Rec* rec,
+					     const Astrea_Opts* opts ) {
+  uint64_t h;
+  unsigned int levels;
+  if ( opts->n_levels == 1 ) {
+    return 1;
+  }
+  h = hash_seq( rec->id, rec->id_len, opts->seed );
+  levels = ( h == 0 ) ? 64 : __builtin_clzll( h );
+  levels++;
+  return ( levels < opts->n_levels ) ? levels : opts->n_levels;
+}
+
+/* report_progress
+   Adds what as has done since it last reported to the shared
+   progress, and prints a report to stderr each time another
+   progress->every sequences have been read. The unique counts
+   come from the histograms the KHAs keep, so this is cheap.
+*/
+static void report_progress( Astrea_State* as, Astrea_Progress* progress ) {
+  uint64_t reads, uniq;
+  reads = as->total + as->unreadable;
+  uniq  = ( as->kha[0] != NULL ) ? as->kha[0]->hist.n_uniq : 0;
+  pthread_mutex_lock( &progress->lock );
+  progress->reads += reads - as->reported_reads;
+  if ( as->kha[0] != NULL ) {
+    progress->uniq += uniq - as->reported_uniq;
+  }
+  else {
+    progress->exact = 0;
+  }
+  as->reported_reads = reads;
+  as->reported_uniq  = uniq;
+  if ( progress->hll != NULL ) {
+    merge_hll( progress->hll, as->hll );
+  }
+  if ( progress->reads >= progress->next ) {
+    if ( progress->hll != NULL ) {
+      fprintf( stderr, "%lu sequences examined, about %.0f unique\n",
+	       progress->reads, estimate_hll( progress->hll ) );
+    }
+    else if ( progress->exact ) {
+      fprintf( stderr, "%lu sequences examined, %s%lu unique\n",
+	       progress->reads,
+	       ( progress->n_threads > 1 ) ? "at most " : "", progress->uniq );
+    }
+    else {
+      fprintf( stderr, "%lu sequences examined\n", progress->reads );
+    }
+    while( progress->next <= progress->reads ) {
+      progress->next += progress->every;
+    }
+  }
+  pthread_mutex_unlock( &progress->lock );
+}
+
+/* astrea_use_rec
+   Returns true IFF astrea_do_batch counts rec in as->total, so
+   -m is the number of sequences counted, not read
+*/
+int astrea_use_rec( const FQ_Rec* rec, void* arg ) {
+  Astrea_Opts* opts = (Astrea_Opts*)arg;
+  if ( opts->whole ) {
+    return ( rec->len > 0 );
+  }
+  return KHA_takes_seq( opts->k, rec );
+}
+
+void astrea_do_batch( void* state, const FQ_Rec* recs, size_t n_recs,
+		      void* arg ) {
+  Astrea_Opts* opts = (Astrea_Opts*)arg;
+  Astrea_State* as  = (Astrea_State*)state;
+  uint64_t hash;
+  unsigned int j, levels;
+  size_t i;
+  if ( opts->whole ) {
+    for( i = 0; i < n_recs; i++ ) {
+      if ( recs[i].len == 0 ) {
+	as->unreadable++;
+	continue;
+      }
+      hash = hash_seq( recs[i].seq, recs[i].len, 0 );
+      add_hll( as->hll, hash );
+      if ( as->kha[0] != NULL ) {
+	levels = subsample_levels( &recs[i], opts );
+	for( j = 0; j < levels; j++ ) {
+	  add_hash_to_KHA( as->kha[j], recs[i].len, hash );
+	}
+      }
+      as->total++;
+    }
+    drop_exact( as, opts->max_bytes );
+    if ( opts->progress != NULL ) {
+      report_progress( as, opts->progress );
+    }
+    return;
+  }
+  for( i = 0; i < n_recs; i++ ) {
+    if ( add_seq_to_KHA( as->kha[0], &recs[i] ) ) {
+      as->total++;
+      levels = subsample_levels( &recs[i], opts );
+      for( j = 1; j < levels; j++ ) {
+	add_seq_to_KHA( as->kha[j], &recs[i] );
+      }
+    }
+    else {
+      as->unreadable++;
+    }
+  }
+  if ( opts->progress != NULL ) {
+    report_progress( as, opts->progress );
+  }
+}
+
+void astrea_merge_state( void* total, void* state, void* arg ) {
+  Astrea_Opts* opts = (Astrea_Opts*)arg;
+  Astrea_State* t   = (Astrea_State*)total;
+  Astrea_State* as  = (Astrea_State*)state;
+  unsigned int j;
+  if ( (t->kha[0] != NULL) && (as->kha[0] != NULL) ) {
+    for( j = 0; j < opts->n_levels; j++ ) {
+      merge_KHA( t->kha[j], as->kha[j] );
+    }
+  }
+  else {
+    /* Any worker giving up on exact counts means none are made */
+    free_khas( t );
+  }
+  free_khas( as );
+  if ( as->hll != NULL ) {
+    merge_hll( t->hll, as->hll );
+    free_hll( as->hll );
+    /* The total gets the whole budget */
+    drop_exact( t, opts->total_bytes );
+  }
+  t->total      += as->total;
+  t->unreadable += as->unreadable;
+  free( as );
+}
+
+/* astrea_do_pair_batch
+   Same as astrea_do_batch for n_recs read pairs. In whole-read
+   mode the hash is of read 1 then read 2; otherwise a pair is
+   keyed on the start kmers of both reads and, with opts->insert,
+   the insert length where the reads overlap. Stops once
+   as->total reaches max_total (0 => no limit).
+*/
+void astrea_do_pair_batch( Astrea_State* as, const FQ_Rec* recs1,
+			   const FQ_Rec* recs2, size_t n_recs,
+			   uint64_t max_total, const Astrea_Opts* opts ) {
+  uint64_t hash;
+  size_t insert_len;
+  size_t len;
+  unsigned int j, levels;
+  size_t i;
+  for( i = 0; (i < n_recs) && ((max_total == 0) || (as->total < max_total));
+       i++ ) {
+    if ( opts->whole ) {
+      len = recs1[i].len + recs2[i].len;
+      if ( len == 0 ) {
+	as->unreadable++;
+	continue;
+      }
+      hash = hash_seq( recs2[i].seq, recs2[i].len,
+		       hash_seq( recs1[i].seq, recs1[i].len, 0 ) );
+      add_hll( as->hll, hash );
+      if ( as->kha[0] != NULL ) {
+	levels = subsample_levels( &recs1[i], opts );
+	for( j = 0; j < levels; j++ ) {
+	  add_hash_to_KHA( as->kha[j], len, hash );
+	}
+      }
+      as->total++;
+      continue;
+    }
+    insert_len = opts->insert ?
+      pair_insert_len( &recs1[i], &recs2[i], opts->k ) : 0;
+    if ( add_pair_to_KHA( as->kha[0], &recs1[i], &recs2[i], insert_len ) ) {
+      as->total++;
+      levels = subsample_levels( &recs1[i], opts );
+      for( j = 1; j < levels; j++ ) {
+	add_pair_to_KHA( as->kha[j], &recs1[i], &recs2[i], insert_len );
+      }
+    }
+    else {
+      as->unreadable++;
+    }
+  }
+  if ( opts->whole ) {
+    drop_exact( as, opts->max_bytes );
+  }
+  if ( opts->progress != NULL ) {
+    report_progress( as, opts->progress );
+  }
+}
+
+/* count_pairs
+   Counts the pairs of ps, a batch at a time as
+   get_next_fqpair_batch hands them over, until max_to_read
+   (0 => all) of them have been counted.
+   Returns: the counts
+*/
+Astrea_State* count_pairs( FQPair_Src* ps, uint64_t max_to_read,
+			   Astrea_Opts* opts ) {
+  Astrea_State* as;
+  FQ_Batch* b1;
+  FQ_Batch* b2;
+  as = (Astrea_State*)astrea_init_state( opts );
+  while( ((max_to_read == 0) || (as->total < max_to_read)) &&
+	 (get_next_fqpair_batch( ps, &b1, &b2 ) == 0) ) {
+    astrea_do_pair_batch( as, b1->recs, b2->recs, b1->n_recs, max_to_read,
+			  opts );
+  }
+  return as;
+}
+
+/* output_yield_curve
+   Prints how many distinct sequences there are in each subsample
+   and in all the reads, then how many there would be with up to
+   opts->max_fold times as many reads, from the histogram of all
+   the reads (see yield-curve.h)
+*/
+void output_yield_curve( Astrea_State* result, const Astrea_Opts* opts ) {
+  uint64_t count[MAX_SEQ_COUNT + 1];
+  uint64_t tail_seqs;
+  uint64_t uniq;
+  Yield_Curve yc;
+  double fold;
+  int j;
+
+  printf( "# Yield curve: distinct sequences by number of reads\n" );
+  if ( result->kha[1] != NULL ) {
+    printf( "# Subsamples are picked by hashing read names with seed %lu\n",
+	    opts->seed );
+  }
+  printf( "# reads\tdistinct\thow\n" );
+  for( j = opts->n_levels - 1; j > 0; j-- ) {
+    if ( result->kha[j] == NULL ) {
+      continue; // merged saved counts have no subsamples
+    }
+    uniq = kmer_table_hist( result->kha[j], count, &tail_seqs );
+    printf( "%lu\t%lu\tsubsample\n", result->kha[j]->n_entries, uniq );
+  }
+  uniq = kmer_table_hist( result->kha[0], count, &tail_seqs );
+  printf( "%lu\t%lu\tobserved\n", result->kha[0]->n_entries, uniq );
+  if ( uniq == 0 ) {
+    return;
+  }
+  fit_yield_curve( count, MAX_SEQ_COUNT, (double)result->kha[0]->n_entries,
+		   opts->max_fold, &yc );
+  for( fold = 2.0; fold < opts->max_fold * (1.0 + 1e-9); fold *= 2.0 ) {
+    printf( "%.0f\t%.0f\t%s\n", fold * yc.n_reads, yield_at( &yc, fold ),
+	    ( yc.model == YC_RATIONAL ) ? "extrapolated" : "lander-waterman" );
+  }
+  if ( fold / 2.0 < opts->max_fold * (1.0 - 1e-9) ) {
+    printf( "%.0f\t%.0f\t%s\n", opts->max_fold * yc.n_reads,
+	    yield_at( &yc, opts->max_fold ),
+	    ( yc.model == YC_RATIONAL ) ? "extrapolated" : "lander-waterman" );
+  }
+  printf( "# Chance the next read is a new sequence (seen once / reads): %.5f\n",
+	  (double)count[1] / yc.n_reads );
+  printf( "# With %gx the reads: %.0f distinct, %.1f%% more than now\n",
+	  opts->max_fold, yield_at( &yc, opts->max_fold ),
+	  100.0 * (yield_at( &yc, opts->max_fold ) / yc.n_distinct - 1.0) );
 }
 
 void help( void ) {
   printf("astrea-complexity V %d\n", VERSION );
-  printf("    -f <fastq file>\n" );
-  printf("    -k <kmer length; default = %d\n", DEF_KMER_LEN);
-  printf("    -m <max sequences to examine; default = %d\n",
+  printf("    -f <fastq file; read 1 with -2>\n" );
+  printf("    -2 <read 2 fastq file; counts read pairs>\n" );
+  printf("    -I with -2, pairs must also have the same insert length\n" );
+  printf("    -k <kmer length; 1 to %d; default = %d\n", MAX_KHA_K,
+	 DEF_KMER_LEN);
+  printf("    -m <max sequences to examine; 0 => all; default = %d\n",
 	 MAX_TO_READ );
+  printf("    -t <threads; 0 => one per processor; default = 1>\n" );
+  printf("    -H hash whole reads instead of using start and end kmers\n" );
+  printf("    -M <MB for exact counts with -H; default = %d>\n", DEF_MAX_MB );
+  printf("    -p <HyperLogLog precision with -H; %d to %d; default = %d>\n",
+	 HLL_MIN_P, HLL_MAX_P, HLL_DEF_P );
+  printf("    -c <make a yield curve out to this many times the reads>\n" );
+  printf("    -s <seed for the yield curve subsamples; default = %d>\n",
+	 DEF_SEED );
+  printf("    -P <report progress to stderr every this many sequences>\n" );
+  printf("    -o <save the counts to this file, to merge later with -r>\n" );
+  printf("    -r <saved counts to merge instead of reading fastq;\n" );
+  printf("        give -r once per file>\n" );
   printf("Makes a histogram of how many sequences are seen\n" );
   printf("each specific number of times.\n" );
   printf("A sequence is the same if its length is the same\n" );
   printf("and the first k and last k bases of the sequence\n" );
   printf("are the same.\n");
-  printf("This is meant to be run on merged sequence data,\n" );
-  printf("i.e., not read pairs.\n" );
+  printf("With -H, a sequence is the same if all its bases are:\n" );
+  printf("reads are hashed whole and counted exactly, as long as\n" );
+  printf("that takes less than -M MB, and the number of different\n" );
+  printf("reads is also estimated in fixed memory (2^p bytes) with\n" );
+  printf("HyperLogLog, however many reads there are.\n" );
+  printf("With -c, one pass also counts nested random subsamples of\n" );
+  printf("1/2 to 1/%d of the reads, and prints how many distinct\n",
+	 1 << (CURVE_LEVELS - 1) );
+  printf("sequences each has, then how many there would be with\n" );
+  printf("2, 4, ... up to -c times the reads, extrapolated from the\n" );
+  printf("histogram as preseq does, to help decide whether more\n" );
+  printf("sequencing of this library is worth it.\n" );
+  printf("With -2, read pairs are counted without merging them\n" );
+  printf("first: a pair is the same if read 1 and read 2 start with\n" );
+  printf("the same k bases (and, with -I, the insert length found\n" );
+  printf("from where the reads overlap is the same, too; pairs that\n" );
+  printf("do not overlap have length 0). -H hashes both whole reads.\n" );
+  printf("The two files are read by a thread each, so -t does not\n" );
+  printf("apply.\n" );
+  printf("Without -2, this is meant to be run on merged sequence\n" );
+  printf("data.\n" );
+  printf("With -o, the counts (of all the reads, not the -c\n" );
+  printf("subsamples) are saved in a compact binary file. Files\n" );
+  printf("saved from different lanes or runs of the same library,\n" );
+  printf("counted the same way, can be merged with -r a.kha -r b.kha\n" );
+  printf("...; counts of the same sequence are summed, so the\n" );
+  printf("histogram (and -c curve, without subsamples) is exactly\n" );
+  printf("what counting all the reads at once would give. -o with\n" );
+  printf("-r saves the merged counts.\n" );
   exit( 0 );
   
 } 
@@ -1,20 +1,6 @@
 #include "fasta-genome-io.h"
 
-/* Takes filename as argument
-   Returns true IFF filename ends in .gz
-   False otherwise */
-int is_gz( const char* fq_fn ) {
-  size_t fn_len;
-  fn_len = strlen( fq_fn );
-  if ( (fq_fn[fn_len-3] == '.') &&
-       (fq_fn[fn_len-2] == 'g') &&
-       (fq_fn[fn_len-1] == 'z') ) {
-    return 1;
-  }
-  return 0;
-}
-
-/* Takes filename
+/* Takes filename; "-" => stdin
    Returns Fa_Src*; NULL => problem or nothing there
 */
 Fa_Src* init_fasta_src( const char fn[] ) {
@@ -25,52 +11,36 @@ Fa_Src* init_fasta_src( const char fn[] ) {
   fa_source = (Fa_Src*)malloc(sizeof( Fa_Src ));
   strcpy( fa_source->fn, fn );
   fa_source->n = 0;
+  fa_source->in = open_in_src( fa_source->fn, 0 );
+  if ( fa_source->in == NULL ) {
+    free( fa_source );
+    return NULL;
+  }
   fa_source->seq_buffer = (char*)malloc(sizeof(char)*MAX_SEQ_LEN);
   fa_source->seq_buffer[0] = '\0';
-  if ( is_gz( fn ) ) {
-    fa_source->is_gz = 1;
-    fa_source->fagz = gzopen( fa_source->fn, "r" );
-    if ( fa_source->fagz == NULL ) {
-      free( fa_source->seq_buffer );
-      free( fa_source );
-      return NULL;
-    }
+  fa_source->buf_pos = 0;
+  if ( fa_source->in->map != NULL ) {
+    fa_source->buf     = fa_source->in->map;
+    fa_source->buf_len = fa_source->in->map_len;
   }
   else {
-    fa_source->is_gz = 0;
-    fa_source->fafp = fileOpen( fa_source->fn, "r" );
-    if ( fa_source->fafp == NULL ) {
-      free( fa_source->seq_buffer );
-      free( fa_source );
-      return NULL;
-    }
+    fa_source->buf     = (char*)malloc(sizeof(char)*FA_BUF_SIZE);
+    fa_source->buf_len = 0;
   }
   return fa_source;
 }
 
 /* get_next_fa
-   Args: Fa_Src* fa_source - the source (uncompressed or gz) 
-                 of some fasta data
+   Args: Fa_Src* fa_source - the source of some fasta data
    Returns: Seq* pointer to new sequence; NULL if there was
             any problem, like EOF
-   Calls the right parser type (gz or regular) to read the next
-   record and updates the fq_source->n if a fastq record is read
-   correctly.
+   Reads the next record and updates the fa_source->n if a
+   fasta record is read correctly.
 */
 Seq* get_next_fa( Fa_Src* fa_source, Genome* genome ) {
   Seq* seq;
-  int status;
   seq = (Seq*)malloc(sizeof(Seq));
-  if ( fa_source->is_gz ) {
-    status = gzread_fasta( fa_source->fagz, seq,
-			   fa_source->seq_buffer );
-
-  }
-  else {
-    status = read_fasta( fa_source->fafp, seq,
-			 fa_source->seq_buffer );
-  }
-  if ( status ) {
+  if ( read_fasta( fa_source, seq ) ) {
     free( seq );
     seq = NULL;
   }
@@ -83,115 +53,106 @@ Seq* get_next_fa( Fa_Src* fa_source, Genome* genome ) {
 }
 
 int close_fasta_src( Fa_Src* fa_source ) {
-  if ( fa_source->is_gz ) {
-    gzclose( fa_source->fagz );
-  }
-  else {
-    fclose(fa_source->fafp);
+  if ( fa_source->in->map == NULL ) {
+    free( fa_source->buf );
   }
+  close_in_src( fa_source->in );
+  free( fa_source->seq_buffer );
   return 0;
 }
 
-/* Args: FILE* fafp
-         Seq* seq
-         char* seq_buffer
-   Returns: 0 - everything is copacetic
-          non-zero if EOF or other problem
-   Reads the next fastq sequence from a regular file handle
+/* fa_fill
+   Makes sure there is unparsed input in fa_source->buf
+   Returns: true IFF there is
 */
-int read_fasta( FILE* fafp, Seq* seq, char* seq_buffer ) {
-  char c;
-  size_t i = 0;
-  c = fgetc(fafp);
-  if ( c == '>' ) {
-    c = fgetc(fafp);
-    while ( !isspace(c) ) { // load up the ID
-      seq->id[i++] = c;
-      c = fgetc(fafp);
-    }
-    seq->id[i] = '\0';
-    while( c != '\n' ) {
-      c = fgetc(fafp);
-    }
-    i = 0;
-    while( (c != '>') &&
-           (c != EOF) &&
-           (i < MAX_SEQ_LEN) ) {
-      if ( isspace(c) ) {
-        ;
-      }
-      else {
-        c = toupper(c);
-        seq_buffer[i++] = c;
-      }
-      c = fgetc( fafp );
-    }
-    seq_buffer[i] = '\0';
-    ungetc(c, fafp);
+static int fa_fill( Fa_Src* fa_source ) {
+  long got;
+  if ( fa_source->buf_pos < fa_source->buf_len ) {
+    return 1;
   }
-  else {
-    if ( c == EOF ) {
-      return -1;
-    }
+  if ( fa_source->in->map != NULL ) {
+    return 0;
   }
-  if ( i == MAX_SEQ_LEN ) {
-    fprintf( stderr, "%s is truncated to %d\n", seq->id, MAX_SEQ_LEN );
+  got = in_src_read( fa_source->in, fa_source->buf, FA_BUF_SIZE );
+  if ( got <= 0 ) {
+    return 0;
   }
-  /* Now, make space in seq for copying the sequence */
-  seq->seq = (char*)malloc(sizeof(char)*(i+1));
-  strcpy( seq->seq, seq_buffer );
-  seq->len = i;
-  return 0;
+  fa_source->buf_pos = 0;
+  fa_source->buf_len = got;
+  return 1;
 }
 
-/* Args: gzFile gzfp
+/* Args: Fa_Src* fa_source
          Seq* seq
-         char* seq_buffer
    Returns: 0 - everything is copacetic
           non-zero if EOF or other problem
-   Reads the next fastq sequence from a gzFile handle
+   Reads the next fasta sequence into fa_source->seq_buffer, then
+   copies it to newly allocated space in seq. The ID is everything
+   up to the first whitespace on the > line. Sequence is upper-cased
+   and any whitespace is left out.
 */
-int gzread_fasta( gzFile gzfp, Seq* seq, char* seq_buffer ) {
+int read_fasta( Fa_Src* fa_source, Seq* seq ) {
+  char* seq_buffer = fa_source->seq_buffer;
   char c;
   size_t i = 0;
-  c = gzgetc(gzfp);
-  if ( c == '>' ) {
-    c = gzgetc(gzfp);
-    while ( !isspace(c) ) { // load up the ID
+
+  /* Skip blank lines before the > */
+  while( fa_fill( fa_source ) &&
+	 isspace( fa_source->buf[fa_source->buf_pos] ) ) {
+    fa_source->buf_pos++;
+  }
+  if ( !fa_fill( fa_source ) ) {
+    return -1;
+  }
+  if ( fa_source->buf[fa_source->buf_pos] != '>' ) {
+    fprintf( stderr, "fasta record not beginning with >\n" );
+    return -1;
+  }
+  fa_source->buf_pos++;
+
+  /* load up the ID */
+  while( fa_fill( fa_source ) ) {
+    c = fa_source->buf[fa_source->buf_pos];
+    if ( isspace(c) ) {
+      break;
+    }
+    if ( i < MAX_ID_LEN ) {
       seq->id[i++] = c;
-      c = gzgetc(gzfp);
     }
-    seq->id[i] = '\0';
-    while( c != '\n' ) {
-      c = gzgetc(gzfp);
+    fa_source->buf_pos++;
+  }
+  seq->id[i] = '\0';
+  /* skip the rest of the > line */
+  while( fa_fill( fa_source ) ) {
+    if ( fa_source->buf[fa_source->buf_pos++] == '\n' ) {
+      break;
     }
-    i = 0;
-    while( (c != '>') &&
-           (c != EOF) &&
-           (i < MAX_SEQ_LEN) ) {
-      if ( isspace(c) ) {
-        ;
+  }
+
+  /* Sequence runs up to the next > or EOF */
+  i = 0;
+  while( fa_fill( fa_source ) ) {
+    while( fa_source->buf_pos < fa_source->buf_len ) {
+      c = fa_source->buf[fa_source->buf_pos];
+      if ( c == '>' ) {
+	break;
       }
-      else {
-        c = toupper(c);
-        seq_buffer[i++] = c;
+      if ( !isspace(c) && (i < MAX_SEQ_LEN) ) {
+	seq_buffer[i++] = toupper(c);
       }
-      c = gzgetc( gzfp );
+      fa_source->buf_pos++;
     }
-    seq_buffer[i] = '\0';
-    gzungetc(c, gzfp);
-  }
-  else {
-    if ( c == EOF ) {
-      return -1;
+    if ( fa_source->buf_pos < fa_source->buf_len ) {
+      break; // stopped at the next >
     }
   }
+  seq_buffer[i] = '\0';
   if ( i == MAX_SEQ_LEN ) {
     fprintf( stderr, "%s is truncated to %d\n", seq->id, MAX_SEQ_LEN );
   }
   /* Now, make space in seq for copying the sequence */
-  seq->seq = (char*)malloc(sizeof(char)*i);
-  strcpy( seq->seq, seq_buffer );
+  seq->seq = (char*)malloc(sizeof(char)*(i+1));
+  memcpy( seq->seq, seq_buffer, i+1 );
   seq->len = i;
   return 0;
 }
@@ -223,16 +184,3 @@ Genome* init_genome( void ) {
   genome->n_seqs = 0;
   return genome;
 }
-
-/** fileOpen **/
-FILE * fileOpen(const char *name, char access_mode[]) {
-  FILE * f;
-  f = fopen(name, access_mode);
-  if (f == NULL) {
-    fprintf( stderr, "%s\n", name);
-    perror("Cannot open file");
-    return NULL;
-  }
-  return f;
-}
-
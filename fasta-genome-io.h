@@ -4,10 +4,12 @@
 #include <string.h>
 #include <limits.h>
 #include <zlib.h>
+#include "input-src.h"
 #define MAX_FN_LEN (2047)
 #define MAX_ID_LEN (511)
 #define MAX_SEQ_LEN (536870911)
 #define MAX_GENOME_SEQS (1000000)
+#define FA_BUF_SIZE (1048576)
 
 /* Data structures */
 typedef struct seq {
@@ -22,12 +24,18 @@ typedef struct genome {
   size_t n_seqs;
 } Genome;
 
+/* Fa_Src reads its input through an In_Src, so it can be plain,
+   gzip, BGZF or stdin ("-") whatever its name. buf holds input
+   not yet parsed, from buf_pos to buf_len. If the In_Src mmapped
+   the file, buf is the mapping and holds all of it.
+ */
 typedef struct fa_src {
   char fn[MAX_FN_LEN+1];
   char* seq_buffer;
-  int is_gz;
-  gzFile fagz;
-  FILE* fafp;
+  In_Src* in;
+  char* buf;
+  size_t buf_pos;
+  size_t buf_len;
   size_t n;
 } Fa_Src;
 
@@ -35,10 +43,7 @@ typedef struct fa_src {
 Genome* init_genome( void );
 Fa_Src* init_fasta_src( const char fn[] );
 Seq* get_next_fa( Fa_Src* fa_source, Genome* genome );
-int read_fasta( FILE* fp, Seq* seq, char* seq_buffer );
-int gzread_fasta( gzFile gzfp, Seq* seq, char* seq_buffer );
+int read_fasta( Fa_Src* fa_source, Seq* seq );
 Seq* find_seq( Genome* genome, const char id[] );
-int is_gz( const char* fn );
-FILE* fileOpen( const char* name, char access_mode[] );
 int close_fasta_src( Fa_Src* );
 int chr_cmp( const void *v1, const void *v2 );
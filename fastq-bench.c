@@ -0,0 +1,574 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "fastq-io.h"
+#include "fasta-genome-io.h"
+
+#define MAX_INPUTS (3)
+#define MAX_CASES (64)
+#define MAX_CASE_NAME (255)
+#define DEF_K (4)
+#define DEF_LEN (100)
+#define FNV_OFFSET (0xcbf29ce484222325ULL)
+#define FNV_PRIME (0x100000001b3ULL)
+
+/* Bench_Result is what one case reports: how many records and
+   bytes of sequence data it got through, and a checksum of what
+   it read (reader cases) or printed (tool cases)
+ */
+typedef struct bench_result {
+  size_t n_recs;
+  size_t n_bytes;
+  uint64_t checksum;
+} Bench_Result;
+
+/* Bench_Sums holds the checksums from an earlier run to compare to */
+typedef struct bench_sums {
+  char names[MAX_CASES][MAX_CASE_NAME + 1];
+  uint64_t sums[MAX_CASES];
+  size_t n;
+} Bench_Sums;
+
+typedef int (*Reader_Fn)( const char fn[], int n_threads,
+			  Bench_Result* res );
+
+void help( void );
+uint64_t fnv_update( uint64_t h, const void* data, size_t len );
+int bench_fastq( const char fn[], int n_threads, Bench_Result* res );
+int bench_fastq_pipe( const char fn[], int n_threads, Bench_Result* res );
+int bench_fasta( const char fn[], int n_threads, Bench_Result* res );
+double now_secs( void );
+int run_reader( Reader_Fn reader, const char fn[], int n_threads,
+		Bench_Result* res, double* secs, long* max_rss );
+int run_tool( char* const argv[], Bench_Result* res, double* secs,
+	      long* max_rss );
+void report( const char name[], const Bench_Result* res, size_t n_recs,
+	     size_t n_bytes, double secs, long max_rss, Bench_Sums* ref,
+	     Bench_Sums* seen, int* n_diff );
+void read_sums( const char fn[], Bench_Sums* sums );
+void write_sums( const char fn[], const Bench_Sums* sums );
+const char* base_name( const char fn[] );
+
+int main( int argc, char* argv[] ) {
+  extern char* optarg;
+  char fq_fns[MAX_INPUTS][MAX_FN_LEN+1] = { {'\0'}, {'\0'}, {'\0'} };
+  char fa_fn[MAX_FN_LEN+1]   = {'\0'};
+  char sums_fn[MAX_FN_LEN+1] = {'\0'};
+  char tool_dir[MAX_FN_LEN+1] = ".";
+  char tool[MAX_FN_LEN+1];
+  char name[MAX_CASE_NAME+1];
+  char k_str[16], len_str[16];
+  char* tool_argv[8];
+  Bench_Result res;
+  Bench_Sums ref;
+  Bench_Sums seen;
+  size_t in_recs[MAX_INPUTS];
+  size_t in_bytes[MAX_INPUTS];
+  size_t fa_recs = 0;
+  size_t fa_bytes = 0;
+  double secs;
+  long max_rss;
+  int k = DEF_K;
+  int len = DEF_LEN;
+  int n_threads = 0;
+  int n_diff = 0;
+  int i;
+  int ich;
+
+  while( (ich=getopt( argc, argv, "f:g:b:a:k:l:t:d:c:" )) != -1 ) {
+    switch(ich) {
+    case 'f' :
+      strcpy( fq_fns[0], optarg );
+      break;
+    case 'g' :
+      strcpy( fq_fns[1], optarg );
+      break;
+    case 'b' :
+      strcpy( fq_fns[2], optarg );
+      break;
+    case 'a' :
+      strcpy( fa_fn, optarg );
+      break;
+    case 'k' :
+      k = atoi( optarg );
+      break;
+    case 'l' :
+      len = atoi( optarg );
+      break;
+    case 't' :
+      n_threads = atoi( optarg );
+      break;
+    case 'd' :
+      strcpy( tool_dir, optarg );
+      break;
+    case 'c' :
+      strcpy( sums_fn, optarg );
+      break;
+    default :
+      help();
+    }
+  }
+  if ( (strlen( fq_fns[0] ) == 0) && (strlen( fq_fns[1] ) == 0) &&
+       (strlen( fq_fns[2] ) == 0) && (strlen( fa_fn ) == 0) ) {
+    help();
+  }
+  ref.n  = 0;
+  seen.n = 0;
+  if ( strlen( sums_fn ) > 0 ) {
+    read_sums( sums_fn, &ref );
+  }
+  sprintf( k_str, "%d", k );
+  sprintf( len_str, "%d", len );
+
+  printf( "#%-39s %10s %8s %12s %9s %9s %-16s\n", "case", "records",
+	  "secs", "records/s", "MB/s", "maxRSS_MB", "checksum" );
+
+  /* Reader paths */
+  for( i = 0; i < MAX_INPUTS; i++ ) {
+    in_recs[i]  = 0;
+    in_bytes[i] = 0;
+    if ( strlen( fq_fns[i] ) == 0 ) {
+      continue;
+    }
+    if ( run_reader( bench_fastq, fq_fns[i], n_threads, &res, &secs,
+		     &max_rss ) == 0 ) {
+      in_recs[i]  = res.n_recs;
+      in_bytes[i] = res.n_bytes;
+      sprintf( name, "get_next_fq_rec:%s", base_name( fq_fns[i] ) );
+      report( name, &res, res.n_recs, res.n_bytes, secs, max_rss,
+	      &ref, &seen, &n_diff );
+    }
+    if ( run_reader( bench_fastq_pipe, fq_fns[i], n_threads, &res, &secs,
+		     &max_rss ) == 0 ) {
+      sprintf( name, "run_fq_pipeline:%s", base_name( fq_fns[i] ) );
+      report( name, &res, res.n_recs, res.n_bytes, secs, max_rss,
+	      &ref, &seen, &n_diff );
+    }
+  }
+  if ( (strlen( fa_fn ) > 0) &&
+       (run_reader( bench_fasta, fa_fn, n_threads, &res, &secs,
+		    &max_rss ) == 0) ) {
+    fa_recs  = res.n_recs;
+    fa_bytes = res.n_bytes;
+    sprintf( name, "get_next_fa:%s", base_name( fa_fn ) );
+    report( name, &res, res.n_recs, res.n_bytes, secs, max_rss,
+	    &ref, &seen, &n_diff );
+  }
+
+  /* Tools; their output checksums should not depend on the input format */
+  for( i = 0; i < MAX_INPUTS; i++ ) {
+    if ( strlen( fq_fns[i] ) == 0 ) {
+      continue;
+    }
+    sprintf( tool, "%s/astrea-complexity", tool_dir );
+    tool_argv[0] = tool;
+    tool_argv[1] = "-f";
+    tool_argv[2] = fq_fns[i];
+    tool_argv[3] = "-k";
+    tool_argv[4] = k_str;
+    tool_argv[5] = NULL;
+    if ( run_tool( tool_argv, &res, &secs, &max_rss ) == 0 ) {
+      sprintf( name, "astrea-complexity:%s", base_name( fq_fns[i] ) );
+      report( name, &res, in_recs[i], in_bytes[i], secs, max_rss,
+	      &ref, &seen, &n_diff );
+    }
+
+    sprintf( tool, "%s/fastq-dinuc-count", tool_dir );
+    tool_argv[3] = "-l";
+    tool_argv[4] = len_str;
+    if ( run_tool( tool_argv, &res, &secs, &max_rss ) == 0 ) {
+      sprintf( name, "fastq-dinuc-count:%s", base_name( fq_fns[i] ) );
+      report( name, &res, in_recs[i], in_bytes[i], secs, max_rss,
+	      &ref, &seen, &n_diff );
+    }
+
+    sprintf( tool, "%s/what-adapter", tool_dir );
+    tool_argv[3] = "-v";
+    tool_argv[4] = NULL;
+    if ( run_tool( tool_argv, &res, &secs, &max_rss ) == 0 ) {
+      sprintf( name, "what-adapter:%s", base_name( fq_fns[i] ) );
+      report( name, &res, in_recs[i], in_bytes[i], secs, max_rss,
+	      &ref, &seen, &n_diff );
+    }
+  }
+  if ( strlen( fa_fn ) > 0 ) {
+    sprintf( tool, "%s/test-fasta-genome", tool_dir );
+    tool_argv[0] = tool;
+    tool_argv[1] = "-f";
+    tool_argv[2] = fa_fn;
+    tool_argv[3] = "-I";
+    tool_argv[4] = "chr1";
+    tool_argv[5] = NULL;
+    if ( run_tool( tool_argv, &res, &secs, &max_rss ) == 0 ) {
+      sprintf( name, "test-fasta-genome:%s", base_name( fa_fn ) );
+      report( name, &res, fa_recs, fa_bytes, secs, max_rss, &ref, &seen,
+	      &n_diff );
+    }
+  }
+
+  if ( strlen( sums_fn ) > 0 ) {
+    if ( ref.n == 0 ) {
+      write_sums( sums_fn, &seen );
+      printf( "# Wrote checksums to %s\n", sums_fn );
+    }
+    else if ( n_diff > 0 ) {
+      printf( "# %d checksums differ from %s\n", n_diff, sums_fn );
+      exit( 1 );
+    }
+    else {
+      printf( "# All checksums match %s\n", sums_fn );
+    }
+  }
+  exit( 0 );
+}
+
+void help( void ) {
+  printf( "fastq-bench -f <plain fastq> -g <gzip fastq> -b <BGZF fastq>\n" );
+  printf( "            -a <fasta>\n" );
+  printf( "            -k <astrea-complexity k; default = %d>\n", DEF_K );
+  printf( "            -l <fastq-dinuc-count length; default = %d>\n",
+	  DEF_LEN );
+  printf( "            -t <run_fq_pipeline threads; default = one per processor>\n" );
+  printf( "            -d <directory with the tools; default = .>\n" );
+  printf( "            -c <checksum file>\n" );
+  printf( "Times each reader path and each tool on the given inputs,\n" );
+  printf( "each in its own process, and reports records/s, MB/s of\n" );
+  printf( "sequence data and peak resident memory. All inputs are\n" );
+  printf( "optional, but give at least one. The fastq inputs should\n" );
+  printf( "hold the same reads, e.g., made by fastq-gen with the same seed.\n" );
+  printf( "A checksum of what each case read or printed is reported.\n" );
+  printf( "If the -c file does not exist the checksums are written to it;\n" );
+  printf( "if it does they are compared to it, and the exit status is 1\n" );
+  printf( "if any differ.\n" );
+  exit( 0 );
+}
+
+/* fnv_update
+   Returns the 64-bit FNV-1a hash h carried on over len bytes of data
+*/
+uint64_t fnv_update( uint64_t h, const void* data, size_t len ) {
+  const unsigned char* p = (const unsigned char*)data;
+  size_t i;
+  for( i = 0; i < len; i++ ) {
+    h = (h ^ p[i]) * FNV_PRIME;
+  }
+  return h;
+}
+
+/* rec_hash
+   Returns a hash of the identifier, sequence and quality of fq_rec
+*/
+static uint64_t rec_hash( const FQ_Rec* fq_rec ) {
+  uint64_t h = FNV_OFFSET;
+  h = fnv_update( h, fq_rec->id, fq_rec->id_len );
+  h = fnv_update( h, fq_rec->seq, fq_rec->len );
+  h = fnv_update( h, fq_rec->qual, fq_rec->qual_len );
+  return h;
+}
+
+/* bench_fastq
+   Reads every record of fn with get_next_fq_rec
+   Returns: 0 => copacetic; -1 => could not open or read fn
+   The checksum is the sum of the record hashes, so it is the same
+   for bench_fastq_pipe, which sees records in no particular order.
+*/
+int bench_fastq( const char fn[], int n_threads, Bench_Result* res ) {
+  FQ_Src* fq_source;
+  FQ_Rec fq_rec;
+  int status;
+  set_fastq_inflate_threads( n_threads );
+  fq_source = init_fastq_src( fn );
+  if ( fq_source == NULL ) {
+    return -1;
+  }
+  while( get_next_fq_rec( fq_source, &fq_rec ) == 0 ) {
+    res->n_bytes  += fq_rec.len;
+    res->checksum += rec_hash( &fq_rec );
+  }
+  res->n_recs = fq_source->n;
+  status = fq_source->error ? -1 : 0;
+  close_fastq_src( fq_source );
+  return status;
+}
+
+/* Callbacks for bench_fastq_pipe; each worker sums into its own
+   Bench_Result */
+static void* bench_init_state( void* arg ) {
+  Bench_Result* state;
+  state = (Bench_Result*)malloc(sizeof( Bench_Result ));
+  state->n_recs   = 0;
+  state->n_bytes  = 0;
+  state->checksum = 0;
+  return state;
+}
+
+static void bench_do_batch( void* state, const FQ_Rec* recs, size_t n_recs,
+			    void* arg ) {
+  Bench_Result* res = (Bench_Result*)state;
+  size_t i;
+  for( i = 0; i < n_recs; i++ ) {
+    res->n_bytes  += recs[i].len;
+    res->checksum += rec_hash( &recs[i] );
+  }
+  res->n_recs += n_recs;
+}
+
+static void bench_merge_state( void* total, void* state, void* arg ) {
+  Bench_Result* t = (Bench_Result*)total;
+  Bench_Result* s = (Bench_Result*)state;
+  t->n_recs   += s->n_recs;
+  t->n_bytes  += s->n_bytes;
+  t->checksum += s->checksum;
+  free( s );
+}
+
+/* bench_fastq_pipe
+   Reads every record of fn with run_fq_pipeline on n_threads workers
+   Returns: 0 => copacetic; -1 => could not open or read fn
+*/
+int bench_fastq_pipe( const char fn[], int n_threads, Bench_Result* res ) {
+  FQ_Src* fq_source;
+  FQ_Pipe pipe;
+  Bench_Result* total;
+  int status;
+  set_fastq_inflate_threads( n_threads );
+  fq_source = init_fastq_src( fn );
+  if ( fq_source == NULL ) {
+    return -1;
+  }
+  pipe.n_threads   = n_threads;
+  pipe.batch_recs  = 0;
+  pipe.max_recs    = 0;
+  pipe.use_rec     = NULL;
+  pipe.arg         = NULL;
+  pipe.init_state  = bench_init_state;
+  pipe.do_batch    = bench_do_batch;
+  pipe.merge_state = bench_merge_state;
+  total = (Bench_Result*)run_fq_pipeline( fq_source, &pipe );
+  *res = *total;
+  free( total );
+  status = fq_source->error ? -1 : 0;
+  close_fastq_src( fq_source );
+  return status;
+}
+
+/* bench_fasta
+   Reads every sequence of fn with get_next_fa
+   Returns: 0 => copacetic; -1 => could not open fn
+*/
+int bench_fasta( const char fn[], int n_threads, Bench_Result* res ) {
+  Fa_Src* fa_source;
+  Genome* genome;
+  Seq* seq;
+  genome = init_genome();
+  fa_source = init_fasta_src( fn );
+  if ( fa_source == NULL ) {
+    return -1;
+  }
+  res->checksum = FNV_OFFSET;
+  while( (seq = get_next_fa( fa_source, genome )) != NULL ) {
+    res->n_bytes += seq->len;
+    res->checksum = fnv_update( res->checksum, seq->id, strlen( seq->id ) );
+    res->checksum = fnv_update( res->checksum, seq->seq, seq->len );
+  }
+  res->n_recs = fa_source->n;
+  close_fasta_src( fa_source );
+  return 0;
+}
+
+/* now_secs
+   Returns wall clock time in seconds
+*/
+double now_secs( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* run_reader
+   Runs reader on fn in a child process, so its peak memory is its
+   own, and gets its Bench_Result back through a pipe
+   Returns: 0 => copacetic; -1 => problem
+*/
+int run_reader( Reader_Fn reader, const char fn[], int n_threads,
+		Bench_Result* res, double* secs, long* max_rss ) {
+  struct rusage usage;
+  double start;
+  pid_t pid;
+  int fds[2];
+  int status;
+  ssize_t got;
+
+  if ( pipe( fds ) ) {
+    perror( "pipe" );
+    return -1;
+  }
+  start = now_secs();
+  pid = fork();
+  if ( pid == 0 ) {
+    close( fds[0] );
+    res->n_recs   = 0;
+    res->n_bytes  = 0;
+    res->checksum = 0;
+    status = reader( fn, n_threads, res );
+    if ( (status == 0) &&
+	 (write( fds[1], res, sizeof( Bench_Result ) ) !=
+	  sizeof( Bench_Result )) ) {
+      status = -1;
+    }
+    _exit( status ? 1 : 0 );
+  }
+  close( fds[1] );
+  got = read( fds[0], res, sizeof( Bench_Result ) );
+  close( fds[0] );
+  wait4( pid, &status, 0, &usage );
+  *secs    = now_secs() - start;
+  *max_rss = usage.ru_maxrss;
+  if ( (got != sizeof( Bench_Result )) || !WIFEXITED( status ) ||
+       (WEXITSTATUS( status ) != 0) ) {
+    fprintf( stderr, "Reading %s failed\n", fn );
+    return -1;
+  }
+  return 0;
+}
+
+/* run_tool
+   Runs argv in a child process with its stdout piped back here to
+   be hashed and its stderr thrown away
+   Returns: 0 => copacetic; -1 => problem
+*/
+int run_tool( char* const argv[], Bench_Result* res, double* secs,
+	      long* max_rss ) {
+  struct rusage usage;
+  char buf[65536];
+  double start;
+  pid_t pid;
+  int fds[2];
+  int status;
+  int null_fd;
+  ssize_t got;
+
+  if ( access( argv[0], X_OK ) ) {
+    fprintf( stderr, "No %s; skipping it\n", argv[0] );
+    return -1;
+  }
+  if ( pipe( fds ) ) {
+    perror( "pipe" );
+    return -1;
+  }
+  start = now_secs();
+  pid = fork();
+  if ( pid == 0 ) {
+    close( fds[0] );
+    dup2( fds[1], STDOUT_FILENO );
+    null_fd = open( "/dev/null", O_WRONLY );
+    dup2( null_fd, STDERR_FILENO );
+    execv( argv[0], argv );
+    _exit( 127 );
+  }
+  close( fds[1] );
+  res->n_recs   = 0;
+  res->n_bytes  = 0;
+  res->checksum = FNV_OFFSET;
+  while( (got = read( fds[0], buf, sizeof( buf ) )) > 0 ) {
+    res->checksum = fnv_update( res->checksum, buf, got );
+  }
+  close( fds[0] );
+  wait4( pid, &status, 0, &usage );
+  *secs    = now_secs() - start;
+  *max_rss = usage.ru_maxrss;
+  if ( !WIFEXITED( status ) || (WEXITSTATUS( status ) != 0) ) {
+    fprintf( stderr, "%s failed\n", argv[0] );
+    return -1;
+  }
+  return 0;
+}
+
+/* report
+   Prints one line of results and checks the checksum against ref.
+   Rates are worked out from n_recs records and n_bytes bases.
+   max_rss is in kilobytes, as getrusage gives it.
+*/
+void report( const char name[], const Bench_Result* res, size_t n_recs,
+	     size_t n_bytes, double secs, long max_rss, Bench_Sums* ref,
+	     Bench_Sums* seen, int* n_diff ) {
+  const char* mark = "";
+  size_t i;
+
+  for( i = 0; i < ref->n; i++ ) {
+    if ( strcmp( ref->names[i], name ) == 0 ) {
+      if ( ref->sums[i] == res->checksum ) {
+	mark = " ok";
+      }
+      else {
+	mark = " DIFFERS";
+	(*n_diff)++;
+      }
+      break;
+    }
+  }
+  if ( seen->n < MAX_CASES ) {
+    strcpy( seen->names[seen->n], name );
+    seen->sums[seen->n] = res->checksum;
+    seen->n++;
+  }
+  if ( secs <= 0 ) {
+    secs = 1e-9;
+  }
+  printf( "%-40s %10lu %8.3f %12.0f %9.1f %9.1f %016lx%s\n", name, n_recs,
+	  secs, n_recs / secs, n_bytes / secs / 1e6, max_rss / 1024.0,
+	  res->checksum, mark );
+  fflush( stdout );
+}
+
+/* read_sums
+   Reads case names and checksums from fn; none if it is not there
+*/
+void read_sums( const char fn[], Bench_Sums* sums ) {
+  FILE* fp;
+  fp = fopen( fn, "r" );
+  sums->n = 0;
+  if ( fp == NULL ) {
+    return;
+  }
+  while( (sums->n < MAX_CASES) &&
+	 (fscanf( fp, "%255s %lx", sums->names[sums->n],
+		  &sums->sums[sums->n] ) == 2) ) {
+    sums->n++;
+  }
+  fclose( fp );
+}
+
+/* write_sums
+   Writes case names and checksums to fn
+*/
+void write_sums( const char fn[], const Bench_Sums* sums ) {
+  FILE* fp;
+  size_t i;
+  fp = fileOpen( fn, "w" );
+  if ( fp == NULL ) {
+    return;
+  }
+  for( i = 0; i < sums->n; i++ ) {
+    fprintf( fp, "%s %016lx\n", sums->names[i], sums->sums[i] );
+  }
+  fclose( fp );
+}
+
+/* base_name
+   Returns the part of fn after the last /
+*/
+const char* base_name( const char fn[] ) {
+  const char* slash;
+  slash = strrchr( fn, '/' );
+  return ( slash == NULL ) ? fn : slash + 1;
+}
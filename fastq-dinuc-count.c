@@ -3,31 +3,142 @@
 #include <ctype.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
 #include "fastq-io.h"
+#include "kmer.h"
 
 #define DEBUG (0)
 #define L_DEF (167)
-
-typedef struct dinucs {
-  unsigned int dinuc_counts[17];
-} Dinucs;
-typedef struct dinucs* DNP;
-
+#define CTX_DEF (2)
+#define MAX_CTX (4)
+#define PLOT_WINDOW (15)
+
+/* Dinuc_array counts the contexts (ctx bases in a row; 2 for
+   dinucleotides) starting at each position of the reads, in one
+   block of 64-bit counts, position-major: row i is position i,
+   with a column for each of the 4^ctx contexts (A=00, C=01, G=10,
+   T=11, first base in the high bits, as in kmer.h) and a last
+   column for contexts with anything but A, C, G, or T in them.
+   It is for reads of length len or shorter, so it has len rows;
+   the last ctx - 1 are never counted in. */
 typedef struct dinuc_array {
-  DNP* dnps;
+  uint64_t* counts;
   size_t len;
+  unsigned int ctx;
+  size_t n_cols; // 4^ctx + 1
 } Dinuc_array;
 typedef struct dinuc_array* DiNucArray;
-
-DiNucArray init_DiNucArray( const int length );
-void update_DNA( DiNucArray DNA, const FQ* fq_seq_p );
-size_t get_dinuc_inx( const char* dinuc );
-void write_DNA( const DiNucArray DNA, const int length, const char out_fn_root[] );
-void make_gnuplot_plot( const char out_fn_root[], const int length );
+#define DNA_ROW(DNA, i) (&(DNA)->counts[(i) * (DNA)->n_cols])
+
+/* Dinuc_set holds a Dinuc_array for each bin of read lengths,
+   made when the first read in the bin shows up, so every length
+   is counted in one pass. Bin b is reads of length b * width to
+   b * width + width - 1; its table is as long as the longest of
+   them. With a width of 1 there is a table for each length. */
+typedef struct dinuc_set {
+  DiNucArray* bins; // NULL => no read in this bin yet
+  size_t n_bins;
+  int width;
+  unsigned int ctx;
+} Dinuc_set;
+typedef struct dinuc_set* DiNucSet;
+
+/* Dinuc_ends counts the contexts of reads of every length by
+   where they are from either end, for damage and ligation bias
+   that shows up at the ends whatever the length. Row i of five is
+   the context starting i bases from the 5' end; row i of three is
+   the context starting window - i bases from the 3' end, so the
+   last row with counts ends at the last base. Only contexts all
+   in the first (or last) window bases are counted. */
+typedef struct dinuc_ends {
+  DiNucArray five;
+  DiNucArray three;
+  int window;
+} Dinuc_ends;
+typedef struct dinuc_ends* DiNucEnds;
+
+/* What the workers need to know */
+typedef struct dinuc_opts {
+  int length; // of the reads to count, if not all_lens
+  int all_lens;
+  int width; // of the length bins, if all_lens
+  unsigned int ctx; // context size
+  int window; // > 0 => count from the ends, in windows this wide
+} Dinuc_opts;
+
+/* Dinuc_files is the -f list, counted by up to n_workers file
+   workers at once. Each worker takes the next file not yet taken,
+   runs it through its own run_fq_pipeline, and keeps the result
+   (a DiNucArray, with -a a DiNucSet, or with -w a DiNucEnds)
+   in counts[] at the file's place in the list, so main can merge
+   them in list order and the output is the same as reading the
+   files one after another. Files after one that cannot be opened
+   are not counted, as they would not be one after another. */
+typedef struct dinuc_files {
+  char** fns;
+  size_t n_files;
+  size_t next_file;
+  size_t stop; // first file that could not be opened, or n_files
+  int read_error; // some file could not be read to the end
+  void** counts; // NULL => not counted
+  size_t* n; // sequences examined in each file
+  pthread_mutex_t lock;
+} Dinuc_files;
+
+/* Dinuc_worker is one file worker, with its share of the threads */
+typedef struct dinuc_worker {
+  Dinuc_files* files;
+  FQ_Pipe pipe;
+  pthread_t thread;
+} Dinuc_worker;
+
+DiNucArray init_DiNucArray( const int length, const unsigned int ctx );
+void free_DNA( DiNucArray DNA );
+void merge_DNA( DiNucArray total, const DiNucArray DNA );
+void update_DNA( DiNucArray DNA, const FQ_Rec* fq_seq_p );
+void update_DNA_range( DiNucArray DNA, const FQ_Rec* fq_seq_p,
+		       const size_t start, const size_t end,
+		       const size_t row0 );
+DiNucSet init_DiNucSet( const int width, const unsigned int ctx );
+void free_DNS( DiNucSet DNS );
+void merge_DNS( DiNucSet total, DiNucSet DNS );
+void update_DNS( DiNucSet DNS, const FQ_Rec* fq_seq_p );
+void write_DNS( const DiNucSet DNS, const char out_fn_root[],
+		const int make_plot );
+DiNucEnds init_DiNucEnds( const int window, const unsigned int ctx );
+void free_DNE( DiNucEnds DNE );
+void merge_DNE( DiNucEnds total, DiNucEnds DNE );
+void update_DNE( DiNucEnds DNE, const FQ_Rec* fq_seq_p );
+void write_DNE( const DiNucEnds DNE, const char out_fn_root[],
+		const int make_plot );
+void write_DNA( const DiNucArray DNA, const char reads[], const long first_pos,
+		const char out_fn_root[] );
+void make_gnuplot_plot( const char out_fn_root[], const int length,
+			const int window, const int ends );
+void* dinuc_init_state( void* arg );
+void dinuc_do_batch( void* state, const FQ_Rec* recs, size_t n_recs,
+		     void* arg );
+void dinuc_merge_state( void* total, void* state, void* arg );
+void* dinuc_set_init_state( void* arg );
+void dinuc_set_do_batch( void* state, const FQ_Rec* recs, size_t n_recs,
+			 void* arg );
+void dinuc_set_merge_state( void* total, void* state, void* arg );
+void* dinuc_ends_init_state( void* arg );
+void dinuc_ends_do_batch( void* state, const FQ_Rec* recs, size_t n_recs,
+			  void* arg );
+void dinuc_ends_merge_state( void* total, void* state, void* arg );
+void* dinuc_file_worker( void* arg );
 
 void help( void ) {
   printf( "fastq-dinuc-count -f <fastq file> -l <length>\n" );
   printf( "                  -e <write output files to this name>\n" );
+  printf( "                  -t <threads; default = 1>\n" );
+  printf( "                  -a count reads of every length, not just -l\n" );
+  printf( "                  -b <with -a, pool lengths in bins this wide>\n" );
+  printf( "                  -c <context size; 1 to %d; default = %d>\n",
+	  MAX_CTX, CTX_DEF );
+  printf( "                  -w <count reads of every length from both ends,\n" );
+  printf( "                      this many bases in from each>\n" );
   printf( "Makes a table of the observed dinucleotides in sequences\n" );
   printf( "of a defined length in a fastq file. Input file can be\n" );
   printf( "gzipped or not.\n" );
@@ -43,6 +154,22 @@ void help( void ) {
   printf( "       made with this prefix. These files contain the data table (.dat)\n" );
   printf( "       and an Encapsulated Postscript File (.eps) with an image of\n" );
   printf( "       the results.\n" );
+  printf( "       With -a, all the reads are read once and there is a table\n" );
+  printf( "       for each length seen (or, with -b, for each bin of lengths,\n" );
+  printf( "       with positions up to the longest in the bin). The tables go\n" );
+  printf( "       to stdout one after another, or with -e to a .dat (and .eps)\n" );
+  printf( "       for each, named <prefix>.<length> or <prefix>.<from>-<to>.\n" );
+  printf( "       With -c, contexts of that many bases are counted instead of\n" );
+  printf( "       dinucleotides, e.g., -c 3 for trinucleotides, at the same\n" );
+  printf( "       cost per read; the .eps plot is only made for -c 2.\n" );
+  printf( "       With -t and more than one file in the -f list, up to that\n" );
+  printf( "       many files are read at once, sharing the threads.\n" );
+  printf( "       With -w, reads of all lengths are counted in two tables,\n" );
+  printf( "       by position from the 5' end (0 is the first base) and\n" );
+  printf( "       from the 3' end (-n starts n bases before the end), only\n" );
+  printf( "       looking at the first and last -w bases of each read.\n" );
+  printf( "       With -e they go to <prefix>.5p.dat and <prefix>.3p.dat,\n" );
+  printf( "       and the plot shows that many bases at each end.\n" );
   exit( 0 );
 }
 
@@ -50,18 +177,28 @@ int main ( int argc, char* argv[] ) {
   extern char* optarg;
   char fq_in[MAX_FN_LEN+1] = {'\0'};
   char out_fn_root[MAX_FN_LEN+1] = {'\0'};
+  char reads[MAX_FN_LEN+1];
+  const char delimiters[] = ":";
   char* fq_fn;
-  FILE* fq;
-  gzFile fqgz;
   int length = L_DEF;
-  DiNucArray DNA;
-  FQ_Src* fq_source;
-  FQ fq_seq;
+  DiNucArray DNA = NULL;
+  DiNucSet DNS = NULL;
+  DiNucEnds DNE = NULL;
+  Dinuc_opts opts;
+  Dinuc_files files;
+  FQ_Pipe pipe;
+  Dinuc_worker* file_workers;
+  size_t i;
   int ich;
+  int n_threads = 1;
+  int n_workers;
   int make_plot = 0;
-  char delimiter = ':';
-  
-  while( (ich=getopt( argc, argv, "f:l:e:" )) != -1 ) {
+
+  opts.all_lens = 0;
+  opts.width    = 1;
+  opts.ctx      = CTX_DEF;
+  opts.window   = 0;
+  while( (ich=getopt( argc, argv, "f:l:e:t:ab:c:w:" )) != -1 ) {
     switch(ich) {
     case 'f' :
       strcpy( fq_in, optarg );
@@ -73,69 +210,566 @@ int main ( int argc, char* argv[] ) {
       strcpy( out_fn_root, optarg );
       make_plot = 1;
       break;
+    case 't' :
+      n_threads = atoi( optarg );
+      break;
+    case 'a' :
+      opts.all_lens = 1;
+      break;
+    case 'b' :
+      opts.width    = atoi( optarg );
+      opts.all_lens = 1;
+      break;
+    case 'c' :
+      opts.ctx = atoi( optarg );
+      break;
+    case 'w' :
+      opts.window = atoi( optarg );
+      if ( opts.window < 1 ) {
+	help();
+      }
+      break;
     default :
       help();
     }
   }
 
-  DNA = init_DiNucArray( length );
-  fq_fn = strtok( fq_in, &delimiter );
-  fq_source = init_fastq_src( fq_fn );
-  if ( fq_source == NULL ) {
+  if ( (opts.width < 1) || (opts.ctx < 1) || (opts.ctx > MAX_CTX) ) {
     help();
   }
-  while( fq_source != NULL ) {
-    fprintf( stderr, "Examining %s... ", fq_source->fn );
-    while( get_next_fq( fq_source, &fq_seq ) == 0 ) {
-      if ( fq_seq.len == length ) {
-	update_DNA( DNA, &fq_seq );
-      }
+  if ( opts.all_lens && (opts.window > 0) ) {
+    help();
+  }
+  if ( opts.ctx != 2 ) {
+    make_plot = 0;
+  }
+  opts.length = length;
+  pipe.n_threads   = n_threads;
+  pipe.batch_recs  = 0;
+  pipe.max_recs    = 0;
+  pipe.use_rec     = NULL;
+  pipe.arg         = &opts;
+  if ( opts.window > 0 ) {
+    DNE = init_DiNucEnds( opts.window, opts.ctx );
+    pipe.init_state  = dinuc_ends_init_state;
+    pipe.do_batch    = dinuc_ends_do_batch;
+    pipe.merge_state = dinuc_ends_merge_state;
+  }
+  else if ( opts.all_lens ) {
+    DNS = init_DiNucSet( opts.width, opts.ctx );
+    pipe.init_state  = dinuc_set_init_state;
+    pipe.do_batch    = dinuc_set_do_batch;
+    pipe.merge_state = dinuc_set_merge_state;
+  }
+  else {
+    DNA = init_DiNucArray( length, opts.ctx );
+    pipe.init_state  = dinuc_init_state;
+    pipe.do_batch    = dinuc_do_batch;
+    pipe.merge_state = dinuc_merge_state;
+  }
+  files.n_files = 0;
+  files.fns = (char**)malloc(sizeof(char*) * (strlen( fq_in ) / 2 + 1));
+  for( fq_fn = strtok( fq_in, delimiters ); fq_fn != NULL;
+       fq_fn = strtok( NULL, delimiters ) ) {
+    files.fns[files.n_files++] = fq_fn;
+  }
+  if ( files.n_files == 0 ) {
+    help();
+  }
+
+  /* Split the threads between the files read at once, the first
+     workers getting one more when they do not split evenly; with
+     more than one, each file also gets the even share for BGZF
+     inflating rather than one per processor */
+  n_workers = ( n_threads < (int)files.n_files ) ? n_threads : files.n_files;
+  if ( n_workers < 1 ) {
+    n_workers = 1;
+  }
+  if ( n_workers > 1 ) {
+    set_fastq_inflate_threads( n_threads / n_workers );
+  }
+  files.next_file = 0;
+  files.stop   = files.n_files;
+  files.read_error = 0;
+  files.counts = (void**)calloc( files.n_files, sizeof(void*) );
+  files.n      = (size_t*)calloc( files.n_files, sizeof(size_t) );
+  pthread_mutex_init( &files.lock, NULL );
+  file_workers = (Dinuc_worker*)malloc(sizeof(Dinuc_worker) * n_workers);
+  for( i = 0; i < (size_t)n_workers; i++ ) {
+    file_workers[i].files = &files;
+    file_workers[i].pipe  = pipe;
+    if ( n_workers > 1 ) {
+      file_workers[i].pipe.n_threads = n_threads / n_workers +
+	( (int)i < n_threads % n_workers );
+    }
+    pthread_create( &file_workers[i].thread, NULL, dinuc_file_worker,
+		    &file_workers[i] );
+  }
+  for( i = 0; i < (size_t)n_workers; i++ ) {
+    pthread_join( file_workers[i].thread, NULL );
+  }
+  free( file_workers );
+  pthread_mutex_destroy( &files.lock );
+  if ( files.read_error ) {
+    exit( 1 );
+  }
+
+  /* Merge in list order, stopping at the first file that could
+     not be opened */
+  if ( files.counts[0] == NULL ) {
+    help();
+  }
+  for( i = 0; (i < files.n_files) && (files.counts[i] != NULL); i++ ) {
+    fprintf( stderr, "Examining %s... ", files.fns[i] );
+    if ( opts.window > 0 ) {
+      merge_DNE( DNE, (DiNucEnds)files.counts[i] );
+    }
+    else if ( opts.all_lens ) {
+      merge_DNS( DNS, (DiNucSet)files.counts[i] );
     }
-    fprintf( stderr, " %lu sequences examined.\n", fq_source->n );
-    fq_fn = strtok( NULL, &delimiter );
-    fq_source = reset_fastq_src( fq_fn, fq_source );
+    else {
+      merge_DNA( DNA, (DiNucArray)files.counts[i] );
+      free_DNA( (DiNucArray)files.counts[i] );
+    }
+    fprintf( stderr, " %lu sequences examined.\n", files.n[i] );
+  }
+  for( ; i < files.n_files; i++ ) {
+    if ( i > files.stop ) {
+      fprintf( stderr, "Skipping %s after %s could not be opened\n",
+	       files.fns[i], files.fns[files.stop] );
+    }
+    if ( files.counts[i] == NULL ) {
+      continue;
+    }
+    if ( opts.window > 0 ) {
+      free_DNE( (DiNucEnds)files.counts[i] );
+    }
+    else if ( opts.all_lens ) {
+      free_DNS( (DiNucSet)files.counts[i] );
+    }
+    else {
+      free_DNA( (DiNucArray)files.counts[i] );
+    }
+  }
+  free( files.counts );
+  free( files.n );
+  free( files.fns );
+
+  if ( opts.window > 0 ) {
+    write_DNE( DNE, out_fn_root, make_plot );
+    exit( 0 );
+  }
+  if ( opts.all_lens ) {
+    write_DNS( DNS, out_fn_root, make_plot );
+    exit( 0 );
   }
-  write_DNA( DNA, length, out_fn_root );
+  snprintf( reads, MAX_FN_LEN, "on reads of length %d", length );
+  write_DNA( DNA, reads, 0, out_fn_root );
   if ( make_plot ) {
-    make_gnuplot_plot( out_fn_root, length );
+    make_gnuplot_plot( out_fn_root, length, PLOT_WINDOW, 0 );
   }
   exit( 0 );
 }
 
-void update_DNA( DiNucArray DNA, const FQ* fq_seq_p ) {
-  size_t i = 0;
+/* Callbacks for run_fq_pipeline. Each worker counts into its
+   own DiNucArray; arg points at the Dinuc_opts. */
+void* dinuc_init_state( void* arg ) {
+  return init_DiNucArray( ((Dinuc_opts*)arg)->length,
+			  ((Dinuc_opts*)arg)->ctx );
+}
+
+void dinuc_do_batch( void* state, const FQ_Rec* recs, size_t n_recs,
+		     void* arg ) {
+  size_t i;
+  int length = ((Dinuc_opts*)arg)->length;
+  for( i = 0; i < n_recs; i++ ) {
+    if ( recs[i].len == length ) {
+      update_DNA( (DiNucArray)state, &recs[i] );
+    }
+  }
+}
+
+void dinuc_merge_state( void* total, void* state, void* arg ) {
+  merge_DNA( (DiNucArray)total, (DiNucArray)state );
+  free_DNA( (DiNucArray)state );
+}
+
+/* Callbacks for -a; each worker counts into its own DiNucSet */
+void* dinuc_set_init_state( void* arg ) {
+  return init_DiNucSet( ((Dinuc_opts*)arg)->width, ((Dinuc_opts*)arg)->ctx );
+}
+
+void dinuc_set_do_batch( void* state, const FQ_Rec* recs, size_t n_recs,
+			 void* arg ) {
+  size_t i;
+  for( i = 0; i < n_recs; i++ ) {
+    update_DNS( (DiNucSet)state, &recs[i] );
+  }
+}
+
+void dinuc_set_merge_state( void* total, void* state, void* arg ) {
+  merge_DNS( (DiNucSet)total, (DiNucSet)state );
+}
+
+/* Callbacks for -w; each worker counts into its own DiNucEnds */
+void* dinuc_ends_init_state( void* arg ) {
+  return init_DiNucEnds( ((Dinuc_opts*)arg)->window,
+			 ((Dinuc_opts*)arg)->ctx );
+}
+
+void dinuc_ends_do_batch( void* state, const FQ_Rec* recs, size_t n_recs,
+			  void* arg ) {
+  size_t i;
+  for( i = 0; i < n_recs; i++ ) {
+    update_DNE( (DiNucEnds)state, &recs[i] );
+  }
+}
+
+void dinuc_ends_merge_state( void* total, void* state, void* arg ) {
+  merge_DNE( (DiNucEnds)total, (DiNucEnds)state );
+}
+
+/* dinuc_file_worker
+   Args: void* arg - this worker's Dinuc_worker
+   Counts files from the list until none are left, or one could
+   not be opened
+*/
+void* dinuc_file_worker( void* arg ) {
+  Dinuc_worker* worker = (Dinuc_worker*)arg;
+  Dinuc_files* files = worker->files;
+  FQ_Src* fq_source;
+  size_t i;
+
+  while( 1 ) {
+    pthread_mutex_lock( &files->lock );
+    i = files->next_file++;
+    if ( i >= files->stop ) {
+      pthread_mutex_unlock( &files->lock );
+      return NULL;
+    }
+    pthread_mutex_unlock( &files->lock );
+    fq_source = init_fastq_src( files->fns[i] );
+    if ( fq_source == NULL ) {
+      pthread_mutex_lock( &files->lock );
+      if ( i < files->stop ) {
+	files->stop = i;
+      }
+      pthread_mutex_unlock( &files->lock );
+      return NULL;
+    }
+    fq_source->pack = 1;
+    files->counts[i] = run_fq_pipeline( fq_source, &worker->pipe );
+    files->n[i] = fq_source->n;
+    if ( fq_source->error ) {
+      pthread_mutex_lock( &files->lock );
+      files->read_error = 1;
+      if ( i < files->stop ) {
+	files->stop = i;
+      }
+      pthread_mutex_unlock( &files->lock );
+    }
+    close_fastq_src( fq_source );
+  }
+}
+
+/* count_contexts
+   Counts each context of ctx bases in bases start to end - 1 of
+   the read, the first at row row0 and each after it a row down.
+   The context index rolls along the read, two bits a base, and
+   a count of the good bases in a row says whether the last ctx
+   were all A, C, G, or T, so the cost per base does not depend
+   on ctx. A packed read is read straight from its 2-bit codes
+   and N-mask. Always inlined, and only called with a constant
+   ctx, so each context size gets its own loop with the masks
+   and row width known at compile time.
+*/
+static inline __attribute__((always_inline))
+void count_contexts( DiNucArray DNA, const FQ_Rec* fq_seq_p,
+		     const size_t start, const size_t end,
+		     const size_t row0, const unsigned int ctx ) {
+  const size_t n_cols = ((size_t)1 << (2 * ctx)) + 1;
+  const size_t mask   = n_cols - 2;
+  uint64_t* row = &DNA->counts[row0 * n_cols];
   size_t inx = 0;
-  char b;
-  
-  for( i = 0; i < (fq_seq_p->len - 1); i++ ) {
-    inx = get_dinuc_inx( &(fq_seq_p->seq[i]) );
-    DNA->dnps[i]->dinuc_counts[inx]++;
+  size_t i;
+  unsigned int c, good = 0;
+
+  if ( fq_seq_p->pack != NULL ) {
+    for( i = start; i < end; i++ ) {
+      if ( packed_n( fq_seq_p->nmask, i ) ) {
+	good = 0;
+      }
+      else {
+	inx = ((inx << 2) | packed_base( fq_seq_p->pack, i )) & mask;
+	good++;
+      }
+      if ( i + 1 >= start + ctx ) {
+	row[( good >= ctx ) ? inx : n_cols - 1]++;
+	row += n_cols;
+      }
+    }
+    return;
+  }
+  for( i = start; i < end; i++ ) {
+    c = base_code[(unsigned char)fq_seq_p->seq[i]];
+    if ( c == KMER_BAD_BASE ) {
+      good = 0;
+    }
+    else {
+      inx = ((inx << 2) | c) & mask;
+      good++;
+    }
+    if ( i + 1 >= start + ctx ) {
+      row[( good >= ctx ) ? inx : n_cols - 1]++;
+      row += n_cols;
+    }
+  }
+}
+
+/* Counts each context of the read at its position; the read must
+   be no longer than the table */
+void update_DNA( DiNucArray DNA, const FQ_Rec* fq_seq_p ) {
+  update_DNA_range( DNA, fq_seq_p, 0, fq_seq_p->len, 0 );
+}
+
+/* Counts the contexts in bases start to end - 1 of the read into
+   rows row0 on; the rows must fit in the table */
+void update_DNA_range( DiNucArray DNA, const FQ_Rec* fq_seq_p,
+		       const size_t start, const size_t end,
+		       const size_t row0 ) {
+  switch( DNA->ctx ) {
+  case 1 :
+    count_contexts( DNA, fq_seq_p, start, end, row0, 1 );
+    break;
+  case 2 :
+    count_contexts( DNA, fq_seq_p, start, end, row0, 2 );
+    break;
+  case 3 :
+    count_contexts( DNA, fq_seq_p, start, end, row0, 3 );
+    break;
+  case 4 :
+    count_contexts( DNA, fq_seq_p, start, end, row0, 4 );
+    break;
   }
 }
 
-DiNucArray init_DiNucArray( const int length ) {
+DiNucArray init_DiNucArray( const int length, const unsigned int ctx ) {
   DiNucArray DNA;
-  size_t i, inx;
 
   DNA = (DiNucArray)malloc(sizeof(Dinuc_array));
-  DNA->dnps = (DNP*)malloc(sizeof(DNP) * length);
-  DNA->len = length;
+  DNA->len    = length;
+  DNA->ctx    = ctx;
+  DNA->n_cols = ((size_t)1 << (2 * ctx)) + 1;
+  DNA->counts = (uint64_t*)calloc( DNA->len * DNA->n_cols,
+				   sizeof(uint64_t) );
+  return DNA;
+}
+
+/* Adds the counts in DNA to total; both must be the same length
+   and context size */
+void merge_DNA( DiNucArray total, const DiNucArray DNA ) {
+  size_t i;
+  for( i = 0; i < DNA->len * DNA->n_cols; i++ ) {
+    total->counts[i] += DNA->counts[i];
+  }
+}
 
-  for( i = 0; i < length; i++ ) {
-    DNA->dnps[i] = (DNP)malloc(sizeof(Dinucs));
-    for( inx = 0; inx < 17; inx++ ) {
-      DNA->dnps[i]->dinuc_counts[inx] = 0;
+DiNucSet init_DiNucSet( const int width, const unsigned int ctx ) {
+  DiNucSet DNS;
+  DNS = (DiNucSet)malloc(sizeof(Dinuc_set));
+  DNS->bins   = NULL;
+  DNS->n_bins = 0;
+  DNS->width  = width;
+  DNS->ctx    = ctx;
+  return DNS;
+}
+
+/* Counts the read in the table of its length bin, making the
+   table (and room for it) if this is the first read in the bin */
+void update_DNS( DiNucSet DNS, const FQ_Rec* fq_seq_p ) {
+  size_t bin, i;
+  if ( fq_seq_p->len < 2 ) {
+    return;
+  }
+  bin = fq_seq_p->len / DNS->width;
+  if ( bin >= DNS->n_bins ) {
+    DNS->bins = (DiNucArray*)realloc( DNS->bins,
+				      sizeof(DiNucArray) * (bin + 1) );
+    for( i = DNS->n_bins; i <= bin; i++ ) {
+      DNS->bins[i] = NULL;
     }
+    DNS->n_bins = bin + 1;
   }
-  return DNA;
+  if ( DNS->bins[bin] == NULL ) {
+    DNS->bins[bin] = init_DiNucArray( (bin + 1) * DNS->width - 1, DNS->ctx );
+  }
+  update_DNA( DNS->bins[bin], fq_seq_p );
+}
+
+/* Adds the counts in DNS to total, which must have the same bin
+   width, and frees DNS. Tables total does not have yet are just
+   moved over. */
+void merge_DNS( DiNucSet total, DiNucSet DNS ) {
+  size_t bin, i;
+  if ( DNS->n_bins > total->n_bins ) {
+    total->bins = (DiNucArray*)realloc( total->bins,
+					sizeof(DiNucArray) * DNS->n_bins );
+    for( i = total->n_bins; i < DNS->n_bins; i++ ) {
+      total->bins[i] = NULL;
+    }
+    total->n_bins = DNS->n_bins;
+  }
+  for( bin = 0; bin < DNS->n_bins; bin++ ) {
+    if ( DNS->bins[bin] == NULL ) {
+      continue;
+    }
+    if ( total->bins[bin] == NULL ) {
+      total->bins[bin] = DNS->bins[bin];
+    }
+    else {
+      merge_DNA( total->bins[bin], DNS->bins[bin] );
+      free_DNA( DNS->bins[bin] );
+    }
+  }
+  DNS->n_bins = 0;
+  free_DNS( DNS );
+}
+
+void free_DNS( DiNucSet DNS ) {
+  size_t bin;
+  for( bin = 0; bin < DNS->n_bins; bin++ ) {
+    if ( DNS->bins[bin] != NULL ) {
+      free_DNA( DNS->bins[bin] );
+    }
+  }
+  free( DNS->bins );
+  free( DNS );
 }
 
-void write_DNA( const DiNucArray DNA, const int length, const char out_fn_root[] ) {
-  size_t i, inx;
+/* Writes each table of DNS, shortest lengths first: to stdout one
+   after the other, or to its own files named for its lengths if
+   out_fn_root is given */
+void write_DNS( const DiNucSet DNS, const char out_fn_root[],
+		const int make_plot ) {
+  char fn_root[MAX_FN_LEN+1];
+  char reads[MAX_FN_LEN+1];
+  size_t bin, n_written = 0;
+  int min_len, max_len;
+  for( bin = 0; bin < DNS->n_bins; bin++ ) {
+    if ( DNS->bins[bin] == NULL ) {
+      continue;
+    }
+    min_len = bin * DNS->width;
+    max_len = (bin + 1) * DNS->width - 1;
+    if ( min_len < 2 ) {
+      min_len = 2;
+    }
+    fn_root[0] = '\0';
+    if ( strlen( out_fn_root ) > 0 ) {
+      if ( min_len == max_len ) {
+	snprintf( fn_root, MAX_FN_LEN, "%s.%d", out_fn_root, max_len );
+      }
+      else {
+	snprintf( fn_root, MAX_FN_LEN, "%s.%d-%d", out_fn_root,
+		  min_len, max_len );
+      }
+    }
+    /* Two blank lines start a new gnuplot data block */
+    if ( (strlen( fn_root ) == 0) && (n_written > 0) ) {
+      printf( "\n\n" );
+    }
+    if ( min_len == max_len ) {
+      snprintf( reads, MAX_FN_LEN, "on reads of length %d", max_len );
+    }
+    else {
+      snprintf( reads, MAX_FN_LEN, "on reads of length %d to %d",
+		min_len, max_len );
+    }
+    write_DNA( DNS->bins[bin], reads, 0, fn_root );
+    n_written++;
+    if ( make_plot ) {
+      make_gnuplot_plot( fn_root, max_len, PLOT_WINDOW, 0 );
+    }
+  }
+}
+
+DiNucEnds init_DiNucEnds( const int window, const unsigned int ctx ) {
+  DiNucEnds DNE;
+  DNE = (DiNucEnds)malloc(sizeof(Dinuc_ends));
+  DNE->five   = init_DiNucArray( window, ctx );
+  DNE->three  = init_DiNucArray( window, ctx );
+  DNE->window = window;
+  return DNE;
+}
+
+/* Counts the contexts in the first and last window bases of the
+   read; a read shorter than the window is all in both */
+void update_DNE( DiNucEnds DNE, const FQ_Rec* fq_seq_p ) {
+  size_t n = fq_seq_p->len;
+  if ( n > (size_t)DNE->window ) {
+    n = DNE->window;
+  }
+  update_DNA_range( DNE->five, fq_seq_p, 0, n, 0 );
+  update_DNA_range( DNE->three, fq_seq_p, fq_seq_p->len - n, fq_seq_p->len,
+		    DNE->window - n );
+}
+
+/* Adds the counts in DNE to total, which must have the same window
+   and context size, and frees DNE */
+void merge_DNE( DiNucEnds total, DiNucEnds DNE ) {
+  merge_DNA( total->five, DNE->five );
+  merge_DNA( total->three, DNE->three );
+  free_DNE( DNE );
+}
+
+void free_DNE( DiNucEnds DNE ) {
+  free_DNA( DNE->five );
+  free_DNA( DNE->three );
+  free( DNE );
+}
+
+/* Writes the 5' table, then the 3' table: to stdout one after the
+   other, or to <out_fn_root>.5p.dat and .3p.dat */
+void write_DNE( const DiNucEnds DNE, const char out_fn_root[],
+		const int make_plot ) {
+  char fn_root[MAX_FN_LEN+1] = {'\0'};
+  if ( strlen( out_fn_root ) > 0 ) {
+    snprintf( fn_root, MAX_FN_LEN, "%s.5p", out_fn_root );
+  }
+  write_DNA( DNE->five, "from the 5' end of reads", 0, fn_root );
+  if ( strlen( out_fn_root ) > 0 ) {
+    snprintf( fn_root, MAX_FN_LEN, "%s.3p", out_fn_root );
+  }
+  else {
+    printf( "\n\n" );
+  }
+  write_DNA( DNE->three, "from the 3' end of reads", -(long)DNE->window,
+	     fn_root );
+  if ( make_plot ) {
+    make_gnuplot_plot( out_fn_root, 0, DNE->window, 1 );
+  }
+}
+
+void free_DNA( DiNucArray DNA ) {
+  free( DNA->counts );
+  free( DNA );
+}
+
+/* Writes the counts at each position, and how each differs from
+   the average over the positions. reads says which reads were
+   counted, for the title; positions are numbered from first_pos. */
+void write_DNA( const DiNucArray DNA, const char reads[], const long first_pos,
+		const char out_fn_root[] ) {
+  static const char* ctx_names[MAX_CTX+1] =
+    { "", "Mononucleotides", "Dinucleotides", "Trinucleotides",
+      "Tetranucleotides" };
+  static const char bases[4] = { 'A', 'C', 'G', 'T' };
+  size_t i, inx, n_pos;
+  unsigned int j;
   FILE* out_fh;
   char dat_fn[ MAX_FN_LEN+1 ] = {'\0'};
-  unsigned int totals[17] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-			      0, 0, 0, 0, 0, 0, 0 };
+  uint64_t* totals;
+  const uint64_t* row;
 
   if ( strlen( out_fn_root ) == 0 ) {
     out_fh = stdout;
@@ -149,94 +783,87 @@ void write_DNA( const DiNucArray DNA, const int length, const char out_fn_root[]
       exit( 1 );
     }
   }
-  
-  /* Find the total counts over all positions for each dinucleotide */
-  for( i = 0; i < (DNA->len - 1); i++ ) {
-    for( inx = 0; inx < 16; inx++ ) {
-      totals[inx] += DNA->dnps[i]->dinuc_counts[inx];
+
+  /* Positions a context can start at */
+  n_pos = ( DNA->len >= DNA->ctx ) ? DNA->len - DNA->ctx + 1 : 0;
+
+  /* Find the total counts over all positions for each context */
+  totals = (uint64_t*)calloc( DNA->n_cols, sizeof(uint64_t) );
+  for( i = 0; i < n_pos; i++ ) {
+    row = DNA_ROW( DNA, i );
+    for( inx = 0; inx < DNA->n_cols - 1; inx++ ) {
+      totals[inx] += row[inx];
     }
   }
 
-  fprintf( out_fh, "#Dinucleotides counts at each position on reads of length %d\n", length );
-  fprintf( out_fh, "#POS AA AC AG AT CA CC CG CT GA GC GG GT TA TC TG TT NN\n" );
-  for( i = 0; i < (DNA->len - 1); i++ ) {
-    fprintf( out_fh, "%lu ", i );
-    for( inx = 0; inx < 16; inx++ ) {
-      fprintf( out_fh, "%u ", DNA->dnps[i]->dinuc_counts[inx] );
+  fprintf( out_fh, "#%s counts at each position %s\n",
+	   ctx_names[DNA->ctx], reads );
+  /* Column names, in index order: the first base is the high bits */
+  fprintf( out_fh, "#POS" );
+  for( inx = 0; inx < DNA->n_cols - 1; inx++ ) {
+    fprintf( out_fh, " " );
+    for( j = DNA->ctx; j > 0; j-- ) {
+      fprintf( out_fh, "%c", bases[(inx >> (2 * (j - 1))) & 3] );
     }
-    fprintf( out_fh, "%u\n", DNA->dnps[i]->dinuc_counts[inx] );
+  }
+  fprintf( out_fh, " " );
+  for( j = 0; j < DNA->ctx; j++ ) {
+    fprintf( out_fh, "N" );
+  }
+  fprintf( out_fh, "\n" );
+  for( i = 0; i < n_pos; i++ ) {
+    row = DNA_ROW( DNA, i );
+    fprintf( out_fh, "%ld ", first_pos + (long)i );
+    for( inx = 0; inx < DNA->n_cols - 1; inx++ ) {
+      fprintf( out_fh, "%lu ", row[inx] );
+    }
+    fprintf( out_fh, "%lu\n", row[inx] );
   }
   
   fprintf( out_fh, "\n\n" );
-  fprintf( out_fh, "# Dinucleotides enrichment/depletion from average\n" );
-  for( i = 0; i < (DNA->len - 1); i++ ) {
-    fprintf( out_fh, "%lu ", i );
-    for( inx = 0; inx < 16; inx++ ) {
+  fprintf( out_fh, "# %s enrichment/depletion from average\n",
+	   ctx_names[DNA->ctx] );
+  for( i = 0; i < n_pos; i++ ) {
+    row = DNA_ROW( DNA, i );
+    fprintf( out_fh, "%ld ", first_pos + (long)i );
+    for( inx = 0; inx < DNA->n_cols - 1; inx++ ) {
       if ( totals[inx] == 0 ) {
 	fprintf( out_fh, "0 " );
       }
       else {
-	fprintf( out_fh, "%.3f ", (float)((float)DNA->dnps[i]->dinuc_counts[inx] /
-					  ((float)totals[inx] / ((float)length - 1.0))) );
+	fprintf( out_fh, "%.3f ", (float)((float)row[inx] /
+					  ((float)totals[inx] /
+					   (float)n_pos)) );
       }
     }
     if ( totals[inx] == 0 ) {
       fprintf( out_fh, "0\n" );
     }
     else {
-      fprintf( out_fh, "%.3f\n", (float)((float)DNA->dnps[i]->dinuc_counts[inx] /
-					 ((float)totals[inx] / ((float)length - 1.0))) );
+      fprintf( out_fh, "%.3f\n", (float)((float)row[inx] /
+					 ((float)totals[inx] /
+					  (float)n_pos)) );
     }
   }
-  fclose( out_fh );
-}
-
-
-size_t get_dinuc_inx( const char* dinuc ) {
-  char b1, b2;
-  size_t inx = 0;
-  b1 = toupper(dinuc[0]);
-  b2 = toupper(dinuc[1]);
-
-  switch( b1 ) {
-  case 'A' :
-    inx += 0;
-    break;
-  case 'C' :
-    inx += 4;
-    break;
-  case 'G' :
-    inx += 8;
-    break;
-  case 'T' :
-    inx += 12;
-    break;
-  default :
-    return 16;
+  free( totals );
+  /* With -a, more tables may follow on stdout */
+  if ( out_fh == stdout ) {
+    fflush( out_fh );
   }
-
-  switch(b2) {
-  case 'A' :
-    inx += 0;
-    break;
-  case 'C' :
-    inx += 1;
-    break;
-  case 'G' :
-    inx += 2;
-    break;
-  case 'T' :
-    inx += 3;
-    break;
-  default :
-    return 16;
+  else {
+    fclose( out_fh );
   }
-  return inx;  
 }
 
-void make_gnuplot_plot( const char out_fn_root[], const int length ) {
+
+/* Plots the first and last window positions of the table in
+   <out_fn_root>.dat, or with ends, the 5' table in .5p.dat and
+   the 3' table in .3p.dat, to <out_fn_root>.eps */
+void make_gnuplot_plot( const char out_fn_root[], const int length,
+			const int window, const int ends ) {
   char eps_fn[MAX_FN_LEN+1] = {'\0'};
   char dat_fn[MAX_FN_LEN+1] = {'\0'};
+  char dat3_fn[MAX_FN_LEN+1] = {'\0'};
   size_t num_commands = 28;
   size_t i;
   FILE* gnuplotPipe;
@@ -254,28 +881,28 @@ void make_gnuplot_plot( const char out_fn_root[], const int length ) {
     "set size 0.5, 0.25;",
     "set tmargin 0.95;",
     "set origin 0, 0.75;",
-    "plot [0:15][-1.6:1.6] datafile index 1 using ($1+1):(log($2)) t \"AA\" w lp ls 1, '' index 1 using ($1+1):(log($3)) t \"AC\" w lp ls 2, '' index 1 using ($1+1):(log($4)) t \"AG\" w lp ls 3, '' index 1 using ($1+1):(log($5)) t \"AT\" w lp ls 4;",
+    "plot [0:window][-1.6:1.6] datafile index 1 using ($1+1):(log($2)) t \"AA\" w lp ls 1, '' index 1 using ($1+1):(log($3)) t \"AC\" w lp ls 2, '' index 1 using ($1+1):(log($4)) t \"AG\" w lp ls 3, '' index 1 using ($1+1):(log($5)) t \"AT\" w lp ls 4;",
 
     "set origin 0.5, 0.75;",
-    "plot [length-15:length][-1.6:1.6] datafile index 1 using ($1+1):(log($2)) t \"AA\" w lp ls 1, '' index 1 using ($1+1):(log($3)) t \"AC\" w lp ls 2, '' index 1 using ($1+1):(log($4)) t \"AG\" w lp ls 3, '' index 1 using ($1+1):(log($5)) t \"AT\" w lp ls 4;",
+    "plot [length-window:length][-1.6:1.6] datafile3 index 1 using ($1+1):(log($2)) t \"AA\" w lp ls 1, '' index 1 using ($1+1):(log($3)) t \"AC\" w lp ls 2, '' index 1 using ($1+1):(log($4)) t \"AG\" w lp ls 3, '' index 1 using ($1+1):(log($5)) t \"AT\" w lp ls 4;",
 
     "set origin 0, 0.5;",
-    "plot [0:15][-1.6:1.6] datafile index 1 using ($1+1):(log($6)) t \"CA\" w lp ls 1, '' index 1 using ($1+1):(log($7)) t \"CC\" w lp ls 2, '' index 1 using ($1+1):(log($8)) t \"CG\" w lp ls 3, '' index 1 using ($1+1):(log($9)) t \"CT\" w lp ls 4;",
+    "plot [0:window][-1.6:1.6] datafile index 1 using ($1+1):(log($6)) t \"CA\" w lp ls 1, '' index 1 using ($1+1):(log($7)) t \"CC\" w lp ls 2, '' index 1 using ($1+1):(log($8)) t \"CG\" w lp ls 3, '' index 1 using ($1+1):(log($9)) t \"CT\" w lp ls 4;",
 
     "set origin 0.5, 0.5;",
-    "plot [length-15:length][-1.6:1.6] datafile index 1 using ($1+1):(log($6)) t \"CA\" w lp ls 1, '' index 1 using ($1+1):(log($7)) t \"CC\" w lp ls 2, '' index 1 using ($1+1):(log($8)) t \"CG\" w lp ls 3, '' index 1 using ($1+1):(log($9)) t \"CT\" w lp ls 4;",
+    "plot [length-window:length][-1.6:1.6] datafile3 index 1 using ($1+1):(log($6)) t \"CA\" w lp ls 1, '' index 1 using ($1+1):(log($7)) t \"CC\" w lp ls 2, '' index 1 using ($1+1):(log($8)) t \"CG\" w lp ls 3, '' index 1 using ($1+1):(log($9)) t \"CT\" w lp ls 4;",
 
     "set origin 0, 0.25;",
-    "plot [0:15][-1.6:1.6] datafile index 1 using ($1+1):(log($10)) t \"GA\" w lp ls 1, '' index 1 using ($1+1):(log($11)) t \"GC\" w lp ls 2, '' index 1 using ($1+1):(log($12)) t \"GG\" w lp ls 3, '' index 1 using ($1+1):(log($14)) t \"GT\" w lp ls 4;",
+    "plot [0:window][-1.6:1.6] datafile index 1 using ($1+1):(log($10)) t \"GA\" w lp ls 1, '' index 1 using ($1+1):(log($11)) t \"GC\" w lp ls 2, '' index 1 using ($1+1):(log($12)) t \"GG\" w lp ls 3, '' index 1 using ($1+1):(log($14)) t \"GT\" w lp ls 4;",
 
     "set origin 0.5, 0.25;",
-    "plot [length-15:length][-1.6:1.6] datafile index 1 using ($1+1):(log($10)) t \"GA\" w lp ls 1, '' index 1 using ($1+1):(log($11)) t \"GC\" w lp ls 2, '' index 1 using ($1+1):(log($12)) t \"GG\" w lp ls 3, '' index 1 using ($1+1):(log($13)) t \"GT\" w lp ls 4;",
+    "plot [length-window:length][-1.6:1.6] datafile3 index 1 using ($1+1):(log($10)) t \"GA\" w lp ls 1, '' index 1 using ($1+1):(log($11)) t \"GC\" w lp ls 2, '' index 1 using ($1+1):(log($12)) t \"GG\" w lp ls 3, '' index 1 using ($1+1):(log($13)) t \"GT\" w lp ls 4;",
 
     "set origin 0, 0;",
-    "plot [0:15][-1.6:1.6] datafile index 1 using ($1+1):(log($14)) t \"TA\" w lp ls 1, '' index 1 using ($1+1):(log($15)) t \"TC\" w lp ls 2, '' index 1 using ($1+1):(log($16)) t \"TG\" w lp ls 3, '' index 1 using ($1+1):(log($17)) t \"TT\" w lp ls 4;",
+    "plot [0:window][-1.6:1.6] datafile index 1 using ($1+1):(log($14)) t \"TA\" w lp ls 1, '' index 1 using ($1+1):(log($15)) t \"TC\" w lp ls 2, '' index 1 using ($1+1):(log($16)) t \"TG\" w lp ls 3, '' index 1 using ($1+1):(log($17)) t \"TT\" w lp ls 4;",
 
     "set origin 0.5, 0;",
-    "plot [length-15:length][-1.6:1.6] datafile index 1 using ($1+1):(log($14)) t \"TA\" w lp ls 1, '' index 1 using ($1+1):(log($15)) t \"TC\" w lp ls 2, '' index 1 using ($1+1):(log($16)) t \"TG\" w lp ls 3, '' index 1 using ($1+1):(log($17)) t \"TT\" w lp ls 4;",
+    "plot [length-window:length][-1.6:1.6] datafile3 index 1 using ($1+1):(log($14)) t \"TA\" w lp ls 1, '' index 1 using ($1+1):(log($15)) t \"TC\" w lp ls 2, '' index 1 using ($1+1):(log($16)) t \"TG\" w lp ls 3, '' index 1 using ($1+1):(log($17)) t \"TT\" w lp ls 4;",
 
   };
 
@@ -283,7 +910,15 @@ void make_gnuplot_plot( const char out_fn_root[], const int length ) {
   strcpy( eps_fn, out_fn_root );
   strcpy( dat_fn, out_fn_root );
   strcat( eps_fn, ".eps" );
-  strcat( dat_fn, ".dat" );
+  if ( ends ) {
+    strcpy( dat3_fn, out_fn_root );
+    strcat( dat_fn, ".5p.dat" );
+    strcat( dat3_fn, ".3p.dat" );
+  }
+  else {
+    strcat( dat_fn, ".dat" );
+    strcpy( dat3_fn, dat_fn );
+  }
 
   /* Open filehandle to give gnuplot commands */
   gnuplotPipe = popen( "gnuplot", "w" );
@@ -291,7 +926,9 @@ void make_gnuplot_plot( const char out_fn_root[], const int length ) {
   /* Print some commands to gnuplot */
   fprintf( gnuplotPipe, "set output \"%s\";\n", eps_fn );
   fprintf( gnuplotPipe, "datafile = \"%s\";\n", dat_fn );
+  fprintf( gnuplotPipe, "datafile3 = \"%s\";\n", dat3_fn );
   fprintf( gnuplotPipe, "length = %d;\n", length );
+  fprintf( gnuplotPipe, "window = %d;\n", window );
 
   for( i = 0; i < num_commands; i++ ) {
     fprintf( gnuplotPipe, "%s \n", commands[i] );
@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include "fastq-io.h"
+#include "fastq-sink.h"
+
+#define DEF_N (1000000)
+#define DEF_LEN (100)
+#define DEF_N_RATE (0.001)
+#define DEF_ADAPT_RATE (0.1)
+#define DEF_DUP_RATE (0.1)
+#define DEF_SEED (1)
+#define FA_LINE_LEN (60)
+#define ADAPTER "AGATCGGAAGAGCACACGTCTGAACTCCAGTCACATCACGATCTCGTATGCCGTCTTCTGCTTG"
+
+/* Gen_Opts holds what the read generator needs to know */
+typedef struct gen_opts {
+  size_t min_len;
+  size_t max_len;
+  double n_rate;
+  double adapt_rate;
+} Gen_Opts;
+
+void help( void );
+uint64_t next_rand( uint64_t* state );
+double rand_unit( uint64_t* state );
+size_t make_read( uint64_t seed, const Gen_Opts* opts, char* seq,
+		  char* qual );
+int write_fastq( FQ_Sink* sink, size_t n, uint64_t seed, double dup_rate,
+		 const Gen_Opts* opts );
+int write_fasta( FQ_Sink* sink, size_t n, uint64_t seed,
+		 const Gen_Opts* opts );
+
+int main( int argc, char* argv[] ) {
+  extern char* optarg;
+  char out_fn[MAX_FN_LEN+1] = {'\0'};
+  Gen_Opts opts;
+  FQ_Sink_Group* group;
+  FQ_Sink* sink;
+  size_t n         = DEF_N;
+  uint64_t seed    = DEF_SEED;
+  double dup_rate  = DEF_DUP_RATE;
+  int mode         = FQ_SINK_AUTO;
+  int n_threads    = 0;
+  int fasta        = 0;
+  int min_set      = 0;
+  int status;
+  int ich;
+
+  opts.min_len    = DEF_LEN;
+  opts.max_len    = DEF_LEN;
+  opts.n_rate     = DEF_N_RATE;
+  opts.adapt_rate = DEF_ADAPT_RATE;
+  while( (ich=getopt( argc, argv, "o:n:l:m:N:a:d:s:t:zpF" )) != -1 ) {
+    switch(ich) {
+    case 'o' :
+      strcpy( out_fn, optarg );
+      break;
+    case 'n' :
+      n = strtoul( optarg, NULL, 10 );
+      break;
+    case 'l' :
+      opts.max_len = strtoul( optarg, NULL, 10 );
+      break;
+    case 'm' :
+      opts.min_len = strtoul( optarg, NULL, 10 );
+      min_set = 1;
+      break;
+    case 'N' :
+      opts.n_rate = atof( optarg );
+      break;
+    case 'a' :
+      opts.adapt_rate = atof( optarg );
+      break;
+    case 'd' :
+      dup_rate = atof( optarg );
+      break;
+    case 's' :
+      seed = strtoull( optarg, NULL, 10 );
+      break;
+    case 't' :
+      n_threads = atoi( optarg );
+      break;
+    case 'z' :
+      mode = FQ_SINK_GZIP;
+      break;
+    case 'p' :
+      mode = FQ_SINK_PLAIN;
+      break;
+    case 'F' :
+      fasta = 1;
+      break;
+    default :
+      help();
+    }
+  }
+  if ( strlen( out_fn ) == 0 ) {
+    help();
+  }
+  if ( !min_set || (opts.min_len > opts.max_len) ) {
+    opts.min_len = opts.max_len;
+  }
+
+  group = init_fq_sink_group( n_threads, 0, 1, -1 );
+  if ( group == NULL ) {
+    exit( 1 );
+  }
+  sink = open_fq_sink( group, out_fn, mode );
+  if ( sink == NULL ) {
+    exit( 1 );
+  }
+  if ( fasta ) {
+    write_fasta( sink, n, seed, &opts );
+  }
+  else {
+    write_fastq( sink, n, seed, dup_rate, &opts );
+  }
+  status = close_fq_sink( sink );
+  close_fq_sink_group( group );
+  if ( status ) {
+    fprintf( stderr, "Could not write all of %s\n", out_fn );
+    exit( 1 );
+  }
+  exit( 0 );
+}
+
+void help( void ) {
+  printf( "fastq-gen -o <output file; - => stdout>\n" );
+  printf( "          -n <number of reads (contigs with -F); default = %d>\n",
+	  DEF_N );
+  printf( "          -l <read (contig) length; default = %d>\n", DEF_LEN );
+  printf( "          -m <minimum read length; default = -l>\n" );
+  printf( "          -N <rate of N bases; default = %.3f>\n", DEF_N_RATE );
+  printf( "          -a <fraction of reads with adapter; default = %.2f>\n",
+	  DEF_ADAPT_RATE );
+  printf( "          -d <fraction of reads that duplicate an earlier one; default = %.2f>\n",
+	  DEF_DUP_RATE );
+  printf( "          -s <random seed; default = %d>\n", DEF_SEED );
+  printf( "          -t <compression threads; default = one per processor>\n" );
+  printf( "          -z gzip output instead of BGZF for names ending in .gz\n" );
+  printf( "          -p plain output whatever the name\n" );
+  printf( "          -F write fasta contigs instead of fastq reads\n" );
+  printf( "Writes synthetic sequence data for benchmarking and testing.\n" );
+  printf( "Read lengths are uniform between -m and -l. Some reads are\n" );
+  printf( "copies of earlier ones, and some have the TruSeq adapter after\n" );
+  printf( "a random-length insert, so every tool has something to find.\n" );
+  printf( "Output is BGZF if the name ends in .gz and plain otherwise.\n" );
+  printf( "The same options and seed always give the same reads, whatever\n" );
+  printf( "the output format.\n" );
+  exit( 0 );
+}
+
+/* next_rand
+   splitmix64; returns the next number from the generator in state
+*/
+uint64_t next_rand( uint64_t* state ) {
+  uint64_t z;
+  *state += 0x9e3779b97f4a7c15ULL;
+  z = *state;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* rand_unit
+   Returns a number in [0, 1)
+*/
+double rand_unit( uint64_t* state ) {
+  return (next_rand( state ) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* make_read
+   Args: uint64_t seed - the read is made from this alone
+         const Gen_Opts* opts - lengths and rates
+         char* seq, char* qual - get the bases and qualities; room
+                                 for opts->max_len each
+   Returns: the read length
+*/
+size_t make_read( uint64_t seed, const Gen_Opts* opts, char* seq,
+		  char* qual ) {
+  static const char bases[4] = { 'A', 'C', 'G', 'T' };
+  uint64_t state = seed;
+  size_t len, insert, i;
+  size_t adapt_len = strlen( ADAPTER );
+
+  len = opts->min_len +
+    next_rand( &state ) % (opts->max_len - opts->min_len + 1);
+  for( i = 0; i < len; i++ ) {
+    seq[i]  = bases[next_rand( &state ) & 3];
+    qual[i] = '#' + (next_rand( &state ) % 39);
+  }
+  if ( rand_unit( &state ) < opts->adapt_rate ) {
+    insert = next_rand( &state ) % (len + 1);
+    for( i = insert; (i < len) && (i - insert < adapt_len); i++ ) {
+      seq[i] = ADAPTER[i - insert];
+    }
+  }
+  for( i = 0; i < len; i++ ) {
+    if ( rand_unit( &state ) < opts->n_rate ) {
+      seq[i]  = 'N';
+      qual[i] = '#';
+    }
+  }
+  return len;
+}
+
+/* write_fastq
+   Writes n reads to sink. A read is a duplicate of an earlier one
+   with probability dup_rate; it is then made from that read's seed.
+   Returns: 0 => copacetic; -1 => problem writing
+*/
+int write_fastq( FQ_Sink* sink, size_t n, uint64_t seed, double dup_rate,
+		 const Gen_Opts* opts ) {
+  uint64_t state = seed;
+  uint64_t* seeds;
+  char* seq;
+  char* qual;
+  char id[64];
+  char comment[64];
+  FQ_Rec fq_rec;
+  size_t i;
+
+  seeds = (uint64_t*)malloc(sizeof(uint64_t) * (n + 1));
+  seq   = (char*)malloc(sizeof(char) * (opts->max_len + 1));
+  qual  = (char*)malloc(sizeof(char) * (opts->max_len + 1));
+  fq_rec.id      = id;
+  fq_rec.comment = comment;
+  fq_rec.seq     = seq;
+  fq_rec.qual    = qual;
+  fq_rec.pack    = NULL;
+  fq_rec.nmask   = NULL;
+  for( i = 0; i < n; i++ ) {
+    seeds[i] = next_rand( &state );
+    if ( (i > 0) && (rand_unit( &state ) < dup_rate) ) {
+      seeds[i] = seeds[next_rand( &state ) % i];
+    }
+    fq_rec.len = make_read( seeds[i], opts, seq, qual );
+    fq_rec.qual_len    = fq_rec.len;
+    fq_rec.id_len      = sprintf( id, "gen:%lu", i + 1 );
+    fq_rec.comment_len = sprintf( comment, "1:N:0:%lu", seeds[i] % 97 );
+    if ( put_fq_rec( sink, &fq_rec ) ) {
+      break;
+    }
+  }
+  free( seeds );
+  free( seq );
+  free( qual );
+  return ( i == n ) ? 0 : -1;
+}
+
+/* write_fasta
+   Writes n contigs, named chr1, chr2, ..., to sink with
+   FA_LINE_LEN bases per line
+   Returns: 0 => copacetic; -1 => problem writing
+*/
+int write_fasta( FQ_Sink* sink, size_t n, uint64_t seed,
+		 const Gen_Opts* opts ) {
+  uint64_t state = seed;
+  char* seq;
+  char* qual;
+  char id[64];
+  size_t len, i, j;
+  int id_len;
+  int status = 0;
+
+  seq  = (char*)malloc(sizeof(char) * (opts->max_len + 1));
+  qual = (char*)malloc(sizeof(char) * (opts->max_len + 1));
+  for( i = 0; (i < n) && (status == 0); i++ ) {
+    len = make_read( next_rand( &state ), opts, seq, qual );
+    id_len = sprintf( id, ">chr%lu\n", i + 1 );
+    status = put_fq_sink( sink, id, id_len );
+    for( j = 0; (j < len) && (status == 0); j += FA_LINE_LEN ) {
+      put_fq_sink( sink, &seq[j], (len - j < FA_LINE_LEN) ?
+		   len - j : FA_LINE_LEN );
+      status = put_fq_sink( sink, "\n", 1 );
+    }
+  }
+  free( seq );
+  free( qual );
+  return status;
+}
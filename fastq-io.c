@@ -1,32 +1,63 @@
 #include "fastq-io.h"
 
-/* Takes filename as argument
-   Returns true IFF filename ends in .gz
-   False otherwise */
-int is_gz( const char* fq_fn ) {
-  size_t fn_len;
-  fn_len = strlen( fq_fn );
-  if ( (fq_fn[fn_len-3] == '.') &&
-       (fq_fn[fn_len-2] == 'g') &&
-       (fq_fn[fn_len-1] == 'z') ) {
-    return 1;
+/* Number of threads used to inflate BGZF input; 0 => one per processor */
+static int fq_inflate_threads = 0;
+
+/* set_fastq_inflate_threads
+   Sets how many threads each FQ_Src opened from now on uses to
+   inflate BGZF input. 0 (the default) means one per processor.
+   Plain gzip input always gets a single inflate thread.
+*/
+void set_fastq_inflate_threads( int n_threads ) {
+  fq_inflate_threads = n_threads;
+}
+
+/* open_fastq_input
+   Opens fq_source->fn through an In_Src, which picks the backend
+   from the first bytes of the file. If the file was mmapped, the
+   mapping is the read buffer and holds the whole file, so
+   fill_fq_buf never has anything to do. Otherwise the read buffer
+   starts out empty.
+   Returns: 0 => opened; -1 => could not open
+*/
+static int open_fastq_input( FQ_Src* fq_source ) {
+  fq_source->buf_pos = 0;
+  fq_source->buf_len = 0;
+  fq_source->eof     = 0;
+  fq_source->error   = 0;
+  fq_source->n       = 0;
+  fq_source->map     = NULL;
+  fq_source->buf     = NULL;
+  fq_source->in = open_in_src( fq_source->fn, fq_inflate_threads );
+  if ( fq_source->in == NULL ) {
+    return -1;
+  }
+  if ( fq_source->in->map != NULL ) {
+    fq_source->map      = fq_source->in->map;
+    fq_source->buf      = fq_source->map;
+    fq_source->buf_size = fq_source->in->map_len;
+    fq_source->buf_len  = fq_source->in->map_len;
+    fq_source->eof      = 1;
+    return 0;
   }
+  fq_source->buf_size = FQ_BUF_SIZE;
+  fq_source->buf = (char*)malloc(sizeof(char) * fq_source->buf_size);
   return 0;
 }
 
-
-/* get_next_fqpair
-   Args: FQPair_Src* fq_pair_source - the input sources for a fastq read pair
-         FQPair* fq_seq_pair - the place to put the read pair data
-   Returns: 0 => data read; everything copacetic
-           -1 => EOF or other problem; stop trying
- */
-int get_next_fqpair( FQPair_Src* fq_pair_source, FQPair* fq_seq_pair ) {
-  if ( (get_next_fq( fq_pair_source->r1, fq_seq_pair->fq1 ) == 0) &&
-       (get_next_fq( fq_pair_source->r2, fq_seq_pair->fq2 ) == 0) ) {
-    return 0;
+/* close_fastq_input
+   Closes whatever open_fastq_input opened and lets go of the
+   read buffer
+*/
+static void close_fastq_input( FQ_Src* fq_source ) {
+  if ( fq_source->map == NULL ) {
+    free( fq_source->buf );
+  }
+  if ( fq_source->in != NULL ) {
+    close_in_src( fq_source->in );
   }
-  return -1;
+  fq_source->in  = NULL;
+  fq_source->buf = NULL;
 }
 
 FQ_Src* init_fastq_src( const char fn[] ) {
@@ -36,22 +67,12 @@ FQ_Src* init_fastq_src( const char fn[] ) {
   }
   fq_source = (FQ_Src*)malloc(sizeof( FQ_Src ));
   strcpy( fq_source->fn, fn );
-  fq_source->n = 0;
-  if ( is_gz( fn ) ) {
-    fq_source->is_gz = 1;
-    fq_source->fqgz = gzopen( fq_source->fn, "r" );
-    if ( fq_source->fqgz == NULL ) {
-      free( fq_source );
-      return NULL;
-    }
-  }
-  else {
-    fq_source->is_gz = 0;
-    fq_source->fqfp = fileOpen( fq_source->fn, "r" );
-    if ( fq_source->fqfp == NULL ) {
-      free( fq_source );
-      return NULL;
-    }
+  fq_source->pack       = 0;
+  fq_source->pack_words = NULL;
+  fq_source->pack_size  = 0;
+  if ( open_fastq_input( fq_source ) ) {
+    close_fastq_src( fq_source );
+    return NULL;
   }
   return fq_source;
 }
@@ -59,304 +80,1036 @@ FQ_Src* init_fastq_src( const char fn[] ) {
 /* reset_fastq_src
    Takes an already initialized FQ_Src* and a filename
    with fastq data.
-   Resets the FQ_Src to use this new data source, creating new
-   filepointers and reseting the n variable.
+   Resets the FQ_Src to use this new data source, closing the
+   old filepointers, creating new ones and reseting the n variable.
+   If fn is NULL, there is no next source, so fq_source is closed.
    Returns a pointer to this new source */
 FQ_Src* reset_fastq_src( const char fn[], FQ_Src* fq_source ) {
   if ( fn == NULL ) {
+    close_fastq_src( fq_source );
     return NULL;
   }
+  close_fastq_input( fq_source );
   strcpy( fq_source->fn, fn );
-  fq_source->n = 0;
-    if ( is_gz( fn ) ) {
-    fq_source->is_gz = 1;
-    fq_source->fqgz = gzopen( fq_source->fn, "r" );
-    if ( fq_source->fqgz == NULL ) {
-      free( fq_source );
-      return NULL;
+  if ( open_fastq_input( fq_source ) ) {
+    close_fastq_src( fq_source );
+    return NULL;
+  }
+  return fq_source;
+}
+
+/* close_fastq_src
+   Closes the underlying file and frees the FQ_Src and its buffer
+*/
+void close_fastq_src( FQ_Src* fq_source ) {
+  close_fastq_input( fq_source );
+  free( fq_source->pack_words );
+  free( fq_source );
+}
+
+/* fastq_src_range
+   Args: const FQ_Src* fq_source - a mmapped source
+         size_t start, end - byte range of the mapping to read
+         FQ_Src* part - filled in as a source for just that range
+   part shares fq_source's mapping and must not be closed; it is
+   only good as long as fq_source is open. start and end should
+   come from find_fq_record_start. part does not pack records.
+*/
+void fastq_src_range( const FQ_Src* fq_source, size_t start, size_t end,
+		      FQ_Src* part ) {
+  strcpy( part->fn, fq_source->fn );
+  part->in       = NULL;
+  part->map      = NULL;
+  part->buf      = &fq_source->buf[start];
+  part->buf_size = end - start;
+  part->buf_pos  = 0;
+  part->buf_len  = end - start;
+  part->eof      = 1;
+  part->error    = 0;
+  part->pack     = 0;
+  part->pack_words = NULL;
+  part->pack_size  = 0;
+  part->n        = 0;
+}
+
+/* line_end
+   Returns the offset of the newline ending the line that starts
+   at pos in buf, or len if there is none
+*/
+static size_t line_end( const char* buf, size_t len, size_t pos ) {
+  const char* nl;
+  nl = memchr( &buf[pos], '\n', len - pos );
+  return ( nl == NULL ) ? len : (size_t)(nl - buf);
+}
+
+/* find_fq_record_start
+   Args: const char* buf - fastq data
+         size_t len - length of buf
+         size_t pos - where to start looking
+   Returns: offset of the first record that starts at or after pos;
+            len if there is none
+   A line starting with @ might be a quality line, so a line only
+   counts as a record start if the line two below it starts with
+   + and the sequence and quality lines are the same length. If an
+   @ line is really a quality line, the line two below it is a
+   sequence line, which cannot start with +.
+*/
+size_t find_fq_record_start( const char* buf, size_t len, size_t pos ) {
+  size_t ends[4];
+  size_t line;
+  size_t seq_len, qual_len;
+  size_t i;
+
+  if ( pos == 0 ) {
+    return 0;
+  }
+  /* Move to the start of a line */
+  line = ( buf[pos-1] == '\n' ) ? pos : line_end( buf, len, pos - 1 ) + 1;
+  while( line < len ) {
+    if ( buf[line] == '@' ) {
+      ends[0] = line_end( buf, len, line );
+      for( i = 1; (i < 4) && (ends[i-1] < len); i++ ) {
+	ends[i] = line_end( buf, len, ends[i-1] + 1 );
+      }
+      if ( (i == 4) && (ends[1] + 1 < len) && (buf[ends[1] + 1] == '+') ) {
+	seq_len  = ends[1] - ends[0] - 1;
+	qual_len = ends[3] - ends[2] - 1;
+	if ( (seq_len > 0) && (buf[ends[1] - 1] == '\r') ) {
+	  seq_len--;
+	}
+	if ( (qual_len > 0) && (buf[ends[3] - 1] == '\r') ) {
+	  qual_len--;
+	}
+	if ( seq_len == qual_len ) {
+	  return line;
+	}
+      }
     }
+    line = line_end( buf, len, line ) + 1;
   }
-  else {
-    fq_source->is_gz = 0;
-    fq_source->fqfp = fileOpen( fq_source->fn, "r" );
-    if ( fq_source->fqfp == NULL ) {
-      free( fq_source );
-      return NULL;
+  return len;
+}
+
+/* fill_fq_buf
+   Moves the unparsed bytes in fq_source->buf to the front, grows
+   the buffer if it is already full of unparsed data, then reads
+   the next block from the input (in_src_read) into the free
+   space at the end.
+   Returns: number of new bytes read; 0 => EOF or error
+   (fq_source->error says which)
+*/
+size_t fill_fq_buf( FQ_Src* fq_source ) {
+  size_t unparsed;
+  size_t space;
+  long got;
+
+  if ( fq_source->eof ) {
+    return 0;
+  }
+  unparsed = fq_source->buf_len - fq_source->buf_pos;
+  if ( fq_source->buf_pos > 0 ) {
+    memmove( fq_source->buf, &fq_source->buf[fq_source->buf_pos], unparsed );
+    fq_source->buf_pos = 0;
+    fq_source->buf_len = unparsed;
+  }
+  if ( fq_source->buf_len == fq_source->buf_size ) {
+    /* A single record is bigger than the buffer */
+    fq_source->buf_size *= 2;
+    fq_source->buf = (char*)realloc( fq_source->buf,
+				     sizeof(char) * fq_source->buf_size );
+  }
+
+  space = fq_source->buf_size - fq_source->buf_len;
+  got = in_src_read( fq_source->in, &fq_source->buf[fq_source->buf_len],
+		     space );
+  if ( got < 0 ) {
+    fprintf( stderr, "Problem reading %s\n", fq_source->fn );
+    fq_source->error = 1;
+    got = 0;
+  }
+  if ( got == 0 ) {
+    fq_source->eof = 1;
+  }
+  fq_source->buf_len += got;
+  return (size_t)got;
+}
+
+/* next_fq_lines
+   Args: FQ_Src* fq_source - the source of fastq data
+         char* lines[4] - set to point at the 4 lines of the next record
+         size_t lens[4] - set to the length of each line, without the \n
+   Returns: 0 => found the next record; everything copacetic
+           -1 => EOF or other problem; stop trying on this source
+            1 => the third line of the record does not begin with +
+   Finds the four newlines that end the next record using memchr
+   over the block buffer, refilling it as needed. The lines point
+   into fq_source->buf and are only good until the next call.
+   The last record is taken even if the file has no final newline.
+*/
+int next_fq_lines( FQ_Src* fq_source, char* lines[4], size_t lens[4] ) {
+  size_t offs[4]; // offset of each line from fq_source->buf_pos
+  size_t off = 0;
+  size_t i   = 0;
+  char* start;
+  char* nl;
+
+  while( i < 4 ) {
+    start = &fq_source->buf[fq_source->buf_pos + off];
+    nl = memchr( start, '\n', fq_source->buf_len - fq_source->buf_pos - off );
+    if ( nl != NULL ) {
+      offs[i] = off;
+      lens[i] = nl - start;
+      off += lens[i] + 1;
+      i++;
+    }
+    else if ( fill_fq_buf( fq_source ) == 0 ) {
+      /* EOF. A quality line with no newline is still a record. */
+      if ( (i == 3) &&
+	   (fq_source->buf_pos + off < fq_source->buf_len) ) {
+	offs[i] = off;
+	lens[i] = fq_source->buf_len - fq_source->buf_pos - off;
+	off += lens[i];
+	i++;
+      }
+      else {
+	return -1;
+      }
     }
   }
-  return fq_source;
+
+  for( i = 0; i < 4; i++ ) {
+    lines[i] = &fq_source->buf[fq_source->buf_pos + offs[i]];
+  }
+  if ( lines[0][0] != '@' ) {
+    fprintf( stderr, "fastq record not beginning with @\n" );
+    return -1;
+  }
+  if ( (lens[2] == 0) || (lines[2][0] != '+') ) {
+    fprintf( stderr, "Problem reading quality line for %.*s\n",
+	     (int)lens[0], lines[0] );
+    return 1;
+  }
+  fq_source->buf_pos += off;
+  return 0;
+}
+
+/* parse_fq_rec
+   Does the work of get_next_fq_rec, except for packing; fq_rec
+   comes back with no pack or nmask
+*/
+static int parse_fq_rec( FQ_Src* fq_source, FQ_Rec* fq_rec ) {
+  char* lines[4];
+  size_t lens[4];
+  size_t i;
+
+  if ( next_fq_lines( fq_source, lines, lens ) ) {
+    return -1;
+  }
+  if ( (lens[0] > 0) && (lines[0][lens[0]-1] == '\r') ) {
+    lens[0]--;
+  }
+  for( i = 1; i < lens[0]; i++ ) {
+    if ( isspace( lines[0][i] ) ) {
+      break;
+    }
+  }
+  fq_rec->id     = &lines[0][1];
+  fq_rec->id_len = i - 1;
+  while( (i < lens[0]) && isspace( lines[0][i] ) ) {
+    i++;
+  }
+  fq_rec->comment     = &lines[0][i];
+  fq_rec->comment_len = lens[0] - i;
+
+  if ( (lens[1] > 0) && (lines[1][lens[1]-1] == '\r') ) {
+    lens[1]--;
+  }
+  if ( (lens[3] > 0) && (lines[3][lens[3]-1] == '\r') ) {
+    lens[3]--;
+  }
+  fq_rec->seq      = lines[1];
+  fq_rec->len      = lens[1];
+  fq_rec->qual     = lines[3];
+  fq_rec->qual_len = lens[3];
+  fq_rec->pack     = NULL;
+  fq_rec->nmask    = NULL;
+  fq_source->n++;
+  return 0;
+}
+
+/* pack_into
+   Args: uint64_t** words - array to pack into; grown if need be
+         size_t* size - allocated size of *words
+         size_t* len - words in use; the packed sequence goes here
+         const char* seq - the bases
+         size_t seq_len - how many
+   Returns the offset in *words of the packed sequence; its N-mask
+   follows at offset + PACK_CODE_WORDS(seq_len)
+*/
+static size_t pack_into( uint64_t** words, size_t* size, size_t* len,
+			 const char* seq, size_t seq_len ) {
+  size_t off;
+  off = *len;
+  if ( off + PACK_WORDS(seq_len) > *size ) {
+    *size  = 2 * (off + PACK_WORDS(seq_len));
+    *words = (uint64_t*)realloc( *words, sizeof(uint64_t) * *size );
+  }
+  pack_seq( seq, seq_len, &(*words)[off],
+	    &(*words)[off + PACK_CODE_WORDS(seq_len)] );
+  *len += PACK_WORDS(seq_len);
+  return off;
+}
+
+/* get_next_fq_rec
+   Args: FQ_Src* fq_source - the source of some
+                             fastq data
+         FQ_Rec* fq_rec - set to point at the next record
+   Returns: 0 => found next fastq record; everything copacetic
+           -1 => EOF or other problem; stop trying on this source
+   Points the fields of fq_rec into the read buffer; no copying.
+   The identifier is everything up to the first whitespace on the
+   header line; the comment is whatever follows that whitespace.
+   A trailing carriage return is left off the header, sequence and
+   quality lines.
+   If fq_source->pack is set, the sequence is also packed into
+   fq_source->pack_words, which is good until the next read.
+   Updates the fq_source->n if a fastq record is read correctly.
+*/
+int get_next_fq_rec( FQ_Src* fq_source, FQ_Rec* fq_rec ) {
+  size_t n_words = 0;
+  if ( parse_fq_rec( fq_source, fq_rec ) ) {
+    return -1;
+  }
+  if ( fq_source->pack ) {
+    pack_into( &fq_source->pack_words, &fq_source->pack_size, &n_words,
+	       fq_rec->seq, fq_rec->len );
+    fq_rec->pack  = fq_source->pack_words;
+    fq_rec->nmask = &fq_source->pack_words[PACK_CODE_WORDS(fq_rec->len)];
+  }
+  return 0;
+}
+
+/* copy_fq_line
+   Copies up to max non-whitespace characters from line into dest,
+   upper-casing them if upper is true, and NUL-terminates dest.
+   Returns the number of characters copied.
+*/
+static size_t copy_fq_line( char* dest, const char* line, size_t len,
+			    size_t max, int upper ) {
+  size_t i, j;
+  j = 0;
+  for( i = 0; (i < len) && (j < max); i++ ) {
+    if ( !isspace( line[i] ) ) {
+      dest[j++] = upper ? toupper( line[i] ) : line[i];
+    }
+  }
+  dest[j] = '\0';
+  return j;
+}
+
+/* fq_rec2fq
+   Copies the record that fq_rec points at into the fixed-size
+   arrays of fq_seq. Sequence is upper-cased. Identifiers,
+   sequences and qualities that are too long are truncated.
+*/
+void fq_rec2fq( const FQ_Rec* fq_rec, FQ* fq_seq ) {
+  size_t id_len;
+  id_len = fq_rec->id_len;
+  if ( id_len > MAX_ID_LEN ) {
+    id_len = MAX_ID_LEN;
+  }
+  memcpy( fq_seq->id, fq_rec->id, id_len );
+  fq_seq->id[id_len] = '\0';
+  fq_seq->len = copy_fq_line( fq_seq->seq, fq_rec->seq, fq_rec->len,
+			      MAX_FQ_LEN, 1 );
+  copy_fq_line( fq_seq->qual, fq_rec->qual, fq_rec->qual_len,
+		MAX_FQ_LEN, 0 );
 }
 
 /* get_next_fq
-   Args: FQ_Src* fq_source - the source (uncompressed or gz) of some
+   Args: FQ_Src* fq_source - the source of some
                              fastq data
          FQ* fq_seq - the place to put the data
    Returns: 0 => read next fastq record; everything copacetic
            -1 => EOF or other problem; stop trying on this source
-   Calls the right parser type (gz or regular) to read the next
-   record and updates the fq_source->n if a fastq record is read
-   correctly.
+   Compatibility wrapper around get_next_fq_rec that copies the
+   record into the fixed-size FQ.
 */
 int get_next_fq( FQ_Src* fq_source, FQ* fq_seq ) {
-  if ( fq_source->is_gz ) {
-    if ( gzread_fastq( fq_source->fqgz, fq_seq ) ) {
-      return -1;
+  FQ_Rec fq_rec;
+  if ( get_next_fq_rec( fq_source, &fq_rec ) ) {
+    return -1;
+  }
+  fq_rec2fq( &fq_rec, fq_seq );
+  return 0;
+}
+
+/* init_fq_batch
+   Returns a new, empty FQ_Batch with room for max_recs records
+*/
+FQ_Batch* init_fq_batch( size_t max_recs ) {
+  FQ_Batch* batch;
+  batch = (FQ_Batch*)malloc(sizeof( FQ_Batch ));
+  batch->max_recs  = max_recs;
+  batch->data_size = max_recs * 512;
+  batch->data      = (char*)malloc(sizeof(char) * batch->data_size);
+  batch->data_len  = 0;
+  batch->offs      = (size_t*)malloc(sizeof(size_t) * 5 * max_recs);
+  batch->words      = NULL;
+  batch->words_size = 0;
+  batch->words_len  = 0;
+  batch->recs      = (FQ_Rec*)malloc(sizeof(FQ_Rec) * max_recs);
+  batch->n_recs    = 0;
+  batch->next      = NULL;
+  return batch;
+}
+
+void free_fq_batch( FQ_Batch* batch ) {
+  free( batch->data );
+  free( batch->offs );
+  free( batch->words );
+  free( batch->recs );
+  free( batch );
+}
+
+/* copy_to_batch
+   Appends len bytes of field and a NUL to batch->data
+   Returns the offset in batch->data where it was put
+*/
+static size_t copy_to_batch( FQ_Batch* batch, const char* field, size_t len ) {
+  size_t off;
+  off = batch->data_len;
+  memcpy( &batch->data[off], field, len );
+  batch->data[off + len] = '\0';
+  batch->data_len += len + 1;
+  return off;
+}
+
+/* fill_fq_batch
+   Args: FQ_Src* fq_source - where to read records from
+         FQ_Batch* batch - the batch to (re)fill
+         size_t n_recs - how many records to read; at most batch->max_recs
+   Returns: the number of records put in the batch; less than n_recs
+            only at the end of the input
+*/
+size_t fill_fq_batch( FQ_Src* fq_source, FQ_Batch* batch, size_t n_recs ) {
+  FQ_Rec fq_rec;
+  size_t need;
+  size_t i;
+
+  if ( n_recs > batch->max_recs ) {
+    n_recs = batch->max_recs;
+  }
+  batch->n_recs    = 0;
+  batch->data_len  = 0;
+  batch->words_len = 0;
+  while( (batch->n_recs < n_recs) &&
+	 (parse_fq_rec( fq_source, &fq_rec ) == 0) ) {
+    need = fq_rec.id_len + fq_rec.comment_len + fq_rec.len +
+      fq_rec.qual_len + 4;
+    if ( batch->data_len + need > batch->data_size ) {
+      batch->data_size = 2 * (batch->data_len + need);
+      batch->data = (char*)realloc( batch->data,
+				    sizeof(char) * batch->data_size );
     }
-    else {
-      fq_source->n++;
-      return 0;
+    i = batch->n_recs;
+    batch->offs[5*i]   = copy_to_batch( batch, fq_rec.id, fq_rec.id_len );
+    batch->offs[5*i+1] = copy_to_batch( batch, fq_rec.comment,
+					fq_rec.comment_len );
+    batch->offs[5*i+2] = copy_to_batch( batch, fq_rec.seq, fq_rec.len );
+    batch->offs[5*i+3] = copy_to_batch( batch, fq_rec.qual,
+					fq_rec.qual_len );
+    if ( fq_source->pack ) {
+      batch->offs[5*i+4] = pack_into( &batch->words, &batch->words_size,
+				      &batch->words_len, fq_rec.seq,
+				      fq_rec.len );
     }
+    batch->recs[i].id_len      = fq_rec.id_len;
+    batch->recs[i].comment_len = fq_rec.comment_len;
+    batch->recs[i].len      = fq_rec.len;
+    batch->recs[i].qual_len = fq_rec.qual_len;
+    batch->n_recs++;
   }
-  else {
-    if ( read_fastq( fq_source->fqfp, fq_seq ) ) {
-      return -1;
+  /* data and words are done moving; point the records into them */
+  for( i = 0; i < batch->n_recs; i++ ) {
+    batch->recs[i].id      = &batch->data[batch->offs[5*i]];
+    batch->recs[i].comment = &batch->data[batch->offs[5*i+1]];
+    batch->recs[i].seq     = &batch->data[batch->offs[5*i+2]];
+    batch->recs[i].qual    = &batch->data[batch->offs[5*i+3]];
+    batch->recs[i].pack    = NULL;
+    batch->recs[i].nmask   = NULL;
+    if ( fq_source->pack ) {
+      batch->recs[i].pack  = &batch->words[batch->offs[5*i+4]];
+      batch->recs[i].nmask = &batch->words[batch->offs[5*i+4] +
+					   PACK_CODE_WORDS(batch->recs[i].len)];
     }
-    else {
-      fq_source->n++;
-      return 0;
+  }
+  return batch->n_recs;
+}
+
+/* FQ_Pipe_Run is the shared state of one run_fq_pipeline call.
+   Filled batches wait in the full queue (oldest first) for a
+   worker; used ones go back on the free list for the reader.
+   A mmapped source is instead cut into n_chunks byte ranges at
+   the offsets in bounds, and workers take the next chunk and parse
+   it themselves.
+ */
+typedef struct fq_pipe_run {
+  FQ_Pipe* pipe;
+  FQ_Batch* full_head;
+  FQ_Batch* full_tail;
+  FQ_Batch* free_list;
+  int done; // reader has queued its last batch
+  FQ_Src* fq_source;
+  size_t* bounds;
+  size_t n_chunks;
+  size_t next_chunk;
+  pthread_mutex_t lock;
+  pthread_cond_t batch_full;
+  pthread_cond_t batch_free;
+} FQ_Pipe_Run;
+
+typedef struct fq_pipe_worker {
+  FQ_Pipe_Run* run;
+  void* state;
+  size_t n_recs; // records parsed by this worker in chunk mode
+  pthread_t thread;
+} FQ_Pipe_Worker;
+
+static void* fq_pipe_worker( void* arg ) {
+  FQ_Pipe_Worker* worker = (FQ_Pipe_Worker*)arg;
+  FQ_Pipe_Run* run = worker->run;
+  FQ_Batch* batch;
+
+  while( 1 ) {
+    pthread_mutex_lock( &run->lock );
+    while( (run->full_head == NULL) && !run->done ) {
+      pthread_cond_wait( &run->batch_full, &run->lock );
+    }
+    batch = run->full_head;
+    if ( batch == NULL ) {
+      pthread_mutex_unlock( &run->lock );
+      break;
     }
+    run->full_head = batch->next;
+    if ( run->full_head == NULL ) {
+      run->full_tail = NULL;
+    }
+    pthread_mutex_unlock( &run->lock );
+
+    run->pipe->do_batch( worker->state, batch->recs, batch->n_recs,
+			 run->pipe->arg );
+
+    pthread_mutex_lock( &run->lock );
+    batch->next = run->free_list;
+    run->free_list = batch;
+    pthread_cond_signal( &run->batch_free );
+    pthread_mutex_unlock( &run->lock );
   }
+  return NULL;
 }
 
-/* Args: 
-         
-   Returns: 0 - everything is copacetic
-          non-zero if EOF or other problem
-   Reads the next fastq sequence from a regular file handle
+/* point_packed_recs
+   Points each of the n records at its packed sequence in words,
+   at the offsets in pack_offs, once words is done moving
 */
-int read_fastq( FILE* fastq, FQ* fq_seq ) {
-  char c;
+static void point_packed_recs( FQ_Rec* recs, size_t n, uint64_t* words,
+			       const size_t* pack_offs, int pack ) {
   size_t i;
-  
-  c = fgetc( fastq );
-  if ( c == EOF ) return -1;
-  if ( c != '@' ) {
-    fprintf( stderr, "fastq record not beginning with @\n" );
-    return -1;
+  if ( !pack ) {
+    return;
+  }
+  for( i = 0; i < n; i++ ) {
+    recs[i].pack  = &words[pack_offs[i]];
+    recs[i].nmask = &words[pack_offs[i] + PACK_CODE_WORDS(recs[i].len)];
   }
+}
 
-  /* get identifier */
-  i = 0;
-  while( (!isspace(c=fgetc( fastq ) ) &&
-          (i < MAX_ID_LEN) ) ) {
-    if ( c == EOF ) {
-      return -1;
+/* fq_pipe_chunk_worker
+   Thread body for a mmapped source. Parses whole chunks of the
+   mapping with no copying; the records stay good because the
+   mapping never moves, so they are passed to do_batch as views.
+   If the source packs, each batch's sequences are packed into
+   this worker's own words.
+*/
+static void* fq_pipe_chunk_worker( void* arg ) {
+  FQ_Pipe_Worker* worker = (FQ_Pipe_Worker*)arg;
+  FQ_Pipe_Run* run = worker->run;
+  FQ_Src part;
+  FQ_Rec* recs;
+  size_t* pack_offs;
+  uint64_t* words = NULL;
+  size_t words_size = 0;
+  size_t words_len = 0;
+  size_t batch_recs;
+  size_t chunk;
+  size_t n;
+  int pack = run->fq_source->pack;
+
+  batch_recs = (run->pipe->batch_recs > 0) ?
+    run->pipe->batch_recs : FQ_BATCH_RECS;
+  recs = (FQ_Rec*)malloc(sizeof(FQ_Rec) * batch_recs);
+  pack_offs = (size_t*)malloc(sizeof(size_t) * batch_recs);
+  while( 1 ) {
+    pthread_mutex_lock( &run->lock );
+    chunk = run->next_chunk++;
+    pthread_mutex_unlock( &run->lock );
+    if ( chunk >= run->n_chunks ) {
+      break;
     }
-    fq_seq->id[i] = c;
-    i++;
-    if ( i == MAX_ID_LEN ) {
-      /* Id is too long - truncate it now */
-      fq_seq->id[i] = '\0';
+    fastq_src_range( run->fq_source, run->bounds[chunk],
+		     run->bounds[chunk+1], &part );
+    n = 0;
+    while( parse_fq_rec( &part, &recs[n] ) == 0 ) {
+      if ( pack ) {
+	pack_offs[n] = pack_into( &words, &words_size, &words_len,
+				  recs[n].seq, recs[n].len );
+      }
+      n++;
+      if ( n == batch_recs ) {
+	point_packed_recs( recs, n, words, pack_offs, pack );
+	run->pipe->do_batch( worker->state, recs, n, run->pipe->arg );
+	n = 0;
+	words_len = 0;
+      }
     }
+    if ( n > 0 ) {
+      point_packed_recs( recs, n, words, pack_offs, pack );
+      run->pipe->do_batch( worker->state, recs, n, run->pipe->arg );
+      words_len = 0;
+    }
+    worker->n_recs += part.n;
   }
-  fq_seq->id[i] = '\0';
+  free( recs );
+  free( pack_offs );
+  free( words );
+  return NULL;
+}
 
-  /* Now, everything else on the line is description (if anything)
-     although fastq does not appear to formally support description */
-  while ( (c != '\n') &&
-          (c != EOF) ) {
-    c = fgetc( fastq );
+/* trim_to_used
+   Counts the records of batch that pipe->use_rec says count toward
+   pipe->max_recs, up to left of them, and drops the records after
+   the last one counted
+   Returns: how many were counted
+*/
+static size_t trim_to_used( FQ_Pipe* pipe, FQ_Batch* batch, size_t left ) {
+  size_t n_used = 0;
+  size_t i;
+  for( i = 0; (i < batch->n_recs) && (n_used < left); i++ ) {
+    if ( pipe->use_rec( &batch->recs[i], pipe->arg ) ) {
+      n_used++;
+    }
   }
-  i = 0;
+  batch->n_recs = i;
+  return n_used;
+}
 
-  /* Now, read the sequence. This should all be on a single line */
-  i = 0;
-  c = fgetc( fastq );
-  while ( (c != '\n') &&
-          (c != EOF) &&
-          (i < MAX_FQ_LEN) ) {
-    if ( isspace(c) ) {
-      ;
+/* run_fq_pipeline
+   Args: FQ_Src* fq_source - the input; read by the calling thread
+         FQ_Pipe* pipe - the callbacks and settings for the run
+   Returns: the merged state of all the workers
+   See FQ_Pipe. fq_source->n counts the records read, as usual.
+   If fq_source is mmapped, the workers parse it in chunks that
+   start on record boundaries, so there is no reader thread.
+*/
+void* run_fq_pipeline( FQ_Src* fq_source, FQ_Pipe* pipe ) {
+  FQ_Pipe_Run run;
+  FQ_Pipe_Worker* workers;
+  FQ_Batch* batch;
+  size_t batch_recs;
+  size_t n_batches;
+  size_t want;
+  size_t got;
+  size_t n_read = 0;
+  size_t size;
+  size_t chunk;
+  void* total;
+  size_t n_threads;
+  size_t i;
+
+  n_threads  = (size_t)( (pipe->n_threads > 0) ? pipe->n_threads
+			 : default_pgz_threads() );
+  batch_recs = (pipe->batch_recs > 0) ? pipe->batch_recs : FQ_BATCH_RECS;
+  n_batches  = 2 * n_threads + 2;
+
+  run.pipe       = pipe;
+  run.full_head  = NULL;
+  run.full_tail  = NULL;
+  run.free_list  = NULL;
+  run.done       = 0;
+  run.fq_source  = fq_source;
+  run.bounds     = NULL;
+  run.n_chunks   = 0;
+  run.next_chunk = 0;
+  pthread_mutex_init( &run.lock, NULL );
+  pthread_cond_init( &run.batch_full, NULL );
+  pthread_cond_init( &run.batch_free, NULL );
+
+  /* A mmapped file can be cut up and parsed by the workers, unless
+     only the first max_recs records are wanted */
+  if ( (fq_source->map != NULL) && (pipe->max_recs == 0) ) {
+    size = fq_source->buf_len - fq_source->buf_pos;
+    run.n_chunks = size / FQ_CHUNK_SIZE + 1;
+    if ( run.n_chunks > FQ_CHUNKS_PER_THREAD * n_threads ) {
+      run.n_chunks = FQ_CHUNKS_PER_THREAD * n_threads;
     }
-    else {
-      c = toupper( c );
-      fq_seq->seq[i++] = c;
+    run.bounds = (size_t*)malloc(sizeof(size_t) * (run.n_chunks + 1));
+    run.bounds[0] = fq_source->buf_pos;
+    for( chunk = 1; chunk < run.n_chunks; chunk++ ) {
+      run.bounds[chunk] =
+	find_fq_record_start( fq_source->buf, fq_source->buf_len,
+			      fq_source->buf_pos + chunk * (size / run.n_chunks) );
     }
-    c = fgetc( fastq );
+    run.bounds[run.n_chunks] = fq_source->buf_len;
   }
-  fq_seq->seq[i] = '\0';
-  fq_seq->len = i;
-  
-  /* If the reading stopped because the sequence was longer than
-     MAX_FQ_LEN, then we need to advance the file pointer
-     past this line */
-  if ( i == MAX_FQ_LEN ) {
-    while ( (c != '\n') &&
-            (c != EOF) ) {
-      c = fgetc( fastq );
+  else {
+    for( i = 0; i < n_batches; i++ ) {
+      batch = init_fq_batch( batch_recs );
+      batch->next = run.free_list;
+      run.free_list = batch;
     }
   }
 
-  /* Now, read the quality score header */
-  c = fgetc( fastq );
-  if ( c != '+' ) {
-    fprintf( stderr, "Problem reading quality line for %s\n", fq_seq->id );
-    return 1;
-  }
-  /* Zip through the rest of the line, it should be the same identifier
-     as before or blank */
-  c = fgetc( fastq );
-  while( (c != '\n') &&
-         (c != EOF) ) {
-    c = fgetc( fastq );
+  workers = (FQ_Pipe_Worker*)malloc(sizeof(FQ_Pipe_Worker) * n_threads);
+  for( i = 0; i < n_threads; i++ ) {
+    workers[i].run    = &run;
+    workers[i].state  = pipe->init_state( pipe->arg );
+    workers[i].n_recs = 0;
+    pthread_create( &workers[i].thread, NULL,
+		    run.bounds ? fq_pipe_chunk_worker : fq_pipe_worker,
+		    &workers[i] );
   }
 
-  /* Now, get the quality score line */
-  c = fgetc( fastq );
-  i = 0;
-  while( (c != '\n') &&
-         (c != EOF) &&
-         (i < MAX_FQ_LEN) ) {
-    if ( isspace(c) ) {
-      ;
+  while( run.bounds == NULL ) {
+    want = batch_recs;
+    if ( (pipe->max_recs > 0) && (pipe->max_recs - n_read < want) ) {
+      want = pipe->max_recs - n_read;
+    }
+    if ( want == 0 ) {
+      break;
+    }
+    pthread_mutex_lock( &run.lock );
+    while( run.free_list == NULL ) {
+      pthread_cond_wait( &run.batch_free, &run.lock );
+    }
+    batch = run.free_list;
+    run.free_list = batch->next;
+    pthread_mutex_unlock( &run.lock );
+
+    got = fill_fq_batch( fq_source, batch, want );
+    if ( (pipe->use_rec != NULL) && (pipe->max_recs > 0) ) {
+      n_read += trim_to_used( pipe, batch, pipe->max_recs - n_read );
+    }
+    else {
+      n_read += got;
+    }
+
+    pthread_mutex_lock( &run.lock );
+    if ( batch->n_recs == 0 ) {
+      batch->next = run.free_list;
+      run.free_list = batch;
     }
     else {
-      fq_seq->qual[i++] = c;
+      batch->next = NULL;
+      if ( run.full_tail == NULL ) {
+	run.full_head = batch;
+      }
+      else {
+	run.full_tail->next = batch;
+      }
+      run.full_tail = batch;
+      pthread_cond_signal( &run.batch_full );
+    }
+    pthread_mutex_unlock( &run.lock );
+    if ( got < want ) {
+      break;
     }
-    c = fgetc( fastq );
   }
-  fq_seq->qual[i] = '\0';
 
-  /* If the reading stopped because the sequence was longer than
-     MAX_FQ_LEN, then we need to advance the file pointer
-     past this line */
-  if ( i == MAX_FQ_LEN ) {
-    while ( (c != '\n') &&
-            (c != EOF) ) {
-      c = fgetc( fastq );
+  pthread_mutex_lock( &run.lock );
+  run.done = 1;
+  pthread_cond_broadcast( &run.batch_full );
+  pthread_mutex_unlock( &run.lock );
+  for( i = 0; i < n_threads; i++ ) {
+    pthread_join( workers[i].thread, NULL );
+  }
+  if ( run.bounds != NULL ) {
+    /* The workers used up the whole mapping */
+    for( i = 0; i < n_threads; i++ ) {
+      fq_source->n += workers[i].n_recs;
     }
+    fq_source->buf_pos = fq_source->buf_len;
+    free( run.bounds );
   }
 
-  if ( c == EOF ) {
-    return -1;
+  total = workers[0].state;
+  for( i = 1; i < n_threads; i++ ) {
+    pipe->merge_state( total, workers[i].state, pipe->arg );
   }
-  return 0;
+  free( workers );
+  while( run.free_list != NULL ) {
+    batch = run.free_list;
+    run.free_list = batch->next;
+    free_fq_batch( batch );
+  }
+  pthread_mutex_destroy( &run.lock );
+  pthread_cond_destroy( &run.batch_full );
+  pthread_cond_destroy( &run.batch_free );
+  return total;
 }
 
-/* Args: gzFile fastq - file pointer to a fastq file ready to read 
-                       the next sequence
-         FQ* fq_seq - data structure to put the fastq data for the next fastq seq
-   Returns: 0 - everything is copacetic
-          non-zero if EOF or other problem
-   Reads the next fastq sequence from a gzFile (gzipped) filehandle
+/* fq_name_len
+   Returns the length of the read name in fq_rec->id, leaving off
+   a trailing /1 or /2. The id already stops at the first
+   whitespace, so Illumina comments like " 1:N:0:ACGT" are not in it.
 */
-int gzread_fastq( gzFile fastq, FQ* fq_seq ) {
-		  //char id[], char seq[], char qual[], size_t* len ) {
-  char c;
-  size_t i;
-  c = gzgetc( fastq );
-  if ( c == EOF ) return -1;
-  if ( c != '@' ) {
-    fprintf( stderr, "fastq record not beginning with @\n" );
-    return -1;
+static size_t fq_name_len( const FQ_Rec* fq_rec ) {
+  size_t len = fq_rec->id_len;
+  if ( (len >= 2) &&
+       (fq_rec->id[len-2] == '/') &&
+       ((fq_rec->id[len-1] == '1') || (fq_rec->id[len-1] == '2')) ) {
+    len -= 2;
   }
+  return len;
+}
 
-  /* get identifier */
-  i = 0;
-  while( (!isspace(c=gzgetc( fastq ) ) &&
-          (i < MAX_ID_LEN) ) ) {
-    if ( c == EOF ) {
-      return -1;
+/* fq_names_match
+   Returns true IFF the two records have the same read name,
+   ignoring /1 and /2 suffixes
+*/
+int fq_names_match( const FQ_Rec* fq_rec1, const FQ_Rec* fq_rec2 ) {
+  size_t len;
+  len = fq_name_len( fq_rec1 );
+  return ( (len == fq_name_len( fq_rec2 )) &&
+	   (memcmp( fq_rec1->id, fq_rec2->id, len ) == 0) );
+}
+
+typedef struct fqpair_reader {
+  FQPair_Src* fq_pair_source;
+  int side; // 0 => R1; 1 => R2
+} FQPair_Reader;
+
+/* fqpair_reader
+   Thread body for one file of a pair. Fills batches in order,
+   waiting for the caller to let go of a slot before reusing it.
+*/
+static void* fqpair_reader( void* arg ) {
+  FQPair_Reader* reader = (FQPair_Reader*)arg;
+  FQPair_Src* ps = reader->fq_pair_source;
+  int side = reader->side;
+  FQ_Src* fq_source;
+  FQ_Batch* batch;
+  size_t got;
+
+  fq_source = side ? ps->r2 : ps->r1;
+  free( reader );
+  pthread_mutex_lock( &ps->lock );
+  while( 1 ) {
+    /* Slot is free once the caller has let go of the batch in it */
+    while( !ps->quit &&
+	   (ps->n_filled[side] >= FQ_PAIR_BATCHES) &&
+	   (ps->n_filled[side] - FQ_PAIR_BATCHES >= ps->n_released) ) {
+      pthread_cond_wait( &ps->used, &ps->lock );
     }
-    fq_seq->id[i] = c;
-    i++;
-    if ( i == MAX_ID_LEN ) {
-      /* Id is too long - truncate it now */
-      fq_seq->id[i] = '\0';
+    if ( ps->quit ) {
+      break;
+    }
+    batch = ps->batches[side][ps->n_filled[side] % FQ_PAIR_BATCHES];
+    pthread_mutex_unlock( &ps->lock );
+    got = fill_fq_batch( fq_source, batch, FQ_BATCH_RECS );
+    pthread_mutex_lock( &ps->lock );
+    ps->n_filled[side]++;
+    if ( got < FQ_BATCH_RECS ) {
+      ps->done[side] = 1;
+    }
+    pthread_cond_broadcast( &ps->filled );
+    if ( ps->done[side] ) {
+      break;
     }
   }
-  fq_seq->id[i] = '\0';
+  pthread_mutex_unlock( &ps->lock );
+  return NULL;
+}
 
-  /* Now, everything else on the line is description (if anything)
-     although fastq does not appear to formally support description */
-  while ( (c != '\n') &&
-          (c != EOF) ) {
-    c = gzgetc( fastq );
-  }
-  i = 0;
+/* init_fastq_pair_src
+   Args: const char fn1[] - R1 fastq file
+         const char fn2[] - R2 fastq file
+   Returns: FQPair_Src* with a reader thread running for each
+            file; NULL => problem
+*/
+FQPair_Src* init_fastq_pair_src( const char fn1[], const char fn2[] ) {
+  FQPair_Src* ps;
+  FQPair_Reader* reader;
+  int side, i;
 
-  /* Now, read the sequence. This should all be on a single line */
-  i = 0;
-  c = gzgetc( fastq );
-  while ( (c != '\n') &&
-          (c != EOF) &&
-          (i < MAX_FQ_LEN) ) {
-    if ( isspace(c) ) {
-      ;
+  ps = (FQPair_Src*)malloc(sizeof( FQPair_Src ));
+  ps->r1 = init_fastq_src( fn1 );
+  ps->r2 = init_fastq_src( fn2 );
+  if ( (ps->r1 == NULL) || (ps->r2 == NULL) ) {
+    if ( ps->r1 != NULL ) {
+      close_fastq_src( ps->r1 );
     }
-    else {
-      c = toupper( c );
-      fq_seq->seq[i++] = c;
+    if ( ps->r2 != NULL ) {
+      close_fastq_src( ps->r2 );
     }
-    c = gzgetc( fastq );
+    free( ps );
+    return NULL;
   }
-  fq_seq->seq[i] = '\0';
-  fq_seq->len = i;
-  
-  /* If the reading stopped because the sequence was longer than
-     MAX_FQ_LEN, then we need to advance the file pointer
-     past this line */
-  if ( i == MAX_FQ_LEN ) {
-    while ( (c != '\n') &&
-            (c != EOF) ) {
-      c = gzgetc( fastq );
+  ps->n_used     = 0;
+  ps->n_released = 0;
+  ps->rec_i      = 0;
+  ps->quit   = 0;
+  ps->error  = 0;
+  ps->n      = 0;
+  pthread_mutex_init( &ps->lock, NULL );
+  pthread_cond_init( &ps->filled, NULL );
+  pthread_cond_init( &ps->used, NULL );
+  for( side = 0; side < 2; side++ ) {
+    ps->n_filled[side] = 0;
+    ps->done[side]     = 0;
+    for( i = 0; i < FQ_PAIR_BATCHES; i++ ) {
+      ps->batches[side][i] = init_fq_batch( FQ_BATCH_RECS );
+      ps->batches[side][i]->n_recs = 0;
     }
   }
-
-  /* Now, read the quality score header */
-  c = gzgetc( fastq );
-  if ( c != '+' ) {
-    fprintf( stderr, "Problem reading quality line for %s\n", fq_seq->id );
-    return 1;
-  }
-  /* Zip through the rest of the line, it should be the same identifier
-     as before or blank */
-  c = gzgetc( fastq );
-  while( (c != '\n') &&
-         (c != EOF) ) {
-    c = gzgetc( fastq );
+  for( side = 0; side < 2; side++ ) {
+    reader = (FQPair_Reader*)malloc(sizeof( FQPair_Reader ));
+    reader->fq_pair_source = ps;
+    reader->side = side;
+    pthread_create( &ps->threads[side], NULL, fqpair_reader, reader );
   }
+  return ps;
+}
 
-  /* Now, get the quality score line */
-  c = gzgetc( fastq );
-  i = 0;
-  while( (c != '\n') &&
-         (c != EOF) &&
-         (i < MAX_FQ_LEN) ) {
-    if ( isspace(c) ) {
-      ;
-    }
-    else {
-      fq_seq->qual[i++] = c;
+/* close_fastq_pair_src
+   Stops the reader threads and closes and frees everything
+*/
+void close_fastq_pair_src( FQPair_Src* ps ) {
+  int side, i;
+  pthread_mutex_lock( &ps->lock );
+  ps->quit = 1;
+  pthread_cond_broadcast( &ps->used );
+  pthread_mutex_unlock( &ps->lock );
+  for( side = 0; side < 2; side++ ) {
+    pthread_join( ps->threads[side], NULL );
+    for( i = 0; i < FQ_PAIR_BATCHES; i++ ) {
+      free_fq_batch( ps->batches[side][i] );
     }
-    c = gzgetc( fastq );
   }
-  fq_seq->qual[i] = '\0';
+  close_fastq_src( ps->r1 );
+  close_fastq_src( ps->r2 );
+  pthread_mutex_destroy( &ps->lock );
+  pthread_cond_destroy( &ps->filled );
+  pthread_cond_destroy( &ps->used );
+  free( ps );
+}
 
-  /* If the reading stopped because the sequence was longer than
-     MAX_FQ_LEN, then we need to advance the file pointer
-     past this line */
-  if ( i == MAX_FQ_LEN ) {
-    while ( (c != '\n') &&
-            (c != EOF) ) {
-      c = gzgetc( fastq );
-    }
+/* get_next_fqpair_batch
+   Args: FQPair_Src* fq_pair_source - the input sources for read pairs
+         FQ_Batch** batch1, batch2 - set to the next R1 and R2 batches
+   Returns: 0 => got a batch of pairs; everything copacetic
+           -1 => EOF or other problem (fq_pair_source->error is set
+                 if R1 and R2 are out of sync or could not be
+                 read); stop trying
+   The records in *batch1 and *batch2 are in the same order and
+   their names have been checked. They are good until the next call.
+*/
+int get_next_fqpair_batch( FQPair_Src* ps, FQ_Batch** batch1,
+			   FQ_Batch** batch2 ) {
+  FQ_Batch* b1;
+  FQ_Batch* b2;
+  size_t k;
+  size_t i;
+
+  if ( ps->error ) {
+    return -1;
+  }
+  pthread_mutex_lock( &ps->lock );
+  k = ps->n_used;
+  /* Asking for batch k lets go of batch k-1 */
+  ps->n_released = k;
+  pthread_cond_broadcast( &ps->used );
+  while( ((ps->n_filled[0] <= k) && !ps->done[0]) ||
+	 ((ps->n_filled[1] <= k) && !ps->done[1]) ) {
+    pthread_cond_wait( &ps->filled, &ps->lock );
+  }
+  /* A reader that is done no longer touches its source */
+  if ( (ps->done[0] && ps->r1->error) || (ps->done[1] && ps->r2->error) ) {
+    pthread_mutex_unlock( &ps->lock );
+    ps->error = 1;
+    return -1;
   }
+  if ( (ps->n_filled[0] <= k) || (ps->n_filled[1] <= k) ) {
+    pthread_mutex_unlock( &ps->lock );
+    return -1;
+  }
+  ps->n_used++;
+  pthread_mutex_unlock( &ps->lock );
 
-  if ( c == EOF ) {
+  b1 = ps->batches[0][k % FQ_PAIR_BATCHES];
+  b2 = ps->batches[1][k % FQ_PAIR_BATCHES];
+  for( i = 0; (i < b1->n_recs) && (i < b2->n_recs); i++ ) {
+    if ( !fq_names_match( &b1->recs[i], &b2->recs[i] ) ) {
+      fprintf( stderr, "Read pair %lu out of sync: %s and %s\n",
+	       k * FQ_BATCH_RECS + i + 1, b1->recs[i].id, b2->recs[i].id );
+      ps->error = 1;
+      return -1;
+    }
+  }
+  if ( b1->n_recs != b2->n_recs ) {
+    fprintf( stderr, "%s and %s have different numbers of reads\n",
+	     ps->r1->fn, ps->r2->fn );
+    ps->error = 1;
+    return -1;
+  }
+  if ( b1->n_recs == 0 ) {
     return -1;
   }
+  *batch1 = b1;
+  *batch2 = b2;
   return 0;
 }
 
-/** fileOpen **/
-FILE * fileOpen(const char *name, char access_mode[]) {
-  FILE * f;
-  f = fopen(name, access_mode);
-  if (f == NULL) {
-    fprintf( stderr, "%s\n", name);
-    perror("Cannot open file");
-    return NULL;
+/* get_next_fqpair_rec
+   Args: FQPair_Src* fq_pair_source - the input sources for read pairs
+         FQ_Rec* fq_rec1, fq_rec2 - set to the next R1 and R2 records
+   Returns: 0 => got a pair; everything copacetic
+           -1 => EOF or other problem; stop trying
+   The records are good until the next call.
+*/
+int get_next_fqpair_rec( FQPair_Src* ps, FQ_Rec* fq_rec1, FQ_Rec* fq_rec2 ) {
+  FQ_Batch* b1;
+  FQ_Batch* b2;
+  if ( ps->n_used > 0 ) {
+    b1 = ps->batches[0][(ps->n_used - 1) % FQ_PAIR_BATCHES];
+    b2 = ps->batches[1][(ps->n_used - 1) % FQ_PAIR_BATCHES];
+  }
+  if ( (ps->n_used == 0) || (ps->rec_i == b1->n_recs) ) {
+    if ( get_next_fqpair_batch( ps, &b1, &b2 ) ) {
+      return -1;
+    }
+    ps->rec_i = 0;
   }
-  return f;
+  *fq_rec1 = b1->recs[ps->rec_i];
+  *fq_rec2 = b2->recs[ps->rec_i];
+  ps->rec_i++;
+  ps->n++;
+  return 0;
+}
+
+/* get_next_fqpair
+   Args: FQPair_Src* fq_pair_source - the input sources for a fastq read pair
+         FQPair* fq_seq_pair - the place to put the read pair data
+   Returns: 0 => data read; everything copacetic
+           -1 => EOF or other problem; stop trying
+   Copies the next pair from get_next_fqpair_rec into the FQs
+ */
+int get_next_fqpair( FQPair_Src* fq_pair_source, FQPair* fq_seq_pair ) {
+  FQ_Rec fq_rec1, fq_rec2;
+  if ( get_next_fqpair_rec( fq_pair_source, &fq_rec1, &fq_rec2 ) ) {
+    return -1;
+  }
+  fq_rec2fq( &fq_rec1, fq_seq_pair->fq1 );
+  fq_rec2fq( &fq_rec2, fq_seq_pair->fq2 );
+  return 0;
 }
@@ -7,11 +7,24 @@
 #include <string.h>
 #include <limits.h>
 #include <zlib.h>
+#include "input-src.h"
+#include "seq-pack.h"
 #define MAX_FN_LEN (2047)
 #define MAX_ID_LEN (511)
 #define MAX_FQ_LEN (2047)
+#define FQ_BUF_SIZE (4194304) // initial size of the FQ_Src read buffer
+#define FQ_BATCH_RECS (4096)  // default number of records in a FQ_Batch
+#define FQ_CHUNK_SIZE (16777216) // bytes per chunk of a mmapped source
+#define FQ_CHUNKS_PER_THREAD (8)
+#define FQ_PAIR_BATCHES (4)   // batches in flight for each file of a pair
 
 /* Data structures */
+
+/* FQ is a copy of one fastq record in fixed-size arrays.
+   It is kept for code that wants NUL-terminated, upper-cased
+   strings; anything longer than MAX_ID_LEN or MAX_FQ_LEN is
+   truncated. New code should use FQ_Rec.
+ */
 typedef struct fq {
   char id[ MAX_ID_LEN + 1];
   char seq[MAX_FQ_LEN + 1];
@@ -19,33 +32,168 @@ typedef struct fq {
   size_t len;
 } FQ;
 
+/* FQ_Rec is a view of one fastq record. The pointers point
+   straight into the FQ_Src read buffer, so nothing is copied and
+   there is no limit on the length of a read. The sequence is
+   exactly as it appears in the input (it is not upper-cased) and
+   the fields are NOT NUL-terminated; use the lengths.
+   A FQ_Rec is only good until the next read from its FQ_Src.
+ */
+typedef struct fq_rec {
+  const char* id;   // identifier, without the leading @
+  size_t id_len;
+  const char* comment; // rest of the header line after the identifier
+  size_t comment_len;  // 0 => no comment
+  const char* seq;
+  size_t len;       // length of seq
+  const char* qual;
+  size_t qual_len;
+  const uint64_t* pack;  // seq packed 2 bits per base; NULL => not packed
+  const uint64_t* nmask; // N-mask for pack; see seq-pack.h
+} FQ_Rec;
+
 typedef struct fqpair {
   FQ* fq1;
   FQ* fq2;
 } FQPair;
 
+/* FQ_Src reads its input in large blocks into buf. Records
+   are found by scanning buf for newlines; the bytes between
+   buf_pos and buf_len have been read but not yet parsed.
+   If a record runs off the end of buf, the unparsed tail is
+   moved to the front, buf is grown if need be, and refilled.
+   The input is an In_Src, so it can be plain, gzip, BGZF or
+   stdin ("-") whatever its name. If the In_Src mmapped the file,
+   map is the mapping, buf points at it and holds the whole file,
+   and eof is already true, so there is never any copying or
+   refilling.
+   If pack is set, records come with their sequence packed 2 bits
+   per base (see seq-pack.h) into pack_words.
+ */
 typedef struct fq_src {
   char fn[MAX_FN_LEN + 1];
-  int is_gz;
-  gzFile fqgz;
-  FILE* fqfp;
+  In_Src* in;
+  char* map;       // the mmapped file, or NULL
+  char* buf;
+  size_t buf_size; // allocated size of buf
+  size_t buf_pos;  // first unparsed byte in buf
+  size_t buf_len;  // number of valid bytes in buf
+  int eof;         // true once the input has been exhausted
+  int error;       // true if the input could not all be read
+  int pack;        // true => fill in pack and nmask of each FQ_Rec
+  uint64_t* pack_words;
+  size_t pack_size; // allocated size of pack_words, in words
   size_t n; // number read so far
 } FQ_Src;
 
+/* FQ_Batch holds copies of a run of consecutive records so they
+   can be handed from the reader to another thread. The records in
+   recs point into data; each field is followed by a NUL.
+   offs holds the offsets of the id, comment, seq and qual of each record
+   in data, and of its packed sequence in words, while the batch is
+   being filled and data and words may move. Sequences are packed
+   only if the FQ_Src the batch is filled from has pack set.
+ */
+typedef struct fq_batch {
+  char* data;
+  size_t data_size;
+  size_t data_len;
+  size_t* offs;
+  uint64_t* words;
+  size_t words_size;
+  size_t words_len;
+  FQ_Rec* recs;
+  size_t n_recs;
+  size_t max_recs;
+  struct fq_batch* next; // link for the queue it is in
+} FQ_Batch;
+
+/* FQPair_Src reads R1 and R2 at the same time. One thread per
+   file fills FQ_PAIR_BATCHES batches of FQ_BATCH_RECS records in
+   turn (batches[0] for R1, batches[1] for R2), so both files are
+   inflated and parsed concurrently. Batches are handed to the
+   caller in order; a batch slot is refilled only after the caller
+   has asked for the batch after the one in it.
+   Read names are checked as pairs are handed out; on the first
+   mismatch, if one file runs out first, or if either cannot be
+   read to the end, error is set and no more pairs are returned.
+ */
 typedef struct fqpair_src {
   FQ_Src* r1;
   FQ_Src* r2;
+  FQ_Batch* batches[2][FQ_PAIR_BATCHES];
+  size_t n_filled[2]; // batches filled so far from each file
+  int done[2];        // no more batches coming from this file
+  size_t n_used;      // batches handed to the caller so far
+  size_t n_released;  // batches the caller is done with
+  size_t rec_i;       // next pair in the current batch
+  int quit;
+  int error;
+  pthread_t threads[2];
+  pthread_mutex_t lock;
+  pthread_cond_t filled;
+  pthread_cond_t used;
+  size_t n;           // pairs read so far
 } FQPair_Src;
 
+/* FQ_Pipe describes a parallel pass over a FQ_Src.
+   The calling thread reads batches of batch_recs records and
+   n_threads workers call do_batch on them, each with its own state
+   made by init_state. When the input is used up (or max_recs
+   records have been read) each worker's state is passed, in
+   worker order, to merge_state along with the first worker's
+   state, which is the result. merge_state should free the state
+   it is given. arg is passed to every callback.
+   n_threads == 0 => one per processor; batch_recs == 0 =>
+   FQ_BATCH_RECS; max_recs == 0 => no limit.
+   use_rec == NULL => every record read counts toward max_recs;
+   otherwise only those it returns true for do, and the pass stops
+   right after the max_recs-th of them. The reader calls it on
+   each record, in file order, so the records passed on do not
+   depend on n_threads.
+   A mmapped FQ_Src is split into chunks that start on record
+   boundaries and the workers parse the chunks themselves.
+   Batches (or chunks) go to whichever worker is free, so the
+   result is only the same as a single-threaded pass if merging
+   does not depend on which records a state saw (e.g., counts).
+ */
+typedef struct fq_pipe {
+  int n_threads;
+  size_t batch_recs;
+  size_t max_recs;
+  int (*use_rec)( const FQ_Rec* rec, void* arg );
+  void* arg;
+  void* (*init_state)( void* arg );
+  void (*do_batch)( void* state, const FQ_Rec* recs, size_t n_recs,
+		    void* arg );
+  void (*merge_state)( void* total, void* state, void* arg );
+} FQ_Pipe;
+
 /* Function prototypes */
-int is_gz( const char* fq_fn );
 int get_next_fq( FQ_Src* fq_source, FQ* fq_seq );
+int get_next_fq_rec( FQ_Src* fq_source, FQ_Rec* fq_rec );
+void fq_rec2fq( const FQ_Rec* fq_rec, FQ* fq_seq );
 int get_next_fqpair( FQPair_Src* fq_pair_source,
 		     FQPair* fq_seq_pair );
+int get_next_fqpair_rec( FQPair_Src* fq_pair_source,
+			 FQ_Rec* fq_rec1, FQ_Rec* fq_rec2 );
+int get_next_fqpair_batch( FQPair_Src* fq_pair_source,
+			   FQ_Batch** batch1, FQ_Batch** batch2 );
+FQPair_Src* init_fastq_pair_src( const char fn1[], const char fn2[] );
+void close_fastq_pair_src( FQPair_Src* fq_pair_source );
+int fq_names_match( const FQ_Rec* fq_rec1, const FQ_Rec* fq_rec2 );
+void set_fastq_inflate_threads( int n_threads );
 FQ_Src* init_fastq_src( const char fn[] );
 FQ_Src* reset_fastq_src( const char fn[], FQ_Src* fq_source );
-int read_fastq( FILE* fp, FQ* fq_seq );
-int gzread_fastq( gzFile gzfp, FQ* fq_seq );
-FILE* fileOpen(const char* name, char access_mode[]);
+void close_fastq_src( FQ_Src* fq_source );
+void fastq_src_range( const FQ_Src* fq_source, size_t start, size_t end,
+		      FQ_Src* part );
+size_t find_fq_record_start( const char* buf, size_t len, size_t pos );
+size_t fill_fq_buf( FQ_Src* fq_source );
+int next_fq_lines( FQ_Src* fq_source, char* lines[4], size_t lens[4] );
+FQ_Batch* init_fq_batch( size_t max_recs );
+void free_fq_batch( FQ_Batch* batch );
+size_t fill_fq_batch( FQ_Src* fq_source, FQ_Batch* batch, size_t n_recs );
+void* run_fq_pipeline( FQ_Src* fq_source, FQ_Pipe* pipe );
 
 #endif
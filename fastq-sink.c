@@ -0,0 +1,556 @@
+#include "fastq-sink.h"
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+/* An empty BGZF block; marks the end of a BGZF file */
+static const unsigned char bgzf_eof[28] = {
+  0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0,
+  0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+/* write_all
+   Writes all len bytes of data to fd, however many write calls
+   that takes
+   Returns: 0 => copacetic; -1 => problem
+*/
+static int write_all( int fd, const void* data, size_t len ) {
+  const char* p = (const char*)data;
+  ssize_t n;
+  while( len > 0 ) {
+    n = write( fd, p, len );
+    if ( n < 0 ) {
+      if ( errno == EINTR ) {
+	continue;
+      }
+      return -1;
+    }
+    p   += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* put_le32
+   Puts x in out as 4 little-endian bytes, as gzip wants
+*/
+static void put_le32( unsigned char* out, unsigned long x ) {
+  out[0] = x & 0xff;
+  out[1] = (x >> 8) & 0xff;
+  out[2] = (x >> 16) & 0xff;
+  out[3] = (x >> 24) & 0xff;
+}
+
+/* compress_sink_chunk
+   Compresses chunk i of buf into a gzip member (with the BC
+   subfield if the sink is BGZF) at its place in buf->cdata.
+   strm (or cc, with libdeflate) is this worker's raw deflate state.
+   Returns: 0 => copacetic; -1 => problem
+*/
+static int compress_sink_chunk( FQ_Sink_Buf* buf, size_t i,
+				z_stream* strm, void* cc ) {
+  FQ_Sink* sink = buf->sink;
+  const unsigned char* in;
+  unsigned char* out;
+  size_t in_len;
+  size_t h_len;
+  size_t c_len;
+  size_t total;
+
+  in     = (const unsigned char*)&buf->data[i * sink->chunk_size];
+  in_len = buf->len - i * sink->chunk_size;
+  if ( in_len > sink->chunk_size ) {
+    in_len = sink->chunk_size;
+  }
+  out   = &buf->cdata[i * sink->chunk_bound];
+  h_len = (sink->mode == FQ_SINK_BGZF) ? 18 : 10;
+  memset( out, 0, h_len );
+  out[0] = 0x1f;
+  out[1] = 0x8b;
+  out[2] = 8;     // deflate
+  out[9] = 0xff;  // OS unknown
+  if ( sink->mode == FQ_SINK_BGZF ) {
+    out[3]  = 4;  // FEXTRA
+    out[10] = 6;  // XLEN
+    out[12] = 'B';
+    out[13] = 'C';
+    out[14] = 2;
+  }
+
+#ifdef HAVE_LIBDEFLATE
+  c_len = libdeflate_deflate_compress( (struct libdeflate_compressor*)cc,
+				       in, in_len, &out[h_len],
+				       sink->chunk_bound - h_len - 8 );
+  if ( c_len == 0 ) {
+    return -1;
+  }
+#else
+  deflateReset( strm );
+  strm->next_in   = (unsigned char*)in;
+  strm->avail_in  = in_len;
+  strm->next_out  = &out[h_len];
+  strm->avail_out = sink->chunk_bound - h_len - 8;
+  if ( deflate( strm, Z_FINISH ) != Z_STREAM_END ) {
+    return -1;
+  }
+  c_len = sink->chunk_bound - h_len - 8 - strm->avail_out;
+#endif
+
+  put_le32( &out[h_len + c_len], crc32( crc32( 0L, Z_NULL, 0 ),
+					in, in_len ) );
+  put_le32( &out[h_len + c_len + 4], in_len );
+  total = h_len + c_len + 8;
+  if ( sink->mode == FQ_SINK_BGZF ) {
+    out[16] = (total - 1) & 0xff;
+    out[17] = (total - 1) >> 8;
+  }
+  buf->c_lens[i] = total;
+  return 0;
+}
+
+/* write_sink_buf
+   Writes everything in buf, compressed or not, to its sink's file
+   Returns: 0 => copacetic; -1 => problem
+*/
+static int write_sink_buf( FQ_Sink_Buf* buf ) {
+  FQ_Sink* sink = buf->sink;
+  size_t i;
+  if ( sink->mode == FQ_SINK_PLAIN ) {
+    return write_all( sink->fd, buf->data, buf->len );
+  }
+  for( i = 0; i < buf->n_chunks; i++ ) {
+    if ( write_all( sink->fd, &buf->cdata[i * sink->chunk_bound],
+		    buf->c_lens[i] ) ) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* fq_sink_worker
+   Thread body. Takes the next chunk of the buffer at the head of
+   the queue and compresses it. The worker that finishes the last
+   chunk of a buffer writes the buffer out and marks it free.
+*/
+static void* fq_sink_worker( void* arg ) {
+  FQ_Sink_Group* group = (FQ_Sink_Group*)arg;
+  FQ_Sink_Buf* buf;
+  z_stream strm;
+  void* cc = NULL;
+  size_t i;
+  int status;
+
+  memset( &strm, 0, sizeof( z_stream ) );
+  deflateInit2( &strm, group->level, Z_DEFLATED, -15, 8,
+		Z_DEFAULT_STRATEGY );
+#ifdef HAVE_LIBDEFLATE
+  cc = libdeflate_alloc_compressor( group->level );
+#endif
+
+  pthread_mutex_lock( &group->lock );
+  while( 1 ) {
+    while( !group->quit && (group->head == NULL) ) {
+      pthread_cond_wait( &group->work, &group->lock );
+    }
+    if ( group->head == NULL ) {
+      break;
+    }
+    buf = group->head;
+    i = buf->next_chunk++;
+    if ( buf->next_chunk == buf->n_chunks ) {
+      group->head = buf->next;
+      if ( group->head == NULL ) {
+	group->tail = NULL;
+      }
+    }
+    pthread_mutex_unlock( &group->lock );
+
+    status = 0;
+    if ( buf->sink->mode != FQ_SINK_PLAIN ) {
+      status = compress_sink_chunk( buf, i, &strm, cc );
+    }
+
+    pthread_mutex_lock( &group->lock );
+    if ( status ) {
+      buf->failed = 1;
+    }
+    buf->n_done++;
+    if ( buf->n_done == buf->n_chunks ) {
+      /* No other worker touches buf now */
+      pthread_mutex_unlock( &group->lock );
+      status = write_sink_buf( buf );
+      pthread_mutex_lock( &group->lock );
+      if ( status ) {
+	perror( buf->sink->fn );
+	buf->failed = 1;
+      }
+      buf->busy = 0;
+      pthread_cond_broadcast( &group->done );
+    }
+  }
+  pthread_mutex_unlock( &group->lock );
+
+  deflateEnd( &strm );
+#ifdef HAVE_LIBDEFLATE
+  libdeflate_free_compressor( (struct libdeflate_compressor*)cc );
+#endif
+  return NULL;
+}
+
+/* init_fq_sink_group
+   Args: int n_threads - compression threads; 0 => one per processor
+         size_t mem_budget - bytes for all the sinks' buffers;
+                             0 => FQ_SINK_MEM
+         size_t max_sinks - most sinks that will be open at once
+         int level - compression level 0-9; -1 => FQ_SINK_LEVEL
+   Returns: FQ_Sink_Group* with its workers running; NULL => the
+            budget is too small for max_sinks sinks
+   Each sink gets two buffers plus room for their compressed
+   chunks, so buffers are a quarter of mem_budget / max_sinks, up
+   to FQ_SINK_BUF_SIZE. They cannot be smaller than one BGZF block
+   (FQ_SINK_MIN_BUF), so a budget with less than that for each
+   sink is refused rather than overrun.
+*/
+FQ_Sink_Group* init_fq_sink_group( int n_threads, size_t mem_budget,
+				   size_t max_sinks, int level ) {
+  FQ_Sink_Group* group;
+  int i;
+
+  if ( n_threads <= 0 ) {
+    n_threads = default_pgz_threads();
+  }
+  if ( mem_budget == 0 ) {
+    mem_budget = FQ_SINK_MEM;
+  }
+  if ( max_sinks == 0 ) {
+    max_sinks = 1;
+  }
+  if ( (level < 0) || (level > 9) ) {
+    level = FQ_SINK_LEVEL;
+  }
+  if ( mem_budget / (4 * max_sinks) < FQ_SINK_MIN_BUF ) {
+    fprintf( stderr, "%lu outputs need at least %lu MB for their buffers\n",
+	     max_sinks, ((4 * max_sinks * FQ_SINK_MIN_BUF) >> 20) + 1 );
+    return NULL;
+  }
+
+  group = (FQ_Sink_Group*)malloc(sizeof( FQ_Sink_Group ));
+  group->n_threads = n_threads;
+  group->level     = level;
+  group->max_sinks = max_sinks;
+  group->n_sinks   = 0;
+  group->buf_size  = mem_budget / (4 * max_sinks);
+  if ( group->buf_size > FQ_SINK_BUF_SIZE ) {
+    group->buf_size = FQ_SINK_BUF_SIZE;
+  }
+  group->head = NULL;
+  group->tail = NULL;
+  group->quit = 0;
+  pthread_mutex_init( &group->lock, NULL );
+  pthread_cond_init( &group->work, NULL );
+  pthread_cond_init( &group->done, NULL );
+  group->threads = (pthread_t*)malloc(sizeof(pthread_t) * n_threads);
+  for( i = 0; i < n_threads; i++ ) {
+    pthread_create( &group->threads[i], NULL, fq_sink_worker, group );
+  }
+  return group;
+}
+
+/* close_fq_sink_group
+   Stops the workers and frees the group. Close its sinks first.
+*/
+void close_fq_sink_group( FQ_Sink_Group* group ) {
+  int i;
+  pthread_mutex_lock( &group->lock );
+  group->quit = 1;
+  pthread_cond_broadcast( &group->work );
+  pthread_mutex_unlock( &group->lock );
+  for( i = 0; i < group->n_threads; i++ ) {
+    pthread_join( group->threads[i], NULL );
+  }
+  pthread_mutex_destroy( &group->lock );
+  pthread_cond_destroy( &group->work );
+  pthread_cond_destroy( &group->done );
+  free( group->threads );
+  free( group );
+}
+
+/* open_fq_sink
+   Args: FQ_Sink_Group* group - the group whose workers compress
+                                and write for this sink
+         const char fn[] - file to write; "-" => stdout
+         int mode - FQ_SINK_PLAIN, FQ_SINK_GZIP, FQ_SINK_BGZF, or
+                    FQ_SINK_AUTO to pick BGZF for names ending in .gz
+   Returns: FQ_Sink* ready to write; NULL => problem
+   BGZF is gzip that any gzip reader can read; it is the better
+   choice unless something needs larger gzip members.
+*/
+FQ_Sink* open_fq_sink( FQ_Sink_Group* group, const char fn[], int mode ) {
+  FQ_Sink* sink;
+  size_t fn_len;
+  size_t max_chunks;
+  int i;
+
+  pthread_mutex_lock( &group->lock );
+  if ( group->n_sinks == group->max_sinks ) {
+    pthread_mutex_unlock( &group->lock );
+    fprintf( stderr, "%s: more than %lu outputs open at once\n",
+	     fn, group->max_sinks );
+    return NULL;
+  }
+  group->n_sinks++;
+  pthread_mutex_unlock( &group->lock );
+
+  if ( mode == FQ_SINK_AUTO ) {
+    fn_len = strlen( fn );
+    mode = ( (fn_len > 3) && (strcmp( &fn[fn_len-3], ".gz" ) == 0) ) ?
+      FQ_SINK_BGZF : FQ_SINK_PLAIN;
+  }
+
+  sink = (FQ_Sink*)malloc(sizeof( FQ_Sink ));
+  strcpy( sink->fn, fn );
+  sink->group = group;
+  sink->mode  = mode;
+  sink->error = 0;
+  sink->n     = 0;
+  sink->n_bytes = 0;
+  sink->cur   = 0;
+  if ( strcmp( fn, "-" ) == 0 ) {
+    sink->fd = STDOUT_FILENO;
+  }
+  else {
+    sink->fd = open( fn, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+    if ( sink->fd < 0 ) {
+      fprintf( stderr, "%s\n", fn );
+      perror( "Cannot open file" );
+      free( sink );
+      pthread_mutex_lock( &group->lock );
+      group->n_sinks--;
+      pthread_mutex_unlock( &group->lock );
+      return NULL;
+    }
+  }
+
+  switch( mode ) {
+  case FQ_SINK_BGZF :
+    sink->chunk_size = BGZF_BLOCK_DATA;
+    break;
+  case FQ_SINK_GZIP :
+    sink->chunk_size = FQ_SINK_GZ_MEMBER;
+    if ( sink->chunk_size > group->buf_size ) {
+      sink->chunk_size = group->buf_size;
+    }
+    break;
+  default :
+    sink->chunk_size = group->buf_size;
+  }
+  max_chunks = group->buf_size / sink->chunk_size;
+  sink->buf_size = max_chunks * sink->chunk_size;
+  sink->chunk_bound = ( mode == FQ_SINK_PLAIN ) ? 0 :
+    compressBound( sink->chunk_size ) + 18 + 8;
+
+  for( i = 0; i < 2; i++ ) {
+    sink->bufs[i].sink   = sink;
+    sink->bufs[i].data   = (char*)malloc( sink->buf_size );
+    sink->bufs[i].len    = 0;
+    sink->bufs[i].cdata  = NULL;
+    sink->bufs[i].c_lens = NULL;
+    if ( mode != FQ_SINK_PLAIN ) {
+      sink->bufs[i].cdata  = (unsigned char*)malloc( max_chunks *
+						     sink->chunk_bound );
+      sink->bufs[i].c_lens = (size_t*)malloc(sizeof(size_t) * max_chunks);
+    }
+    sink->bufs[i].busy   = 0;
+    sink->bufs[i].failed = 0;
+    sink->bufs[i].next   = NULL;
+  }
+  return sink;
+}
+
+/* queue_sink_buf
+   Hands the current buffer of sink to the workers and makes the
+   other buffer current. Waits first for the other buffer to be
+   written, so buffers are written in the order they were filled.
+   Only the thread using sink touches sink->error; failures seen
+   by the workers are picked up from the buffers here.
+*/
+static void queue_sink_buf( FQ_Sink* sink ) {
+  FQ_Sink_Group* group = sink->group;
+  FQ_Sink_Buf* buf   = &sink->bufs[sink->cur];
+  FQ_Sink_Buf* other = &sink->bufs[sink->cur ^ 1];
+
+  if ( buf->len == 0 ) {
+    return;
+  }
+  if ( sink->mode == FQ_SINK_PLAIN ) {
+    buf->n_chunks = 1;
+  }
+  else {
+    buf->n_chunks = (buf->len + sink->chunk_size - 1) / sink->chunk_size;
+  }
+  buf->next_chunk = 0;
+  buf->n_done     = 0;
+  buf->next       = NULL;
+
+  pthread_mutex_lock( &group->lock );
+  while( other->busy ) {
+    pthread_cond_wait( &group->done, &group->lock );
+  }
+  if ( other->failed ) {
+    sink->error = 1;
+  }
+  buf->busy = 1;
+  if ( group->tail == NULL ) {
+    group->head = buf;
+  }
+  else {
+    group->tail->next = buf;
+  }
+  group->tail = buf;
+  pthread_cond_broadcast( &group->work );
+  pthread_mutex_unlock( &group->lock );
+
+  sink->cur ^= 1;
+  other->len = 0;
+}
+
+/* put_fq_sink
+   Args: FQ_Sink* sink - where to write
+         const char* data - bytes to write
+         size_t len - how many
+   Returns: 0 => copacetic; -1 => an earlier write failed
+*/
+int put_fq_sink( FQ_Sink* sink, const char* data, size_t len ) {
+  FQ_Sink_Buf* buf;
+  size_t n;
+  if ( sink->error ) {
+    return -1;
+  }
+  while( len > 0 ) {
+    buf = &sink->bufs[sink->cur];
+    n = sink->buf_size - buf->len;
+    if ( n > len ) {
+      n = len;
+    }
+    memcpy( &buf->data[buf->len], data, n );
+    buf->len      += n;
+    sink->n_bytes += n;
+    data     += n;
+    len      -= n;
+    if ( buf->len == sink->buf_size ) {
+      queue_sink_buf( sink );
+    }
+  }
+  return 0;
+}
+
+/* put_fq_rec
+   Args: FQ_Sink* sink - where to write
+         const FQ_Rec* fq_rec - record to write in four-line format,
+                                with a bare + line
+   Returns: 0 => copacetic; -1 => an earlier write failed
+*/
+int put_fq_rec( FQ_Sink* sink, const FQ_Rec* fq_rec ) {
+  FQ_Sink_Buf* buf = &sink->bufs[sink->cur];
+  size_t rec_len;
+  char* p;
+
+  if ( sink->error ) {
+    return -1;
+  }
+  sink->n++;
+  rec_len = fq_rec->id_len + fq_rec->len + fq_rec->qual_len + 6;
+  if ( fq_rec->comment_len > 0 ) {
+    rec_len += fq_rec->comment_len + 1;
+  }
+  if ( rec_len > sink->buf_size - buf->len ) {
+    put_fq_sink( sink, "@", 1 );
+    put_fq_sink( sink, fq_rec->id, fq_rec->id_len );
+    if ( fq_rec->comment_len > 0 ) {
+      put_fq_sink( sink, " ", 1 );
+      put_fq_sink( sink, fq_rec->comment, fq_rec->comment_len );
+    }
+    put_fq_sink( sink, "\n", 1 );
+    put_fq_sink( sink, fq_rec->seq, fq_rec->len );
+    put_fq_sink( sink, "\n+\n", 3 );
+    put_fq_sink( sink, fq_rec->qual, fq_rec->qual_len );
+    return put_fq_sink( sink, "\n", 1 );
+  }
+
+  /* The whole record fits; copy it straight in */
+  p = &buf->data[buf->len];
+  *p++ = '@';
+  memcpy( p, fq_rec->id, fq_rec->id_len );
+  p += fq_rec->id_len;
+  if ( fq_rec->comment_len > 0 ) {
+    *p++ = ' ';
+    memcpy( p, fq_rec->comment, fq_rec->comment_len );
+    p += fq_rec->comment_len;
+  }
+  *p++ = '\n';
+  memcpy( p, fq_rec->seq, fq_rec->len );
+  p += fq_rec->len;
+  *p++ = '\n';
+  *p++ = '+';
+  *p++ = '\n';
+  memcpy( p, fq_rec->qual, fq_rec->qual_len );
+  p += fq_rec->qual_len;
+  *p++ = '\n';
+  buf->len      += rec_len;
+  sink->n_bytes += rec_len;
+  if ( buf->len == sink->buf_size ) {
+    queue_sink_buf( sink );
+  }
+  return 0;
+}
+
+/* flush_fq_sink
+   Writes out everything put so far and waits until it is written
+   Returns: 0 => copacetic; -1 => a write failed
+*/
+int flush_fq_sink( FQ_Sink* sink ) {
+  FQ_Sink_Group* group = sink->group;
+  queue_sink_buf( sink );
+  pthread_mutex_lock( &group->lock );
+  while( sink->bufs[0].busy || sink->bufs[1].busy ) {
+    pthread_cond_wait( &group->done, &group->lock );
+  }
+  if ( sink->bufs[0].failed || sink->bufs[1].failed ) {
+    sink->error = 1;
+  }
+  pthread_mutex_unlock( &group->lock );
+  return sink->error ? -1 : 0;
+}
+
+/* close_fq_sink
+   Flushes sink, ends a BGZF file with its EOF block (an empty
+   gzip file gets one too, so it is still valid gzip), closes the
+   file (unless it is stdout) and frees sink
+   Returns: 0 => everything was written; -1 => problem
+*/
+int close_fq_sink( FQ_Sink* sink ) {
+  FQ_Sink_Group* group = sink->group;
+  int status;
+  int i;
+
+  status = flush_fq_sink( sink );
+  if ( (status == 0) &&
+       ((sink->mode == FQ_SINK_BGZF) ||
+	((sink->mode == FQ_SINK_GZIP) && (sink->n_bytes == 0))) ) {
+    status = write_all( sink->fd, bgzf_eof, sizeof( bgzf_eof ) );
+  }
+  if ( sink->fd != STDOUT_FILENO ) {
+    if ( close( sink->fd ) ) {
+      status = -1;
+    }
+  }
+  for( i = 0; i < 2; i++ ) {
+    free( sink->bufs[i].data );
+    free( sink->bufs[i].cdata );
+    free( sink->bufs[i].c_lens );
+  }
+  free( sink );
+  pthread_mutex_lock( &group->lock );
+  group->n_sinks--;
+  pthread_mutex_unlock( &group->lock );
+  return status;
+}
@@ -0,0 +1,103 @@
+#ifndef FASTQ_SINK
+#define FASTQ_SINK
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "fastq-io.h"
+#include "pgzip-io.h"
+
+/* Output modes */
+#define FQ_SINK_AUTO (-1)  // BGZF if the name ends in .gz, else plain
+#define FQ_SINK_PLAIN (0)
+#define FQ_SINK_GZIP (1)   // gzip members of FQ_SINK_GZ_MEMBER bytes
+#define FQ_SINK_BGZF (2)   // BGZF blocks, as written by bgzip
+
+#define FQ_SINK_BUF_SIZE (4194304) // largest buffer for one sink
+#define FQ_SINK_MIN_BUF (BGZF_BLOCK_DATA) // smallest buffer for one sink
+#define FQ_SINK_MEM (268435456)    // default memory budget for a group
+#define FQ_SINK_LEVEL (6)          // default compression level
+#define FQ_SINK_GZ_MEMBER (1048576) // bytes compressed per gzip member
+#define BGZF_BLOCK_DATA (65280)    // bytes compressed per BGZF block
+
+/* FQ_Sink_Buf is one of the two output buffers of a FQ_Sink.
+   Once full it is queued for the group's workers, which compress
+   its chunks (BGZF blocks or gzip members) in parallel into cdata.
+   Whichever worker finishes the last chunk writes them all to the
+   file in order and marks the buffer free again.
+ */
+typedef struct fq_sink_buf {
+  struct fq_sink* sink;
+  char* data;
+  size_t len;
+  unsigned char* cdata;  // chunk i is at cdata + i * sink->chunk_bound
+  size_t* c_lens;
+  size_t n_chunks;
+  size_t next_chunk;     // next chunk for a worker to take
+  size_t n_done;         // chunks compressed so far
+  int busy;              // queued or being written
+  int failed;            // compressing or writing it failed
+  struct fq_sink_buf* next; // link for the group queue
+} FQ_Sink_Buf;
+
+/* FQ_Sink is one buffered output file; "-" is stdout.
+   Records are appended to the current buffer. When it is full it
+   is handed to the workers and the other buffer becomes current,
+   after waiting for the write before it to finish, so at most
+   one buffer per sink is in flight and output stays in order.
+   A FQ_Sink must only be used from one thread at a time, but
+   different sinks of a group can be used from different threads.
+ */
+typedef struct fq_sink {
+  char fn[MAX_FN_LEN + 1];
+  struct fq_sink_group* group;
+  int fd;
+  int mode;
+  size_t buf_size;     // bytes in each of bufs, a whole number of chunks
+  size_t chunk_size;   // bytes of input per BGZF block or gzip member
+  size_t chunk_bound;  // most bytes a compressed chunk can take
+  FQ_Sink_Buf bufs[2];
+  int cur;             // the buffer being filled
+  int error;           // true once a write has failed
+  size_t n;            // records put so far
+  size_t n_bytes;      // bytes put so far, before compression
+} FQ_Sink;
+
+/* FQ_Sink_Group is a pool of n_threads compression and writing
+   threads shared by up to max_sinks sinks. Each sink gets two
+   buffers of buf_size bytes (plus room for their compressed
+   chunks), with buf_size set from the memory budget so that
+   max_sinks sinks fit in it, so hundreds of outputs (e.g., one
+   per barcode) can be open at once without unbounded memory.
+ */
+typedef struct fq_sink_group {
+  int n_threads;
+  pthread_t* threads;
+  int level;
+  size_t buf_size;
+  size_t max_sinks;
+  size_t n_sinks;      // sinks open now
+  FQ_Sink_Buf* head;   // queue of buffers waiting for workers
+  FQ_Sink_Buf* tail;
+  int quit;
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+} FQ_Sink_Group;
+
+/* Function prototypes */
+FQ_Sink_Group* init_fq_sink_group( int n_threads, size_t mem_budget,
+				   size_t max_sinks, int level );
+void close_fq_sink_group( FQ_Sink_Group* group );
+FQ_Sink* open_fq_sink( FQ_Sink_Group* group, const char fn[], int mode );
+int put_fq_sink( FQ_Sink* sink, const char* data, size_t len );
+int put_fq_rec( FQ_Sink* sink, const FQ_Rec* fq_rec );
+int flush_fq_sink( FQ_Sink* sink );
+int close_fq_sink( FQ_Sink* sink );
+
+#endif
@@ -0,0 +1,198 @@
+#include "input-src.h"
+
+/* plain backend: read(2) on fd, after giving back the sniffed bytes */
+static int plain_open( In_Src* in, int n_threads ) {
+  return 0;
+}
+
+static long plain_read( In_Src* in, char* buf, size_t len ) {
+  size_t got = 0;
+  ssize_t n;
+  if ( in->head_pos < in->head_len ) {
+    got = in->head_len - in->head_pos;
+    if ( got > len ) {
+      got = len;
+    }
+    memcpy( buf, &in->head[in->head_pos], got );
+    in->head_pos += got;
+  }
+  while( got < len ) {
+    n = read( in->fd, &buf[got], len - got );
+    if ( n < 0 ) {
+      perror( in->fn );
+      return -1;
+    }
+    if ( n == 0 ) {
+      break;
+    }
+    got += n;
+  }
+  return (long)got;
+}
+
+static void plain_close( In_Src* in ) {
+}
+
+/* mmap backend: the whole file is in in->map. Readers that can
+   use the mapping directly look at in->map; in_src_read copies. */
+static int mmap_open( In_Src* in, int n_threads ) {
+  struct stat st;
+  void* map;
+  if ( (fstat( in->fd, &st ) != 0) ||
+       !S_ISREG( st.st_mode ) ||
+       (st.st_size == 0) ) {
+    return -1;
+  }
+  map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0 );
+  if ( map == MAP_FAILED ) {
+    return -1;
+  }
+  madvise( map, st.st_size, MADV_SEQUENTIAL );
+  in->map     = (char*)map;
+  in->map_len = st.st_size;
+  in->map_pos = 0;
+  return 0;
+}
+
+static long mmap_read( In_Src* in, char* buf, size_t len ) {
+  if ( len > in->map_len - in->map_pos ) {
+    len = in->map_len - in->map_pos;
+  }
+  memcpy( buf, &in->map[in->map_pos], len );
+  in->map_pos += len;
+  return (long)len;
+}
+
+static void mmap_close( In_Src* in ) {
+  munmap( in->map, in->map_len );
+  in->map = NULL;
+}
+
+/* gzip and bgzf backends: a PGZ_Src picks its own mode from head */
+static int pgz_open( In_Src* in, int n_threads ) {
+  in->pgz = init_pgz_src( in->fn, in->fd, in->head, in->head_len,
+			  n_threads );
+  return ( in->pgz == NULL ) ? -1 : 0;
+}
+
+static long pgz_backend_read( In_Src* in, char* buf, size_t len ) {
+  return pgz_read( in->pgz, buf, len );
+}
+
+static void pgz_close( In_Src* in ) {
+  close_pgz_src( in->pgz );
+  in->pgz = NULL;
+}
+
+static const In_Backend plain_backend = { "plain", plain_open,
+					  plain_read, plain_close };
+static const In_Backend mmap_backend  = { "mmap", mmap_open,
+					  mmap_read, mmap_close };
+static const In_Backend gzip_backend  = { "gzip", pgz_open,
+					  pgz_backend_read, pgz_close };
+static const In_Backend bgzf_backend  = { "bgzf", pgz_open,
+					  pgz_backend_read, pgz_close };
+
+/* sniff_backend
+   Picks the backend for in from the magic bytes in in->head
+*/
+static const In_Backend* sniff_backend( const In_Src* in ) {
+  if ( is_bgzf( in->head, in->head_len ) ) {
+    return &bgzf_backend;
+  }
+  if ( (in->head_len >= 2) &&
+       (in->head[0] == 0x1f) && (in->head[1] == 0x8b) ) {
+    return &gzip_backend;
+  }
+  return &mmap_backend;
+}
+
+/* open_in_src
+   Args: const char fn[] - file to read; "-" => stdin
+         int n_threads - inflate threads for BGZF; 0 => one per processor
+   Returns: In_Src* ready to read; NULL => problem
+   Reads the first few bytes to pick the backend. An uncompressed
+   input that cannot be mmapped (stdin, pipes, empty files) falls
+   back to the plain backend. Compressed input that cannot be
+   opened is an error.
+*/
+In_Src* open_in_src( const char fn[], int n_threads ) {
+  In_Src* in;
+  ssize_t n;
+
+  in = (In_Src*)malloc(sizeof( In_Src ));
+  strcpy( in->fn, fn );
+  in->map = NULL;
+  in->pgz = NULL;
+  if ( strcmp( fn, "-" ) == 0 ) {
+    in->fd = STDIN_FILENO;
+  }
+  else {
+    in->fd = open( fn, O_RDONLY );
+    if ( in->fd < 0 ) {
+      fprintf( stderr, "%s\n", fn );
+      perror( "Cannot open file" );
+      free( in );
+      return NULL;
+    }
+  }
+
+  /* Sniff; a pipe may hand these over a few at a time */
+  in->head_len = 0;
+  in->head_pos = 0;
+  while( in->head_len < PGZ_HEAD_LEN ) {
+    n = read( in->fd, &in->head[in->head_len], PGZ_HEAD_LEN - in->head_len );
+    if ( n <= 0 ) {
+      break;
+    }
+    in->head_len += n;
+  }
+
+  in->backend = sniff_backend( in );
+  if ( in->backend->open( in, n_threads ) ) {
+    if ( in->backend != &mmap_backend ) {
+      fprintf( stderr, "Cannot read %s input from %s\n",
+	       in->backend->name, fn );
+      if ( in->fd != STDIN_FILENO ) {
+	close( in->fd );
+      }
+      free( in );
+      return NULL;
+    }
+    in->backend = &plain_backend;
+    in->backend->open( in, n_threads );
+  }
+  return in;
+}
+
+/* in_src_read
+   Reads up to len bytes; fewer only at the end of the input or
+   before a problem
+   Returns: number of bytes read; 0 => EOF; -1 => problem
+*/
+long in_src_read( In_Src* in, char* buf, size_t len ) {
+  return in->backend->read( in, buf, len );
+}
+
+/* close_in_src
+   Closes the backend and the file and frees in
+*/
+void close_in_src( In_Src* in ) {
+  in->backend->close( in );
+  if ( in->fd != STDIN_FILENO ) {
+    close( in->fd );
+  }
+  free( in );
+}
+
+/** fileOpen **/
+FILE * fileOpen(const char *name, char access_mode[]) {
+  FILE * f;
+  f = fopen(name, access_mode);
+  if (f == NULL) {
+    fprintf( stderr, "%s\n", name);
+    perror("Cannot open file");
+    return NULL;
+  }
+  return f;
+}
@@ -0,0 +1,57 @@
+#ifndef INPUT_SRC
+#define INPUT_SRC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "pgzip-io.h"
+
+/* In_Src is a byte stream from a file or stdin (filename "-").
+   The first bytes are sniffed to pick a backend, so the filename
+   does not matter:
+     bgzf  - gzip with the BGZF BC subfield; inflated in parallel
+     gzip  - any other gzip; inflated on its own thread
+     mmap  - an uncompressed regular file; map holds all of it
+     plain - anything else, e.g. stdin or a pipe; read(2) as is
+   head holds the sniffed bytes, which the plain backend returns
+   before reading any more from fd.
+ */
+typedef struct in_src In_Src;
+
+/* In_Backend is the table of functions behind an In_Src.
+   read returns the number of bytes put in buf, 0 at EOF, or
+   -1 if there was a problem. close frees what open set up,
+   but not the In_Src itself or fd.
+ */
+typedef struct in_backend {
+  const char* name;
+  int (*open)( In_Src* in, int n_threads );
+  long (*read)( In_Src* in, char* buf, size_t len );
+  void (*close)( In_Src* in );
+} In_Backend;
+
+struct in_src {
+  char fn[MAX_FN_LEN + 1];
+  const In_Backend* backend;
+  int fd;
+  unsigned char head[PGZ_HEAD_LEN];
+  size_t head_len;
+  size_t head_pos;
+  char* map;       // mmap backend: the whole file
+  size_t map_len;
+  size_t map_pos;  // mmap backend: next byte for in_src_read
+  PGZ_Src* pgz;    // gzip and bgzf backends
+};
+
+/* Function prototypes */
+In_Src* open_in_src( const char fn[], int n_threads );
+long in_src_read( In_Src* in, char* buf, size_t len );
+void close_in_src( In_Src* in );
+FILE* fileOpen( const char* name, char access_mode[] );
+
+#endif
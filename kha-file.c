@@ -0,0 +1,388 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kha-file.h"
+
+/* KHA_Writer writes a saved KHA a table at a time */
+typedef struct kha_writer {
+  FILE* fp;
+  KHA_File_Header hdr;
+  KHA_File_Table* dir; // room for one per index of kaa
+  KHA_File_Table* cur; // table being written
+  uint64_t pos; // bytes written so far
+  uint64_t prev_key;
+} KHA_Writer;
+
+/* KHA_Cursor walks the keys of one table of a saved KHA */
+typedef struct kha_cursor {
+  const uint8_t* p;
+  const uint8_t* end;
+  uint64_t key;
+  uint64_t count;
+} KHA_Cursor;
+
+/* put_varint
+   Writes x to w as a LEB128 varint
+*/
+static inline void put_varint( KHA_Writer* w, uint64_t x ) {
+  while( x >= 0x80 ) {
+    putc( (int)(x & 0x7f) | 0x80, w->fp );
+    x >>= 7;
+    w->pos++;
+  }
+  putc( (int)x, w->fp );
+  w->pos++;
+}
+
+/* get_varint
+   Reads a LEB128 varint at *p, no further than end, and moves *p
+   past it. Returns: 0 if it runs past end
+*/
+static inline int get_varint( const uint8_t** p, const uint8_t* end,
+			      uint64_t* x ) {
+  unsigned int shift = 0;
+  *x = 0;
+  while( (*p < end) && (shift < 64) ) {
+    *x |= (uint64_t)(**p & 0x7f) << shift;
+    if ( (*(*p)++ & 0x80) == 0 ) {
+      return 1;
+    }
+    shift += 7;
+  }
+  return 0;
+}
+
+/* start_writer
+   Opens fn and writes everything that goes before the tables.
+   Returns: 0 if copacetic, -1 if fn cannot be written
+*/
+static int start_writer( KHA_Writer* w, const char* fn,
+			 const KHA_File_Header* info, const HLL* hll ) {
+  w->fp = fopen( fn, "wb" );
+  if ( w->fp == NULL ) {
+    fprintf( stderr, "Cannot write %s\n", fn );
+    return -1;
+  }
+  w->hdr = *info;
+  memset( w->hdr.magic, 0, sizeof(w->hdr.magic) );
+  strcpy( w->hdr.magic, KHA_FILE_MAGIC );
+  w->hdr.version   = KHA_FILE_VERSION;
+  w->hdr.hll_p     = ( hll != NULL ) ? hll->p : 0;
+  w->hdr.n_tables  = 0;
+  w->hdr.n_entries = 0;
+  w->dir = (KHA_File_Table*)calloc( w->hdr.kaa_size + 1,
+				     sizeof(KHA_File_Table) );
+  /* The header is written again at the end, when it is done */
+  fwrite( &w->hdr, sizeof(KHA_File_Header), 1, w->fp );
+  w->pos = sizeof(KHA_File_Header);
+  if ( hll != NULL ) {
+    fwrite( hll->reg, 1, hll->m, w->fp );
+    w->pos += hll->m;
+  }
+  return 0;
+}
+
+static void start_table( KHA_Writer* w, unsigned int inx ) {
+  w->cur = &w->dir[w->hdr.n_tables];
+  w->cur->inx    = inx;
+  w->cur->n_keys = 0;
+  w->cur->offset = w->pos;
+  w->prev_key    = 0;
+}
+
+/* put_entry
+   Writes the next key, which must be more than the one before,
+   and its count to the current table
+*/
+static inline void put_entry( KHA_Writer* w, uint64_t key, uint64_t count ) {
+  put_varint( w, key - w->prev_key );
+  put_varint( w, count );
+  w->prev_key = key;
+  w->cur->n_keys++;
+  w->hdr.n_entries += count;
+}
+
+static void end_table( KHA_Writer* w ) {
+  w->cur->bytes = w->pos - w->cur->offset;
+  if ( w->cur->n_keys > 0 ) {
+    w->hdr.n_tables++;
+  }
+}
+
+/* finish_writer
+   Writes the directory and the finished header and closes the
+   file. Returns: 0 if copacetic, -1 if anything failed to write
+*/
+static int finish_writer( KHA_Writer* w ) {
+  static const uint8_t zeros[sizeof(uint64_t)] = { 0 };
+  int failed;
+  /* The directory is read in place, so it starts on an 8-byte
+     boundary */
+  if ( w->pos % sizeof(uint64_t) != 0 ) {
+    fwrite( zeros, 1, sizeof(uint64_t) - w->pos % sizeof(uint64_t), w->fp );
+    w->pos += sizeof(uint64_t) - w->pos % sizeof(uint64_t);
+  }
+  w->hdr.dir_offset = w->pos;
+  fwrite( w->dir, sizeof(KHA_File_Table), w->hdr.n_tables, w->fp );
+  fseek( w->fp, 0, SEEK_SET );
+  fwrite( &w->hdr, sizeof(KHA_File_Header), 1, w->fp );
+  failed = ferror( w->fp );
+  if ( fclose( w->fp ) != 0 ) {
+    failed = 1;
+  }
+  free( w->dir );
+  if ( failed ) {
+    fprintf( stderr, "Error writing saved counts\n" );
+    return -1;
+  }
+  return 0;
+}
+
+int save_KHA( KHA* kha, const KHA_File_Header* info, const HLL* hll,
+	      const char* fn ) {
+  KHA_Writer w;
+  KA_Entry* entries;
+  KHA_File_Header hdr = *info;
+  size_t n, i;
+  unsigned int inx;
+  hdr.k        = kha->k;
+  hdr.kaa_size = kha->kaa_size;
+  if ( start_writer( &w, fn, &hdr, hll ) != 0 ) {
+    return -1;
+  }
+  for( inx = 0; inx <= kha->kaa_size; inx++ ) {
+    if ( kha->kaa[inx] == NULL ) {
+      continue;
+    }
+    entries = sorted_kmer_array( kha->kaa[inx], &n );
+    start_table( &w, inx );
+    for( i = 0; i < n; i++ ) {
+      put_entry( &w, entries[i].key, entries[i].count );
+    }
+    end_table( &w );
+    free( entries );
+  }
+  return finish_writer( &w );
+}
+
+KHA_File* open_KHA_file( const char* fn ) {
+  KHA_File* kf;
+  struct stat st;
+  const KHA_File_Header* hdr;
+  uint64_t i, end;
+  int fd;
+  fd = open( fn, O_RDONLY );
+  if ( fd < 0 ) {
+    fprintf( stderr, "Cannot open %s\n", fn );
+    return NULL;
+  }
+  if ( (fstat( fd, &st ) != 0) ||
+       ((size_t)st.st_size < sizeof(KHA_File_Header)) ) {
+    fprintf( stderr, "%s is not a saved KHA\n", fn );
+    close( fd );
+    return NULL;
+  }
+  kf = (KHA_File*)malloc(sizeof(KHA_File));
+  kf->fd   = fd;
+  kf->size = st.st_size;
+  kf->map  = (const uint8_t*)mmap( NULL, kf->size, PROT_READ, MAP_PRIVATE,
+				   fd, 0 );
+  if ( kf->map == MAP_FAILED ) {
+    fprintf( stderr, "Cannot mmap %s\n", fn );
+    close( fd );
+    free( kf );
+    return NULL;
+  }
+  /* Each table is read from start to end once */
+  madvise( (void*)kf->map, kf->size, MADV_SEQUENTIAL );
+  hdr = kf->hdr = (const KHA_File_Header*)kf->map;
+  kf->dir     = NULL;
+  kf->hll_reg = ( hdr->hll_p > 0 ) ? kf->map + sizeof(KHA_File_Header) :
+    NULL;
+
+  /* Everything the header points to has to be in the file */
+  end = sizeof(KHA_File_Header);
+  if ( hdr->hll_p > 0 ) {
+    end += ( (hdr->hll_p >= HLL_MIN_P) && (hdr->hll_p <= HLL_MAX_P) ) ?
+      ((uint64_t)1 << hdr->hll_p) : kf->size + 1;
+  }
+  if ( (memcmp( hdr->magic, KHA_FILE_MAGIC, sizeof(KHA_FILE_MAGIC) ) != 0) ||
+       (hdr->version != KHA_FILE_VERSION) || (end > kf->size) ||
+       (hdr->dir_offset > kf->size) ||
+       (hdr->dir_offset % sizeof(uint64_t) != 0) ||
+       (hdr->n_tables > (kf->size - hdr->dir_offset) /
+	sizeof(KHA_File_Table)) ) {
+    fprintf( stderr, "%s is not a saved KHA\n", fn );
+    close_KHA_file( kf );
+    return NULL;
+  }
+  kf->dir = (const KHA_File_Table*)(kf->map + hdr->dir_offset);
+  for( i = 0; i < hdr->n_tables; i++ ) {
+    if ( (kf->dir[i].inx > hdr->kaa_size) ||
+	 (kf->dir[i].offset > kf->size) ||
+	 (kf->dir[i].bytes > kf->size - kf->dir[i].offset) ) {
+      fprintf( stderr, "%s is not a saved KHA\n", fn );
+      close_KHA_file( kf );
+      return NULL;
+    }
+  }
+  return kf;
+}
+
+void close_KHA_file( KHA_File* kf ) {
+  munmap( (void*)kf->map, kf->size );
+  close( kf->fd );
+  free( kf );
+}
+
+/* next_entry
+   Moves c to the next key of its table.
+   Returns: 0 if there are no more
+*/
+static inline int next_entry( KHA_Cursor* c ) {
+  uint64_t delta;
+  if ( !get_varint( &c->p, c->end, &delta ) ||
+       !get_varint( &c->p, c->end, &c->count ) ) {
+    return 0;
+  }
+  c->key += delta;
+  return 1;
+}
+
+/* sift_down
+   Restores the heap of cursors, ordered by key, below i
+*/
+static void sift_down( KHA_Cursor** heap, size_t n, size_t i ) {
+  KHA_Cursor* tmp;
+  size_t c;
+  while( (c = 2 * i + 1) < n ) {
+    if ( (c + 1 < n) && (heap[c + 1]->key < heap[c]->key) ) {
+      c++;
+    }
+    if ( heap[i]->key <= heap[c]->key ) {
+      return;
+    }
+    tmp = heap[i];
+    heap[i] = heap[c];
+    heap[c] = tmp;
+    i = c;
+  }
+}
+
+/* hist_add
+   Adds a key with count count to hist
+*/
+static inline void hist_add( Dup_Hist* hist, uint64_t count ) {
+  if ( count >= MAX_SEQ_COUNT ) {
+    hist->count[MAX_SEQ_COUNT]++;
+    hist->tail_seqs += count;
+  }
+  else {
+    hist->count[count]++;
+  }
+  hist->n_uniq++;
+}
+
+int merge_KHA_files( KHA_File** in, size_t n_in, const char* out_fn,
+		     KHA* total, KHA_File_Header* info, HLL** hll ) {
+  KHA_Writer w;
+  KHA_Cursor* cursors;
+  KHA_Cursor** heap;
+  size_t* next_table; // of each file
+  const KHA_File_Table* t;
+  HLL part;
+  uint64_t key, count;
+  size_t f, n_heap;
+  unsigned int inx;
+
+  *info = *in[0]->hdr;
+  info->total      = 0;
+  info->unreadable = 0;
+  *hll = NULL;
+  for( f = 0; f < n_in; f++ ) {
+    if ( (in[f]->hdr->mode != info->mode) || (in[f]->hdr->k != info->k) ||
+	 (in[f]->hdr->kaa_size != info->kaa_size) ) {
+      fprintf( stderr, "Saved counts made different ways cannot be merged\n" );
+      return -1;
+    }
+    if ( in[f]->hdr->hll_p != info->hll_p ) {
+      info->hll_p = 0;
+    }
+    info->total      += in[f]->hdr->total;
+    info->unreadable += in[f]->hdr->unreadable;
+  }
+  if ( (info->kaa_size != total->kaa_size) || (info->k != total->k) ) {
+    fprintf( stderr, "Saved counts do not match the KHA to merge into\n" );
+    return -1;
+  }
+  if ( info->hll_p > 0 ) {
+    *hll = init_hll( info->hll_p );
+    for( f = 0; f < n_in; f++ ) {
+      part.p   = info->hll_p;
+      part.m   = (*hll)->m;
+      part.reg = (uint8_t*)in[f]->hll_reg;
+      merge_hll( *hll, &part );
+    }
+  }
+  if ( (out_fn != NULL) && (start_writer( &w, out_fn, info, *hll ) != 0) ) {
+    return -1;
+  }
+
+  cursors    = (KHA_Cursor*)malloc(sizeof(KHA_Cursor) * n_in);
+  heap       = (KHA_Cursor**)malloc(sizeof(KHA_Cursor*) * n_in);
+  next_table = (size_t*)calloc( n_in, sizeof(size_t) );
+  for( inx = 0; inx <= info->kaa_size; inx++ ) {
+    /* The directory of each file is in order of inx */
+    n_heap = 0;
+    for( f = 0; f < n_in; f++ ) {
+      if ( (next_table[f] < in[f]->hdr->n_tables) &&
+	   (in[f]->dir[next_table[f]].inx == inx) ) {
+	t = &in[f]->dir[next_table[f]++];
+	cursors[f].p   = in[f]->map + t->offset;
+	cursors[f].end = cursors[f].p + t->bytes;
+	cursors[f].key = 0;
+	if ( next_entry( &cursors[f] ) ) {
+	  heap[n_heap++] = &cursors[f];
+	}
+      }
+    }
+    if ( n_heap == 0 ) {
+      continue;
+    }
+    for( f = n_heap; f > 0; f-- ) {
+      sift_down( heap, n_heap, f - 1 );
+    }
+    if ( out_fn != NULL ) {
+      start_table( &w, inx );
+    }
+    while( n_heap > 0 ) {
+      key   = heap[0]->key;
+      count = 0;
+      while( (n_heap > 0) && (heap[0]->key == key) ) {
+	count += heap[0]->count;
+	if ( !next_entry( heap[0] ) ) {
+	  heap[0] = heap[--n_heap];
+	}
+	sift_down( heap, n_heap, 0 );
+      }
+      if ( out_fn != NULL ) {
+	put_entry( &w, key, count );
+      }
+      hist_add( &total->hist, count );
+      total->n_entries += count;
+    }
+    if ( out_fn != NULL ) {
+      end_table( &w );
+    }
+  }
+  free( cursors );
+  free( heap );
+  free( next_table );
+  info->n_entries = total->n_entries;
+  if ( out_fn != NULL ) {
+    return finish_writer( &w );
+  }
+  return 0;
+}
@@ -0,0 +1,108 @@
+#ifndef KHA_FILE
+#define KHA_FILE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "kmer.h"
+#include "read-hash.h"
+#define KHA_FILE_MAGIC "KHACNT1"
+#define KHA_FILE_VERSION (1)
+
+/* What the keys of a saved KHA are; files are only merged with
+   files of the same mode, k, and kaa_size */
+#define KHA_MODE_ENDS (0)         // start and end k-mers
+#define KHA_MODE_WHOLE (1)        // hashes of whole reads
+#define KHA_MODE_PAIRS (2)        // start k-mers of both reads of a pair
+#define KHA_MODE_PAIRS_INSERT (3) // and the insert length
+
+/* A saved KHA file is a header, the HyperLogLog registers if
+   there are any, the tables, and last the directory of the
+   tables (one per index of kaa that has any keys) at dir_offset,
+   so it can be written once the tables are. The directory is
+   padded out to start on an 8-byte boundary. Each table is its
+   keys in order, each written as the difference from the key
+   before (the first from 0) and then its count, both as LEB128
+   varints: 7 bits a byte, low bits first, the high bit set on
+   every byte but the last. Most differences and counts are small,
+   so a key and count mostly take a few bytes rather than 16.
+   Everything is in the byte order of the machine that wrote it.
+   Files are read by mmapping them and decoding the tables in
+   place, so opening one costs nothing, and tables of many files
+   are merged a key at a time, in order, without loading any of
+   them.
+ */
+typedef struct kha_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t mode; // KHA_MODE_*
+  uint32_t k;
+  uint32_t kaa_size;
+  uint32_t hll_p; // 0 => no HyperLogLog
+  uint32_t n_tables;
+  uint64_t n_entries; // sum of the counts
+  uint64_t total; // sequences (or pairs) counted
+  uint64_t unreadable; // and not counted
+  uint64_t dir_offset; // of the directory, from the start of the file
+} KHA_File_Header;
+
+typedef struct kha_file_table {
+  uint32_t inx; // index in kaa
+  uint32_t pad;
+  uint64_t n_keys;
+  uint64_t offset; // from the start of the file
+  uint64_t bytes;
+} KHA_File_Table;
+
+/* KHA_File is a mmapped saved KHA */
+typedef struct kha_file {
+  int fd;
+  size_t size;
+  const uint8_t* map;
+  const KHA_File_Header* hdr;
+  const KHA_File_Table* dir; // hdr->n_tables of them
+  const uint8_t* hll_reg; // 2^hdr->hll_p bytes, or NULL
+} KHA_File;
+
+/* save_KHA
+   Args: KHA* kha - the counts; its tables are finished
+         const KHA_File_Header* info - mode, total, and unreadable
+                                       are taken from here
+         const HLL* hll - saved too if not NULL
+         const char* fn - file to write
+   Returns: 0 if copacetic, -1 if fn could not be written
+*/
+int save_KHA( KHA* kha, const KHA_File_Header* info, const HLL* hll,
+	      const char* fn );
+
+/* open_KHA_file
+   Returns the mmapped saved KHA in fn, or NULL (with a message
+   on stderr) if it cannot be read or is not a saved KHA
+*/
+KHA_File* open_KHA_file( const char* fn );
+
+void close_KHA_file( KHA_File* kf );
+
+/* merge_KHA_files
+   Args: KHA_File** in - n_in saved KHAs, all of the same mode,
+                         k, and kaa_size
+         const char* out_fn - file to write the merged counts to,
+                              or NULL
+         KHA* total - a KHA of the same k with nothing in it; gets
+                      the histogram and n_entries of the merged
+                      counts (but no tables)
+         KHA_File_Header* info - gets the merged header
+         HLL** hll - gets the merged HyperLogLog, if all the files
+                     have one with the same p; else NULL
+   Counts of the same key, in the same table, are summed, so the
+   result is the same as if all the sequences had been counted
+   together. Each table is merged a key at a time over a heap of
+   the files that have it, so memory does not grow with the size
+   of the files.
+   Returns: 0 if copacetic, -1 if the files do not match or
+   out_fn could not be written
+*/
+int merge_KHA_files( KHA_File** in, size_t n_in, const char* out_fn,
+		     KHA* total, KHA_File_Header* info, HLL** hll );
+
+#endif
@@ -0,0 +1,609 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "fastq-io.h"
+#include "kmer.h"
+#include "pgzip-io.h"
+#define VERSION (1)
+#define DEF_KMER_LEN (21)
+#define MAX_SPECTRUM_K (31) // odd k up to here has no palindromes
+#define DEF_MIN_LEN (11) // minimizer length
+#define DEF_BLOOM_MB (1024)
+#define DEF_TABLE_MB (4096)
+#define DEF_MAX_COUNT (10000)
+#define DEF_DUMP_MIN (2)
+#define PARTS_PER_THREAD (4)
+#define FLUSH_KMERS (1024) // k-mers a worker holds for a partition
+#define RUN_BUF (4096) // entries read from a spilled run at a time
+#define PREFETCH_AHEAD (16) // k-mers looked up ahead of the one counted
+
+/* Spectrum_Part is one partition of the k-mers: those whose
+   minimizer hashes to it. Only k-mers the Bloom filter has seen
+   before go in the table, so the many k-mers seen once (mostly
+   sequencing errors) take 4 bits or so each rather than a table
+   slot. When the table takes more than its share of -M it is
+   sorted and written to spill as a run and started again. */
+typedef struct spectrum_part {
+  pthread_mutex_t lock;
+  KA* ka;
+  Count_Bloom* bloom;
+  FILE* spill; // NULL until the first run is written
+  size_t n_runs;
+  off_t* run_start; // of each run in spill; run_start[n_runs] is the end
+} Spectrum_Part;
+
+/* Spectrum is shared by the workers */
+typedef struct spectrum {
+  unsigned int k;
+  unsigned int m; // minimizer length
+  unsigned int n_parts;
+  Spectrum_Part* parts;
+  size_t part_bytes; // table budget of each partition
+  const char* tmp_dir;
+} Spectrum;
+
+/* Spectrum_Worker is what each worker keeps: k-mers waiting to
+   go to each partition, so the partition lock is taken once per
+   FLUSH_KMERS of them, and the minimizer hashes of the current
+   read. */
+typedef struct spectrum_worker {
+  uint64_t* buf; // FLUSH_KMERS per partition
+  size_t* n_buf;
+  uint64_t* mhash; // of the canonical m-mer at each position
+  size_t mhash_size;
+  uint64_t n_seqs;
+  uint64_t n_kmers;
+} Spectrum_Worker;
+
+/* Spill_Run reads back a sorted run, from spill or from memory */
+typedef struct spill_run {
+  int fd; // -1 => in memory
+  off_t off; // next byte to read from fd
+  off_t end;
+  KA_Entry* buf; // the run itself if in memory
+  size_t n; // entries in buf
+  size_t i; // next one
+} Spill_Run;
+
+void help( void );
+void* spectrum_init_state( void* arg );
+void spectrum_do_batch( void* state, const FQ_Rec* recs, size_t n_recs,
+			void* arg );
+void spectrum_merge_state( void* total, void* state, void* arg );
+void flush_worker( Spectrum_Worker* sw, Spectrum* sp );
+uint64_t merge_runs( Spectrum* sp, uint64_t* hist, size_t max_count,
+		     FILE* dump, uint64_t dump_min );
+
+int main ( int argc, char* argv[] ) {
+  extern char* optarg;
+  char fq_fn[MAX_FN_LEN + 1];
+  char dump_fn[MAX_FN_LEN + 1] = {'\0'};
+  FQ_Src* fq_source;
+  FQ_Pipe pipe;
+  Spectrum sp;
+  Spectrum_Worker* result;
+  FILE* dump = NULL;
+  uint64_t* hist;
+  uint64_t table_sum, distinct = 0, n_spills = 0;
+  size_t i;
+  int ich;
+  int n_threads         = 1;
+  size_t bloom_mb       = DEF_BLOOM_MB;
+  size_t table_mb       = DEF_TABLE_MB;
+  size_t max_count      = DEF_MAX_COUNT;
+  uint64_t dump_min     = DEF_DUMP_MIN;
+  uint64_t max_to_read  = 0;
+  if ( argc == 1 ) {
+    help();
+  }
+  sp.k       = DEF_KMER_LEN;
+  sp.m       = DEF_MIN_LEN;
+  sp.tmp_dir = getenv( "TMPDIR" );
+  if ( sp.tmp_dir == NULL ) {
+    sp.tmp_dir = "/tmp";
+  }
+
+  while( (ich=getopt( argc, argv, "f:k:l:m:t:B:M:T:h:o:x:" )) != -1 ) {
+    switch(ich) {
+    case 'f' :
+      strcpy( fq_fn, optarg );
+      break;
+    case 'k' :
+      sp.k = atoi( optarg );
+      break;
+    case 'l' :
+      sp.m = atoi( optarg );
+      break;
+    case 'm' :
+      max_to_read = strtoull( optarg, NULL, 10 );
+      break;
+    case 't' :
+      n_threads = atoi( optarg );
+      break;
+    case 'B' :
+      bloom_mb = strtoul( optarg, NULL, 10 );
+      break;
+    case 'M' :
+      table_mb = strtoul( optarg, NULL, 10 );
+      break;
+    case 'T' :
+      sp.tmp_dir = optarg;
+      break;
+    case 'h' :
+      max_count = strtoul( optarg, NULL, 10 );
+      break;
+    case 'o' :
+      strcpy( dump_fn, optarg );
+      break;
+    case 'x' :
+      dump_min = strtoull( optarg, NULL, 10 );
+      break;
+    default :
+      help();
+    }
+  }
+
+  if ( (sp.k < 1) || (sp.k > MAX_SPECTRUM_K) || (max_count < 2) ||
+       (sp.m < 1) ) {
+    help();
+  }
+  if ( sp.m > sp.k ) {
+    sp.m = sp.k;
+  }
+  /* Only k-mers in the table can be dumped */
+  if ( dump_min < 2 ) {
+    dump_min = 2;
+  }
+  fq_source = init_fastq_src( fq_fn );
+  if ( fq_source == NULL ) {
+    help();
+  }
+  if ( strlen( dump_fn ) > 0 ) {
+    dump = fopen( dump_fn, "w" );
+    if ( dump == NULL ) {
+      fprintf( stderr, "Cannot write %s\n", dump_fn );
+      exit( 1 );
+    }
+  }
+  if ( n_threads <= 0 ) {
+    n_threads = default_pgz_threads();
+  }
+
+  sp.n_parts    = PARTS_PER_THREAD * n_threads;
+  sp.part_bytes = (table_mb << 20) / sp.n_parts;
+  sp.parts = (Spectrum_Part*)malloc(sizeof(Spectrum_Part) * sp.n_parts);
+  for( i = 0; i < sp.n_parts; i++ ) {
+    pthread_mutex_init( &sp.parts[i].lock, NULL );
+    sp.parts[i].ka        = init_kmer_array( sp.k, NULL );
+    sp.parts[i].bloom     = init_count_bloom( (bloom_mb << 20) / sp.n_parts );
+    sp.parts[i].spill     = NULL;
+    sp.parts[i].n_runs    = 0;
+    sp.parts[i].run_start = NULL;
+  }
+
+  pipe.n_threads   = n_threads;
+  pipe.batch_recs  = 0;
+  pipe.max_recs    = max_to_read;
+  pipe.use_rec     = NULL;
+  pipe.arg         = &sp;
+  pipe.init_state  = spectrum_init_state;
+  pipe.do_batch    = spectrum_do_batch;
+  pipe.merge_state = spectrum_merge_state;
+  result = (Spectrum_Worker*)run_fq_pipeline( fq_source, &pipe );
+  if ( fq_source->error ) {
+    exit( 1 );
+  }
+  flush_worker( result, &sp );
+  for( i = 0; i < sp.n_parts; i++ ) {
+    n_spills += sp.parts[i].n_runs;
+    free_count_bloom( sp.parts[i].bloom );
+  }
+
+  hist = (uint64_t*)calloc( max_count + 1, sizeof(uint64_t) );
+  table_sum = merge_runs( &sp, hist, max_count, dump, dump_min );
+  /* Every k-mer never let into a table was seen once */
+  if ( result->n_kmers > table_sum ) {
+    hist[1] += result->n_kmers - table_sum;
+  }
+  for( i = 1; i <= max_count; i++ ) {
+    distinct += hist[i];
+  }
+
+  printf( "# k-mer spectrum of %s\n", fq_fn );
+  printf( "# k = %u; a k-mer and its reverse complement count as one\n",
+	  sp.k );
+  printf( "# Total sequences: %lu\n", result->n_seqs );
+  printf( "# Total k-mers: %lu\n", result->n_kmers );
+  printf( "# Distinct k-mers: %lu\n", distinct );
+  printf( "# Runs spilled to %s (-M): %lu\n", sp.tmp_dir, n_spills );
+  printf( "# count\tdistinct k-mers; the last row is %lu or more\n",
+	  max_count );
+  for( i = 1; i <= max_count; i++ ) {
+    if ( hist[i] > 0 ) {
+      printf( "%lu\t%lu\n", i, hist[i] );
+    }
+  }
+  if ( dump != NULL ) {
+    fclose( dump );
+  }
+  exit( 0 );
+}
+
+/* Callbacks for run_fq_pipeline; arg points at the Spectrum */
+void* spectrum_init_state( void* arg ) {
+  Spectrum* sp = (Spectrum*)arg;
+  Spectrum_Worker* sw;
+  sw = (Spectrum_Worker*)malloc(sizeof(Spectrum_Worker));
+  sw->buf   = (uint64_t*)malloc(sizeof(uint64_t) * FLUSH_KMERS * sp->n_parts);
+  sw->n_buf = (size_t*)calloc( sp->n_parts, sizeof(size_t) );
+  sw->mhash_size = MAX_SEQ_LEN + 1;
+  sw->mhash   = (uint64_t*)malloc(sizeof(uint64_t) * sw->mhash_size);
+  sw->n_seqs  = 0;
+  sw->n_kmers = 0;
+  return sw;
+}
+
+/* spill_part
+   Writes the table of part, sorted, to the end of its spill file
+   as another run, and starts an empty table
+*/
+static void spill_part( Spectrum_Part* part, const Spectrum* sp ) {
+  KA_Entry* run;
+  char fn[MAX_FN_LEN + 1];
+  size_t n;
+  int fd;
+  if ( part->spill == NULL ) {
+    snprintf( fn, MAX_FN_LEN, "%s/kmer-spectrum.XXXXXX", sp->tmp_dir );
+    fd = mkstemp( fn );
+    if ( fd < 0 ) {
+      fprintf( stderr, "Cannot make a temporary file in %s\n", sp->tmp_dir );
+      exit( 1 );
+    }
+    /* Gone as soon as it is closed */
+    unlink( fn );
+    part->spill = fdopen( fd, "w+" );
+    part->run_start = (off_t*)malloc(sizeof(off_t));
+    part->run_start[0] = 0;
+  }
+  run = sorted_kmer_array( part->ka, &n );
+  if ( fwrite( run, sizeof(KA_Entry), n, part->spill ) != n ) {
+    fprintf( stderr, "Cannot write to %s\n", sp->tmp_dir );
+    exit( 1 );
+  }
+  free( run );
+  part->n_runs++;
+  part->run_start = (off_t*)realloc( part->run_start,
+				     sizeof(off_t) * (part->n_runs + 1) );
+  part->run_start[part->n_runs] = ftello( part->spill );
+  free_kmer_array( part->ka );
+  part->ka = init_kmer_array( sp->k, NULL );
+}
+
+/* count_kmers
+   Counts n k-mers of one partition. A k-mer in the table gets
+   its count bumped; otherwise it goes through the Bloom filter,
+   and into the table once the filter has seen it before: with
+   a count of 2 the first time it gets to 2, so the time it was
+   kept out is counted; with a count of 1 if it was more (it was
+   in a table before that was spilled, with the earlier counts).
+   The table bucket and filter block of the k-mer PREFETCH_AHEAD
+   on are loaded while this one is counted.
+   Caller holds the partition lock.
+*/
+static void count_kmers( Spectrum_Part* part, const Spectrum* sp,
+			 const uint64_t* kmers, size_t n ) {
+  unsigned int seen;
+  size_t i;
+  for( i = 0; i < n; i++ ) {
+    if ( i + PREFETCH_AHEAD < n ) {
+      prefetch_kmer_array( part->ka, kmers[i + PREFETCH_AHEAD] );
+      prefetch_count_bloom( part->bloom, kmers[i + PREFETCH_AHEAD] );
+    }
+    if ( bump_kmer_array( part->ka, kmers[i], 1 ) ) {
+      continue;
+    }
+    seen = add_count_bloom( part->bloom, kmers[i] );
+    if ( seen >= 2 ) {
+      add_kmer_array( part->ka, kmers[i], ( seen == 2 ) ? 2 : 1 );
+    }
+  }
+  if ( KA_bytes( part->ka ) > sp->part_bytes ) {
+    spill_part( part, sp );
+  }
+}
+
+/* flush_part
+   Hands the k-mers sw holds for partition p over to it
+*/
+static void flush_part( Spectrum_Worker* sw, Spectrum* sp, unsigned int p ) {
+  Spectrum_Part* part = &sp->parts[p];
+  pthread_mutex_lock( &part->lock );
+  count_kmers( part, sp, &sw->buf[(size_t)p * FLUSH_KMERS], sw->n_buf[p] );
+  pthread_mutex_unlock( &part->lock );
+  sw->n_buf[p] = 0;
+}
+
+void flush_worker( Spectrum_Worker* sw, Spectrum* sp ) {
+  unsigned int p;
+  for( p = 0; p < sp->n_parts; p++ ) {
+    if ( sw->n_buf[p] > 0 ) {
+      flush_part( sw, sp, p );
+    }
+  }
+}
+
+/* spectrum_do_batch
+   Every canonical k-mer of every sequence goes to the partition
+   of its minimizer: the least hash of the canonical m-mers in
+   it. Neighbouring k-mers mostly share their minimizer, so runs
+   of them go to the same partition, and a k-mer and its reverse
+   complement always do.
+*/
+void spectrum_do_batch( void* state, const FQ_Rec* recs, size_t n_recs,
+			void* arg ) {
+  Spectrum* sp = (Spectrum*)arg;
+  Spectrum_Worker* sw = (Spectrum_Worker*)state;
+  Kmer_Iter it, mit;
+  uint64_t min_hash = 0;
+  size_t min_pos = 0, last_pos = 0, end, j;
+  unsigned int p;
+  int in_run;
+  size_t i;
+  for( i = 0; i < n_recs; i++ ) {
+    sw->n_seqs++;
+    if ( recs[i].len > sw->mhash_size ) {
+      sw->mhash_size = recs[i].len;
+      sw->mhash = (uint64_t*)realloc( sw->mhash,
+				      sizeof(uint64_t) * sw->mhash_size );
+    }
+    init_kmer_iter_rec( &mit, &recs[i], sp->m );
+    while( next_kmer( &mit ) ) {
+      sw->mhash[mit.pos] = mix_key( canonical_kmer( &mit ) );
+    }
+    in_run = 0;
+    init_kmer_iter_rec( &it, &recs[i], sp->k );
+    while( next_kmer( &it ) ) {
+      end = it.pos + sp->k - sp->m;
+      if ( in_run && (it.pos == last_pos + 1) && (min_pos >= it.pos) ) {
+	if ( sw->mhash[end] < min_hash ) {
+	  min_hash = sw->mhash[end];
+	  min_pos  = end;
+	}
+      }
+      else {
+	/* The minimizer went out of the window (or this is the
+	   first k-mer after an N): look at the whole window */
+	min_hash = sw->mhash[it.pos];
+	min_pos  = it.pos;
+	for( j = it.pos + 1; j <= end; j++ ) {
+	  if ( sw->mhash[j] < min_hash ) {
+	    min_hash = sw->mhash[j];
+	    min_pos  = j;
+	  }
+	}
+      }
+      in_run   = 1;
+      last_pos = it.pos;
+      p = min_hash % sp->n_parts;
+      sw->buf[(size_t)p * FLUSH_KMERS + sw->n_buf[p]++] =
+	canonical_kmer( &it );
+      sw->n_kmers++;
+      if ( sw->n_buf[p] == FLUSH_KMERS ) {
+	flush_part( sw, sp, p );
+      }
+    }
+  }
+}
+
+void spectrum_merge_state( void* total, void* state, void* arg ) {
+  Spectrum* sp = (Spectrum*)arg;
+  Spectrum_Worker* t  = (Spectrum_Worker*)total;
+  Spectrum_Worker* sw = (Spectrum_Worker*)state;
+  flush_worker( sw, sp );
+  t->n_seqs  += sw->n_seqs;
+  t->n_kmers += sw->n_kmers;
+  free( sw->buf );
+  free( sw->n_buf );
+  free( sw->mhash );
+  free( sw );
+}
+
+/* fill_run
+   Reads the next entries of a spilled run into its buffer.
+   Returns: 0 if there are none left
+*/
+static int fill_run( Spill_Run* run ) {
+  size_t want;
+  ssize_t got;
+  if ( (run->fd < 0) || (run->off >= run->end) ) {
+    return 0;
+  }
+  want = run->end - run->off;
+  if ( want > RUN_BUF * sizeof(KA_Entry) ) {
+    want = RUN_BUF * sizeof(KA_Entry);
+  }
+  got = pread( run->fd, run->buf, want, run->off );
+  if ( got != (ssize_t)want ) {
+    fprintf( stderr, "Cannot read back a spilled run\n" );
+    exit( 1 );
+  }
+  run->off += want;
+  run->n = want / sizeof(KA_Entry);
+  run->i = 0;
+  return 1;
+}
+
+/* run_kmer
+   Returns the next k-mer of run; run must not be used up
+*/
+static inline uint64_t run_kmer( const Spill_Run* run ) {
+  return run->buf[run->i].key;
+}
+
+/* sift_down
+   Restores the heap of runs, ordered by next k-mer, below i
+*/
+static void sift_down( Spill_Run** heap, size_t n, size_t i ) {
+  Spill_Run* tmp;
+  size_t c;
+  while( (c = 2 * i + 1) < n ) {
+    if ( (c + 1 < n) && (run_kmer( heap[c + 1] ) < run_kmer( heap[c] )) ) {
+      c++;
+    }
+    if ( run_kmer( heap[i] ) <= run_kmer( heap[c] ) ) {
+      return;
+    }
+    tmp = heap[i];
+    heap[i] = heap[c];
+    heap[c] = tmp;
+    i = c;
+  }
+}
+
+/* write_kmer
+   Writes kmer, as bases, and its count to dump
+*/
+static void write_kmer( FILE* dump, uint64_t kmer, unsigned int k,
+			uint64_t count ) {
+  char bases[MAX_KMER_LEN + 1];
+  unsigned int i;
+  for( i = 0; i < k; i++ ) {
+    bases[k - 1 - i] = "ACGT"[(kmer >> (2 * i)) & 3];
+  }
+  bases[k] = '\0';
+  fprintf( dump, "%s\t%lu\n", bases, count );
+}
+
+/* merge_runs
+   Args: Spectrum* sp - after counting; its tables are freed
+         uint64_t* hist - max_count + 1 entries; hist[i] gets
+                          the k-mers in the tables with count i,
+                          hist[max_count] the ones with more
+         FILE* dump - if not NULL, gets every k-mer with a count
+                      of dump_min or more, in order
+   Each table is sorted and kept in memory as one more run, or
+   spilled too if the partition has spilled before or the sorted
+   tables kept would take more than the table budget. All the
+   runs are sorted and the partitions hold different k-mers, so
+   merging all of them at once puts each k-mer's counts side by
+   side and gives them in order.
+   Returns: the sum of the counts
+*/
+uint64_t merge_runs( Spectrum* sp, uint64_t* hist, size_t max_count,
+		     FILE* dump, uint64_t dump_min ) {
+  Spectrum_Part* part;
+  Spill_Run* runs;
+  Spill_Run** heap;
+  size_t n_runs = 0, n_heap = 0, kept_bytes = 0, n, r;
+  size_t budget = sp->part_bytes * sp->n_parts;
+  uint64_t kmer, count, sum = 0;
+  unsigned int p;
+
+  for( p = 0; p < sp->n_parts; p++ ) {
+    part = &sp->parts[p];
+    finish_kmer_array( part->ka );
+    if ( (part->n_runs > 0) ||
+	 (kept_bytes + sizeof(KA_Entry) * part->ka->n_keys > budget) ) {
+      spill_part( part, sp );
+      fflush( part->spill );
+    }
+    else {
+      kept_bytes += sizeof(KA_Entry) * part->ka->n_keys;
+    }
+    n_runs += part->n_runs + 1;
+  }
+  runs = (Spill_Run*)malloc(sizeof(Spill_Run) * n_runs);
+  heap = (Spill_Run**)malloc(sizeof(Spill_Run*) * n_runs);
+  n_runs = 0;
+  for( p = 0; p < sp->n_parts; p++ ) {
+    part = &sp->parts[p];
+    if ( part->ka->n_keys > 0 ) {
+      runs[n_runs].fd  = -1;
+      runs[n_runs].buf = sorted_kmer_array( part->ka, &runs[n_runs].n );
+      runs[n_runs].i   = 0;
+      heap[n_heap++]   = &runs[n_runs++];
+    }
+    free_kmer_array( part->ka );
+    for( r = 0; r < part->n_runs; r++ ) {
+      runs[n_runs].fd  = fileno( part->spill );
+      runs[n_runs].off = part->run_start[r];
+      runs[n_runs].end = part->run_start[r + 1];
+      runs[n_runs].buf = (KA_Entry*)malloc(sizeof(KA_Entry) * RUN_BUF);
+      if ( fill_run( &runs[n_runs] ) ) {
+	heap[n_heap++] = &runs[n_runs];
+      }
+      n_runs++;
+    }
+  }
+  for( n = n_heap; n > 0; n-- ) {
+    sift_down( heap, n_heap, n - 1 );
+  }
+
+  while( n_heap > 0 ) {
+    kmer  = run_kmer( heap[0] );
+    count = 0;
+    while( (n_heap > 0) && (run_kmer( heap[0] ) == kmer) ) {
+      count += heap[0]->buf[heap[0]->i++].count;
+      if ( (heap[0]->i == heap[0]->n) && !fill_run( heap[0] ) ) {
+	heap[0] = heap[--n_heap];
+      }
+      sift_down( heap, n_heap, 0 );
+    }
+    sum += count;
+    hist[( count < max_count ) ? count : max_count]++;
+    if ( (dump != NULL) && (count >= dump_min) ) {
+      write_kmer( dump, kmer, sp->k, count );
+    }
+  }
+
+  for( r = 0; r < n_runs; r++ ) {
+    free( runs[r].buf );
+  }
+  free( runs );
+  free( heap );
+  for( p = 0; p < sp->n_parts; p++ ) {
+    if ( sp->parts[p].spill != NULL ) {
+      fclose( sp->parts[p].spill );
+      free( sp->parts[p].run_start );
+    }
+  }
+  return sum;
+}
+
+void help( void ) {
+  printf( "kmer-spectrum V %d\n", VERSION );
+  printf( "    -f <fastq file>\n" );
+  printf( "    -k <kmer length; 1 to %d; default = %d>\n",
+	  MAX_SPECTRUM_K, DEF_KMER_LEN );
+  printf( "    -m <max sequences to examine; 0 => all; default = 0>\n" );
+  printf( "    -t <threads; 0 => one per processor; default = 1>\n" );
+  printf( "    -B <MB for the Bloom filters; default = %d>\n",
+	  DEF_BLOOM_MB );
+  printf( "    -M <MB for the k-mer tables; default = %d>\n",
+	  DEF_TABLE_MB );
+  printf( "    -T <directory for spilled tables; default = $TMPDIR or /tmp>\n" );
+  printf( "    -l <minimizer length; default = %d>\n", DEF_MIN_LEN );
+  printf( "    -h <last row of the histogram; default = %d>\n",
+	  DEF_MAX_COUNT );
+  printf( "    -o <file to write k-mers and counts to, sorted>\n" );
+  printf( "    -x <least count of the k-mers written with -o; default = %d>\n",
+	  DEF_DUMP_MIN );
+  printf( "Counts every canonical k-mer (a k-mer and its reverse\n" );
+  printf( "complement count as one) of every sequence and prints\n" );
+  printf( "how many distinct k-mers were seen once, twice, and so\n" );
+  printf( "on, e.g., for estimating genome size and heterozygosity.\n" );
+  printf( "A counting Bloom filter keeps k-mers out of the tables\n" );
+  printf( "until they are seen a second time, so the k-mers seen\n" );
+  printf( "only once, mostly sequencing errors, take little memory.\n" );
+  printf( "The filter can mistake a new k-mer for one it has seen;\n" );
+  printf( "such a k-mer is counted once too often, so give it more\n" );
+  printf( "memory (-B) if there are many distinct k-mers. K-mers are\n" );
+  printf( "split among the threads by minimizer. When the tables\n" );
+  printf( "take more than -M, they are sorted and written to disk\n" );
+  printf( "(-T) and merged at the end, so memory stays within\n" );
+  printf( "about -B + -M however big the input is.\n" );
+  exit( 0 );
+}
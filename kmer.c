@@ -1,54 +1,121 @@
+#include <sys/mman.h>
 #include "kmer.h"
 
-int seq2inx( char* seq, unsigned int k, unsigned int* inx ) {
-  int i = 0;
-  unsigned int inx_build = 0;
-  while( i < k ) {
-    inx_build = inx_build << 2;
-    switch( seq[i] ) {
-    case 'A' :
-      inx_build += 0;
-      break;
-    case 'a' :
-      inx_build += 0;
-      break;
-    case 'C' :
-      inx_build += 1;
-      break;
-    case 'c' :
-      inx_build += 1;
-      break;
-    case 'G' :
-      inx_build += 2;
-      break;
-    case 'g' :
-      inx_build += 2;
-      break;
-    case 'T' :
-      inx_build += 3;
-      break;
-    case 't' :
-      inx_build += 3;
-      break;
-    default :
+const unsigned char base_code[256] = {
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 0, 4, 1, 4, 4, 4, 2, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 0, 4, 1, 4, 4, 4, 2, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4
+};
+
+int seq2inx( const char* seq, unsigned int k, unsigned int* inx ) {
+  uint64_t kmer;
+  if ( seq2kmer( seq, k, &kmer ) == 0 ) {
+    return 0;
+  }
+  *inx = (unsigned int)kmer;
+  return 1;
+}
+
+int seq2kmer( const char* seq, unsigned int k, uint64_t* kmer ) {
+  unsigned int i;
+  unsigned int c;
+  uint64_t inx_build = 0;
+  for( i = 0; i < k; i++ ) {
+    c = base_code[(unsigned char)seq[i]];
+    if ( c == KMER_BAD_BASE ) {
       return 0;
     }
-    i++;
+    inx_build = (inx_build << 2) | c;
   }
-  *inx = inx_build;
+  *kmer = inx_build;
   return 1;
 }
 
-int add_seq_to_KHA( KHA* kha, FQ* fq ) {
-  unsigned int start_inx;
-  unsigned int end_inx;
-  unsigned int full_inx = 0;
+uint64_t revcomp_kmer( uint64_t kmer, unsigned int k ) {
+  uint64_t x = ~kmer;
+  /* Reverse the order of the 32 2-bit codes, then drop the
+     ones that were above the k-mer */
+  x = __builtin_bswap64( x );
+  x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+  x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+  return x >> (64 - 2 * k);
+}
+
+void init_kmer_iter( Kmer_Iter* it, const char* seq, size_t len,
+		     unsigned int k ) {
+  it->seq    = seq;
+  it->pack   = NULL;
+  it->nmask  = NULL;
+  it->len    = len;
+  it->next   = 0;
+  it->pos    = 0;
+  it->k      = k;
+  it->filled = 0;
+  it->mask   = ( k >= MAX_KMER_LEN ) ? ~(uint64_t)0 :
+    (((uint64_t)1 << (2 * k)) - 1);
+  it->fwd    = 0;
+  it->rev    = 0;
+}
+
+void init_kmer_iter_rec( Kmer_Iter* it, const FQ_Rec* fq, unsigned int k ) {
+  if ( fq->pack != NULL ) {
+    init_kmer_iter( it, NULL, fq->len, k );
+    it->pack  = fq->pack;
+    it->nmask = fq->nmask;
+  }
+  else {
+    init_kmer_iter( it, fq->seq, fq->len, k );
+  }
+}
 
-  if ( seq2inx( fq->seq, kha->k, &start_inx ) == 0 ) {
+int packed_seq2inx( const FQ_Rec* fq, size_t start, unsigned int k,
+		    unsigned int* inx ) {
+  uint64_t kmer;
+  if ( packed_kmer( fq->pack, fq->nmask, start, k, &kmer ) == 0 ) {
     return 0;
   }
-  if ( seq2inx( &fq->seq[fq->len - kha->k], kha->k, &end_inx )
-       == 0 ) {
+  *inx = (unsigned int)kmer;
+  return 1;
+}
+
+/* rec_kmer
+   Same as seq2kmer for the k bases at start in fq, using fq->pack
+   if the record was packed
+*/
+static inline int rec_kmer( const FQ_Rec* fq, size_t start, unsigned int k,
+			    uint64_t* kmer ) {
+  if ( fq->pack != NULL ) {
+    return packed_kmer( fq->pack, fq->nmask, start, k, kmer );
+  }
+  return seq2kmer( &fq->seq[start], k, kmer );
+}
+
+int add_seq_to_KHA( KHA* kha, const FQ_Rec* fq ) {
+  uint64_t start_inx;
+  uint64_t end_inx;
+  uint64_t full_inx = 0;
+
+  if ( (fq->len < kha->k) ||
+       (fq->len > kha->kaa_size) ) {
+    return 0;
+  }
+  if ( rec_kmer( fq, 0, kha->k, &start_inx ) == 0 ) {
+    return 0;
+  }
+  if ( rec_kmer( fq, fq->len - kha->k, kha->k, &end_inx ) == 0 ) {
     return 0;
   }
   full_inx = start_inx;
@@ -57,35 +124,496 @@ int add_seq_to_KHA( KHA* kha, FQ* fq ) {
   
   /* First for this length? */
   if (kha->kaa[fq->len] == NULL ) {
-    kha->kaa[fq->len] = init_kmer_array( kha->k );
+    kha->kaa[fq->len] = init_kmer_array( kha->k, &kha->hist );
+  }
+  inc_kmer_array( kha->kaa[fq->len], full_inx );
+  kha->n_entries++;
+  return 1;
+}
+
+int KHA_takes_seq( unsigned int k, const FQ_Rec* fq ) {
+  uint64_t kmer;
+  if ( (fq->len < k) || (fq->len > MAX_SEQ_LEN) ) {
+    return 0;
+  }
+  return ( rec_kmer( fq, 0, k, &kmer ) &&
+	   rec_kmer( fq, fq->len - k, k, &kmer ) );
+}
+
+int add_pair_to_KHA( KHA* kha, const FQ_Rec* fq1, const FQ_Rec* fq2,
+		     size_t insert_len ) {
+  uint64_t start1_inx;
+  uint64_t start2_inx;
+
+  if ( (fq1->len < kha->k) || (fq2->len < kha->k) ) {
+    return 0;
+  }
+  if ( (rec_kmer( fq1, 0, kha->k, &start1_inx ) == 0) ||
+       (rec_kmer( fq2, 0, kha->k, &start2_inx ) == 0) ) {
+    return 0;
+  }
+  if ( insert_len > kha->kaa_size ) {
+    insert_len = kha->kaa_size;
   }
-  kha->kaa[fq->len]->k_array[full_inx]++;
+  if ( kha->kaa[insert_len] == NULL ) {
+    kha->kaa[insert_len] = init_kmer_array( kha->k, &kha->hist );
+  }
+  inc_kmer_array( kha->kaa[insert_len],
+		  (start1_inx << (2 * kha->k)) | start2_inx );
+  kha->n_entries++;
+  return 1;
+}
+
+size_t pair_insert_len( const FQ_Rec* fq1, const FQ_Rec* fq2,
+			unsigned int k ) {
+  Kmer_Iter it;
+  uint64_t r2_end;
+  uint64_t target;
+  size_t overlap, j, mismatches;
+  unsigned int b1, b2;
+
+  if ( (fq1->len < k) || (fq2->len < k) ||
+       (seq2kmer( &fq2->seq[fq2->len - k], k, &r2_end ) == 0) ) {
+    return 0;
+  }
+  /* Where read 2 starts, reverse complemented, in read 1 */
+  target = revcomp_kmer( r2_end, k );
+  init_kmer_iter( &it, fq1->seq, fq1->len, k );
+  while( next_kmer( &it ) ) {
+    if ( it.fwd != target ) {
+      continue;
+    }
+    overlap = fq1->len - it.pos;
+    if ( overlap > fq2->len ) {
+      overlap = fq2->len;
+    }
+    if ( overlap < PAIR_MIN_OVERLAP ) {
+      break;
+    }
+    mismatches = 0;
+    for( j = 0; j < overlap; j++ ) {
+      b1 = base_code[(unsigned char)fq1->seq[it.pos + j]];
+      b2 = base_code[(unsigned char)fq2->seq[fq2->len - 1 - j]];
+      if ( (b1 == KMER_BAD_BASE) || (b2 == KMER_BAD_BASE) ||
+	   (b1 != 3 - b2) ) {
+	mismatches++;
+      }
+    }
+    if ( mismatches * PAIR_MISMATCH_RATE <= overlap ) {
+      return it.pos + fq2->len;
+    }
+  }
+  return 0;
+}
+
+int add_hash_to_KHA( KHA* kha, size_t len, uint64_t hash ) {
+  if ( len == 0 ) {
+    return 0;
+  }
+  if ( len > kha->kaa_size ) {
+    len = kha->kaa_size;
+  }
+  if ( kha->kaa[len] == NULL ) {
+    kha->kaa[len] = init_kmer_array( kha->k, &kha->hist );
+  }
+  inc_kmer_array( kha->kaa[len], hash );
   kha->n_entries++;
   return 1;
 }
 
-KA* init_kmer_array( const unsigned int k ) {
+/* alloc_buckets
+   Returns n empty buckets, aligned to a cache line
+*/
+static KA_Bucket* alloc_buckets( size_t n ) {
+  KA_Bucket* buckets;
+  buckets = (KA_Bucket*)aligned_alloc( sizeof(KA_Bucket),
+				       sizeof(KA_Bucket) * n );
+  if ( buckets == NULL ) {
+    fprintf( stderr, "Out of memory for %lu k-mer buckets\n", n );
+    exit( 1 );
+  }
+  memset( buckets, 0, sizeof(KA_Bucket) * n );
+  return buckets;
+}
+
+/* find_slot
+   Looks for key in the n buckets starting with its home bucket.
+   Returns: the bucket with key in slot *s, or with the empty
+   slot *s where it would go if it is not there
+*/
+static inline KA_Bucket* find_slot( KA_Bucket* buckets, size_t n,
+				    uint64_t key, unsigned int* s ) {
+  size_t b;
+  unsigned int i;
+  b = mix_key( key ) & (n - 1);
+  while( 1 ) {
+    for( i = 0; i < KA_BUCKET_SLOTS; i++ ) {
+      if ( (buckets[b].count[i] == 0) ||
+	   (buckets[b].key[i] == key) ) {
+	*s = i;
+	return &buckets[b];
+      }
+    }
+    b = (b + 1) & (n - 1);
+  }
+}
+
+/* migrate_buckets
+   Moves up to n_move buckets of the old table into the new one;
+   frees the old table when it is all moved
+*/
+static void migrate_buckets( KA* ka, size_t n_move ) {
+  KA_Bucket* from;
+  KA_Bucket* to;
+  unsigned int i, s;
+  for( ; (n_move > 0) && (ka->migrated < ka->old_n_buckets); n_move-- ) {
+    from = &ka->old[ka->migrated++];
+    for( i = 0; i < KA_BUCKET_SLOTS; i++ ) {
+      if ( from->count[i] ) {
+	/* The slot found is empty: keys only go in the new table
+	   when they are not in the old one */
+	to = find_slot( ka->buckets, ka->n_buckets, from->key[i], &s );
+	to->key[s]   = from->key[i];
+	to->count[s] = from->count[i];
+	ka->n_keys++;
+      }
+    }
+  }
+  if ( ka->migrated == ka->old_n_buckets ) {
+    free( ka->old );
+    ka->old = NULL;
+    ka->old_n_buckets = 0;
+    ka->migrated = 0;
+  }
+}
+
+/* find_ovf
+   Returns the slot of key in the overflow table of ka, or the
+   empty slot where it would go
+*/
+static size_t find_ovf( const KA* ka, uint64_t key ) {
+  size_t i;
+  i = mix_key( key ) & (ka->ovf_size - 1);
+  while( (ka->ovf_count[i] != 0) && (ka->ovf_key[i] != key) ) {
+    i = (i + 1) & (ka->ovf_size - 1);
+  }
+  return i;
+}
+
+/* grow_ovf
+   Makes the overflow table of ka twice as big (or makes it, the
+   first time) and puts the promoted keys back in
+*/
+static void grow_ovf( KA* ka ) {
+  uint64_t* old_key   = ka->ovf_key;
+  uint64_t* old_count = ka->ovf_count;
+  size_t old_size     = ka->ovf_size;
+  size_t i, j;
+  ka->ovf_size  = ( old_size == 0 ) ? KA_INIT_OVERFLOW : 2 * old_size;
+  ka->ovf_key   = (uint64_t*)malloc(sizeof(uint64_t) * ka->ovf_size);
+  ka->ovf_count = (uint64_t*)calloc(ka->ovf_size, sizeof(uint64_t));
+  if ( (ka->ovf_key == NULL) || (ka->ovf_count == NULL) ) {
+    fprintf( stderr, "Out of memory for %lu k-mer counts\n", ka->ovf_size );
+    exit( 1 );
+  }
+  for( i = 0; i < old_size; i++ ) {
+    if ( old_count[i] ) {
+      j = find_ovf( ka, old_key[i] );
+      ka->ovf_key[j]   = old_key[i];
+      ka->ovf_count[j] = old_count[i];
+    }
+  }
+  free( old_key );
+  free( old_count );
+}
+
+/* hist_move
+   Moves a key from count old to count new in hist
+*/
+static inline void hist_move( Dup_Hist* hist, uint64_t old, uint64_t new ) {
+  if ( old >= MAX_SEQ_COUNT ) {
+    hist->count[MAX_SEQ_COUNT]--;
+    hist->tail_seqs -= old;
+  }
+  else if ( old > 0 ) {
+    hist->count[old]--;
+  }
+  else {
+    hist->n_uniq++;
+  }
+  if ( new >= MAX_SEQ_COUNT ) {
+    hist->count[MAX_SEQ_COUNT]++;
+    hist->tail_seqs += new;
+  }
+  else {
+    hist->count[new]++;
+  }
+}
+
+/* bump_count
+   Adds n to the count in bucket slot s of ka, promoting the key
+   to the overflow table when the 8 bits run out
+*/
+static inline void bump_count( KA* ka, KA_Bucket* bucket, unsigned int s,
+			       uint64_t n ) {
+  uint64_t old;
+  size_t i;
+  if ( bucket->count[s] == KA_PROMOTED ) {
+    i = find_ovf( ka, bucket->key[s] );
+    old = ka->ovf_count[i];
+    ka->ovf_count[i] += n;
+  }
+  else if ( bucket->count[s] + n < KA_PROMOTED ) {
+    old = bucket->count[s];
+    bucket->count[s] += n;
+  }
+  else {
+    if ( 2 * (ka->n_ovf + 1) > ka->ovf_size ) {
+      grow_ovf( ka );
+    }
+    old = bucket->count[s];
+    i = find_ovf( ka, bucket->key[s] );
+    ka->ovf_key[i]   = bucket->key[s];
+    ka->ovf_count[i] = old + n;
+    ka->n_ovf++;
+    bucket->count[s] = KA_PROMOTED;
+  }
+  if ( ka->hist != NULL ) {
+    hist_move( ka->hist, old, old + n );
+  }
+}
+
+uint64_t kmer_array_count( const KA* ka, const KA_Bucket* bucket,
+			   unsigned int s ) {
+  if ( bucket->count[s] == KA_PROMOTED ) {
+    return ka->ovf_count[find_ovf( ka, bucket->key[s] )];
+  }
+  return bucket->count[s];
+}
+
+size_t KA_bytes( const KA* ka ) {
+  return sizeof(KA) +
+    sizeof(KA_Bucket) * (ka->n_buckets + ka->old_n_buckets) +
+    2 * sizeof(uint64_t) * ka->ovf_size;
+}
+
+size_t KHA_bytes( const KHA* kha ) {
   size_t i;
-  unsigned int array_size;
+  size_t bytes = 0;
+  for( i = 0; i <= kha->kaa_size; i++ ) {
+    if ( kha->kaa[i] != NULL ) {
+      bytes += KA_bytes( kha->kaa[i] );
+    }
+  }
+  return bytes;
+}
+
+KA* init_kmer_array( const unsigned int k, Dup_Hist* hist ) {
   KA* ka;
   ka = (KA*)malloc(sizeof( KA ));
-  ka->k = k;
-  array_size = 1 << (4*k);
-  ka->k_array = (short unsigned int*)malloc(sizeof(short unsigned int)
-					   * array_size);
-  for( i = 0; i < array_size; i++ ) {
-    ka->k_array[i] = 0;
-  }
+  ka->k             = k;
+  ka->n_buckets     = KA_INIT_BUCKETS;
+  ka->n_keys        = 0;
+  ka->buckets       = alloc_buckets( ka->n_buckets );
+  ka->old           = NULL;
+  ka->old_n_buckets = 0;
+  ka->migrated      = 0;
+  ka->ovf_size      = 0;
+  ka->n_ovf         = 0;
+  ka->ovf_key       = NULL;
+  ka->ovf_count     = NULL;
+  ka->hist          = hist;
   return ka;
 }
 
+void inc_kmer_array( KA* ka, uint64_t key ) {
+  add_kmer_array( ka, key, 1 );
+}
+
+/* find_key
+   Looks for key in the new table of ka, then in the old one.
+   Returns: the bucket with key in slot *s, or NULL if it is not
+   there, with *bucket and *s the empty slot of the new table
+   where it would go
+*/
+static inline KA_Bucket* find_key( KA* ka, uint64_t key,
+				   KA_Bucket** bucket, unsigned int* s ) {
+  KA_Bucket* old_bucket;
+  unsigned int old_s;
+  *bucket = find_slot( ka->buckets, ka->n_buckets, key, s );
+  if ( (*bucket)->count[*s] ) {
+    return *bucket;
+  }
+  if ( ka->old != NULL ) {
+    /* Not moved yet? Its count goes along when it is */
+    old_bucket = find_slot( ka->old, ka->old_n_buckets, key, &old_s );
+    if ( old_bucket->count[old_s] ) {
+      *s = old_s;
+      return old_bucket;
+    }
+  }
+  return NULL;
+}
+
+int bump_kmer_array( KA* ka, uint64_t key, uint64_t n ) {
+  KA_Bucket* bucket;
+  KA_Bucket* found;
+  unsigned int s;
+  if ( ka->old != NULL ) {
+    migrate_buckets( ka, KA_MIGRATE_STEP );
+  }
+  found = find_key( ka, key, &bucket, &s );
+  if ( found == NULL ) {
+    return 0;
+  }
+  bump_count( ka, found, s, n );
+  return 1;
+}
+
+void add_kmer_array( KA* ka, uint64_t key, uint64_t n ) {
+  KA_Bucket* bucket;
+  KA_Bucket* found;
+  unsigned int s;
+  if ( ka->old != NULL ) {
+    migrate_buckets( ka, KA_MIGRATE_STEP );
+  }
+  found = find_key( ka, key, &bucket, &s );
+  if ( found != NULL ) {
+    bump_count( ka, found, s, n );
+    return;
+  }
+  bucket->key[s]   = key;
+  bucket->count[s] = 0;
+  bump_count( ka, bucket, s, n );
+  ka->n_keys++;
+
+  if ( ka->n_keys > KA_MAX_LOAD * KA_BUCKET_SLOTS * ka->n_buckets ) {
+    finish_kmer_array( ka );
+    ka->old           = ka->buckets;
+    ka->old_n_buckets = ka->n_buckets;
+    ka->migrated      = 0;
+    ka->n_buckets    *= 2;
+    ka->buckets       = alloc_buckets( ka->n_buckets );
+    ka->n_keys        = 0;
+  }
+}
+
+/* entry_cmp
+   qsort comparison of KA_Entry by key
+*/
+static int entry_cmp( const void* a, const void* b ) {
+  uint64_t ka = ((const KA_Entry*)a)->key;
+  uint64_t kb = ((const KA_Entry*)b)->key;
+  return ( ka < kb ) ? -1 : ( ka > kb );
+}
+
+KA_Entry* sorted_kmer_array( KA* ka, size_t* n ) {
+  KA_Entry* entries;
+  size_t b;
+  unsigned int s;
+  finish_kmer_array( ka );
+  entries = (KA_Entry*)malloc(sizeof(KA_Entry) * (ka->n_keys + 1));
+  *n = 0;
+  for( b = 0; b < ka->n_buckets; b++ ) {
+    for( s = 0; s < KA_BUCKET_SLOTS; s++ ) {
+      if ( ka->buckets[b].count[s] ) {
+	entries[*n].key   = ka->buckets[b].key[s];
+	entries[*n].count = kmer_array_count( ka, &ka->buckets[b], s );
+	(*n)++;
+      }
+    }
+  }
+  qsort( entries, *n, sizeof(KA_Entry), entry_cmp );
+  return entries;
+}
+
+void finish_kmer_array( KA* ka ) {
+  if ( ka->old != NULL ) {
+    migrate_buckets( ka, ka->old_n_buckets );
+  }
+}
+
+void free_kmer_array( KA* ka ) {
+  free( ka->buckets );
+  free( ka->old );
+  free( ka->ovf_key );
+  free( ka->ovf_count );
+  free( ka );
+}
+
+Count_Bloom* init_count_bloom( size_t bytes ) {
+  Count_Bloom* cb;
+  cb = (Count_Bloom*)malloc(sizeof(Count_Bloom));
+  cb->n_blocks = 1;
+  while( cb->n_blocks * 2 * 64 <= bytes ) {
+    cb->n_blocks *= 2;
+  }
+  /* Every add is a random access, so huge pages save a TLB miss
+     on most of them */
+  bytes = ( cb->n_blocks * 64 < CB_PAGE ) ? CB_PAGE : cb->n_blocks * 64;
+  cb->cells = (uint8_t*)aligned_alloc( CB_PAGE, bytes );
+  if ( cb->cells == NULL ) {
+    fprintf( stderr, "Out of memory for a %lu byte Bloom filter\n",
+	     cb->n_blocks * 64 );
+    exit( 1 );
+  }
+  madvise( cb->cells, cb->n_blocks * 64, MADV_HUGEPAGE );
+  memset( cb->cells, 0, cb->n_blocks * 64 );
+  return cb;
+}
+
+/* bloom_counter
+   Returns counter j of a Count_Bloom block
+*/
+static inline unsigned int bloom_counter( const uint8_t* block,
+					  unsigned int j ) {
+  return (block[j >> 1] >> (4 * (j & 1))) & 15;
+}
+
+unsigned int add_count_bloom( Count_Bloom* cb, uint64_t key ) {
+  uint64_t h;
+  uint8_t* block;
+  unsigned int slot[CB_HASHES];
+  unsigned int i, low = CB_MAX;
+  h = mix_key( key );
+  block = &cb->cells[(h & (cb->n_blocks - 1)) * 64];
+  /* The top bits pick the counters in the block, 7 bits each,
+     away from the low bits that picked the block */
+  for( i = 0; i < CB_HASHES; i++ ) {
+    slot[i] = (h >> (57 - 7 * i)) & 127;
+    if ( bloom_counter( block, slot[i] ) < low ) {
+      low = bloom_counter( block, slot[i] );
+    }
+  }
+  if ( low == CB_MAX ) {
+    return CB_MAX;
+  }
+  low++;
+  for( i = 0; i < CB_HASHES; i++ ) {
+    if ( bloom_counter( block, slot[i] ) < low ) {
+      block[slot[i] >> 1] &= ~(15 << (4 * (slot[i] & 1)));
+      block[slot[i] >> 1] |= low << (4 * (slot[i] & 1));
+    }
+  }
+  return low;
+}
+
+void free_count_bloom( Count_Bloom* cb ) {
+  free( cb->cells );
+  free( cb );
+}
+
 KHA* init_KHA( const unsigned int k ) {
   size_t i;
   KHA* kha;
+  if ( (k < 1) || (k > MAX_KHA_K) ) {
+    return NULL;
+  }
   kha            = (KHA*)malloc(sizeof(KHA));
   kha->k         = k;
   kha->kaa_size  = MAX_SEQ_LEN;
   kha->n_entries = 0;
+  memset( &kha->hist, 0, sizeof(Dup_Hist) );
   kha->kaa = (KA**)malloc(sizeof(KA*) * (MAX_SEQ_LEN+1));
   for( i = 0; i <= MAX_SEQ_LEN; i++ ) {
     kha->kaa[i] = NULL;
@@ -94,41 +622,67 @@ KHA* init_KHA( const unsigned int k ) {
 }
 			  
 
-/* 
- */
-void output_kmer_table( KHA* kha ) {
+void merge_KHA( KHA* total, KHA* part ) {
   size_t len_i;
-  size_t kmer_i;
-  unsigned int i;
-  unsigned int t_uniq = 0; // total number of uniq seq
-  unsigned int array_size;
-  unsigned int count[MAX_SEQ_COUNT + 1];
-  /* Zero out the count array that will be printed */
-  for( i = 0; i <= MAX_SEQ_COUNT; i++ ) {
-    count[i] = 0;
-  }
-  
-  array_size = 1 << (4*kha->k);
-  for( len_i = 0; len_i <= kha->kaa_size; len_i++ ) {
-    /* Go through each kaa */
-    if ( kha->kaa[len_i] != NULL ) {
-      for( kmer_i = 0; kmer_i < array_size; kmer_i++ ) {
-	if ( kha->kaa[len_i]->k_array[kmer_i] > MAX_SEQ_COUNT ) {
-	  count[MAX_SEQ_COUNT]++;
-	}
-	else {
-	  count[kha->kaa[len_i]->k_array[kmer_i]]++;
+  size_t b;
+  unsigned int s;
+  KA* ka;
+  for( len_i = 0; len_i <= part->kaa_size; len_i++ ) {
+    ka = part->kaa[len_i];
+    if ( ka == NULL ) {
+      continue;
+    }
+    if ( total->kaa[len_i] == NULL ) {
+      total->kaa[len_i] = init_kmer_array( total->k, &total->hist );
+    }
+    finish_kmer_array( ka );
+    for( b = 0; b < ka->n_buckets; b++ ) {
+      for( s = 0; s < KA_BUCKET_SLOTS; s++ ) {
+	if ( ka->buckets[b].count[s] ) {
+	  add_kmer_array( total->kaa[len_i], ka->buckets[b].key[s],
+			  kmer_array_count( ka, &ka->buckets[b], s ) );
 	}
       }
     }
   }
-  for( i = 1; i <= MAX_SEQ_COUNT; i++ ) {
-    t_uniq += count[i];
+  total->n_entries += part->n_entries;
+}
+
+void free_KHA( KHA* kha ) {
+  size_t i;
+  for( i = 0; i <= kha->kaa_size; i++ ) {
+    if ( kha->kaa[i] != NULL ) {
+      free_kmer_array( kha->kaa[i] );
+    }
   }
-  printf( "# Total unique sequences: %u\n", t_uniq );
+  free( kha->kaa );
+  free( kha );
+}
+
+uint64_t kmer_table_hist( KHA* kha, uint64_t* count,
+			  uint64_t* tail_seqs ) {
+  memcpy( count, kha->hist.count, sizeof(uint64_t) * (MAX_SEQ_COUNT + 1) );
+  *tail_seqs = kha->hist.tail_seqs;
+  return kha->hist.n_uniq;
+}
+
+/* 
+ */
+void output_kmer_table( KHA* kha ) {
+  unsigned int i;
+  uint64_t t_uniq; // total number of uniq seq
+  uint64_t tail_seqs; // seqs in those seen MAX_SEQ_COUNT+ times
+  uint64_t count[MAX_SEQ_COUNT + 1];
+
+  t_uniq = kmer_table_hist( kha, count, &tail_seqs );
+  printf( "# Total unique sequences: %lu\n", t_uniq );
   
-  for( i = 1; i <= MAX_SEQ_COUNT; i++ ) {
-    printf( "%u\t%u\t%.5f\n", i, count[i],
+  /* The last line is everything seen MAX_SEQ_COUNT or more
+     times, so its fraction is from their real counts */
+  for( i = 1; i < MAX_SEQ_COUNT; i++ ) {
+    printf( "%u\t%lu\t%.5f\n", i, count[i],
 	    ((double)i*(double)count[i])/(double)kha->n_entries );
   }
+  printf( "%u\t%lu\t%.5f\n", i, count[i],
+	  (double)tail_seqs/(double)kha->n_entries );
 }
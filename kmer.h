@@ -4,20 +4,103 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include "fastq-io.h"
 #define MAX_SEQ_COUNT (256)
 #define MAX_SEQ_LEN (511)
+#define MAX_KMER_LEN (32)
+#define MAX_KHA_K (16)
+#define KMER_BAD_BASE (4)
+#define KA_BUCKET_SLOTS (7)
+#define KA_PROMOTED (255)
+#define KA_INIT_BUCKETS (16)
+#define KA_INIT_OVERFLOW (64)
+#define KA_MAX_LOAD (0.75)
+#define KA_MIGRATE_STEP (2)
+#define CB_HASHES (4)      // counters per key in a Count_Bloom
+#define CB_MAX (15)        // counters are 4 bits
+#define CB_PAGE (1 << 21)  // huge page size the filter is aligned to
+#define PAIR_MIN_OVERLAP (10)   // shortest read pair overlap believed
+#define PAIR_MISMATCH_RATE (10) // at most 1 mismatch per this many bases
 
-/* KA is the array that will keep counts of each k-mer of length k.
-   The array is indexed by converting the kmer to a number using
-   the formula A=00, C=01, G=10, T=11. The kmer is converted to
-   a bitstring. That bitstring is interpreted as an unsigned int.
+/* base_code maps a character to its 2-bit code using the
+   formula A=00, C=01, G=10, T=11 (either case). Anything else
+   maps to KMER_BAD_BASE.
  */
+extern const unsigned char base_code[256];
+
+/* KA keeps counts of each pair of start and end k-mers seen for
+   one length. Each k-mer is converted to a number using the
+   formula A=00, C=01, G=10, T=11; the key is the start k-mer
+   followed by the end k-mer, 4*k bits, so k is at most MAX_KHA_K.
+   Only keys that have been seen take memory: it is an open
+   addressing hash table of 64-byte buckets (one cache line) of
+   KA_BUCKET_SLOTS keys and 8-bit counts each; a count of 0 means
+   an empty slot. Collisions go on to the next bucket.
+   Most keys are seen only a few times, so counts are 8 bits.
+   A key seen more than KA_PROMOTED - 1 times is promoted: its
+   count in the bucket becomes KA_PROMOTED and its real count is
+   kept, 64 bits wide, in a small table on the side (ovf_key,
+   ovf_count; also open addressing, grown when half full).
+   When the table is more than KA_MAX_LOAD full, a table twice
+   the size is made and each insert moves KA_MIGRATE_STEP buckets
+   of the old one into it, so no single insert pays for copying
+   the whole table. Until then a key is looked for in the new
+   table and then in the old one.
+ */
+/* Dup_Hist is the duplication histogram of a KHA: count[i] is how
+   many keys have been seen i times, count[MAX_SEQ_COUNT] how many
+   MAX_SEQ_COUNT or more times, and tail_seqs the total count of
+   those. It is kept up to date as counts go up, moving a key from
+   one entry to the next, so it never has to be made by going
+   through the tables.
+ */
+typedef struct dup_hist {
+  uint64_t count[MAX_SEQ_COUNT + 1];
+  uint64_t tail_seqs;
+  uint64_t n_uniq; // keys seen at all
+} Dup_Hist;
+
+typedef struct kmer_bucket {
+  uint64_t key[KA_BUCKET_SLOTS];
+  uint8_t count[KA_BUCKET_SLOTS];
+} __attribute__((aligned(64))) KA_Bucket;
+
 typedef struct kmer_array {
   unsigned int k;
-  short unsigned int* k_array;
+  size_t n_buckets; // number of buckets; a power of 2
+  size_t n_keys; // keys in buckets
+  KA_Bucket* buckets;
+  KA_Bucket* old; // table being moved into buckets, or NULL
+  size_t old_n_buckets;
+  size_t migrated; // old buckets before this have been moved
+  size_t ovf_size; // slots in ovf_key and ovf_count; a power of 2
+  size_t n_ovf; // promoted keys
+  uint64_t* ovf_key;
+  uint64_t* ovf_count; // 0 => empty slot
+  Dup_Hist* hist; // of the KHA this is in; NULL => none kept
 } KA;
 
+/* Count_Bloom is a counting Bloom filter: it gives an upper
+   bound on how many times a key has been added, in 4 bits per
+   counter, however many keys there are. It is blocked: the
+   CB_HASHES counters of a key are all in one 64-byte block (128
+   counters), so an add touches one cache line. Adds are
+   conservative: only the counters that are at the lowest of the
+   key's are raised, which keeps the bound tighter. Counts stop
+   at CB_MAX.
+ */
+typedef struct count_bloom {
+  size_t n_blocks; // a power of 2
+  uint8_t* cells; // 2 counters per byte
+} Count_Bloom;
+
+/* KA_Entry is a key and its count, as taken out of a KA */
+typedef struct ka_entry {
+  uint64_t key;
+  uint64_t count;
+} KA_Entry;
+
 /* KHA is an array with pointers so KA
    This array can be indexed by the length of the sequence or
    any arbitrary thing.
@@ -25,10 +108,23 @@ typedef struct kmer_array {
 typedef struct kmer_array_array {
   unsigned int k;
   unsigned int kaa_size; // length of KA** kaa
-  unsigned int n_entries; // how many seqs in KA** kaa
+  uint64_t n_entries; // how many seqs in KA** kaa
   KA** kaa;
+  Dup_Hist hist; // of every KA in kaa
 } KHA;
 
+/* mix_key
+   murmur3 64-bit finalizer; spreads the key bits over the hash
+*/
+static inline uint64_t mix_key( uint64_t key ) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return key;
+}
+
 /* Takes the sequence, k-mer length, and the index to compute
    Converts the first k bases of the seq to bitstring/unsigned int
    using the formula A=00, C=01, G=10, T=11.
@@ -36,20 +132,269 @@ typedef struct kmer_array_array {
    Returns 0 if there is a non ACGT character or sequence is
    less than k in length
  */
-int seq2inx( char* seq, unsigned int k, unsigned int* inx );
+int seq2inx( const char* seq, unsigned int k, unsigned int* inx );
+
+/* Same as seq2inx, for the k bases at start in the packed
+   sequence of fq (fq->pack must be set). Returns 1 if copacetic,
+   0 if there is a non ACGT character.
+ */
+int packed_seq2inx( const FQ_Rec* fq, size_t start, unsigned int k,
+		    unsigned int* inx );
+
+/* Same as seq2inx, but the index is a uint64_t so k can be up
+   to MAX_KMER_LEN. Returns 1 if copacetic, 0 if there is a non
+   ACGT character.
+ */
+int seq2kmer( const char* seq, unsigned int k, uint64_t* kmer );
+
+/* Kmer_Iter walks over every k-mer of a sequence, one base at a
+   time: each step shifts the new base onto the forward k-mer and
+   its complement onto the front of the reverse complement, so
+   the cost per base does not depend on k. A non-ACGT base resets
+   the iterator; the next k-mer starts after it.
+   Use:
+     init_kmer_iter( &it, seq, len, k );
+     while( next_kmer( &it ) ) {
+       ... it.pos, it.fwd, it.rev, canonical_kmer( &it ) ...
+     }
+ */
+typedef struct kmer_iter {
+  const char* seq; // the bases, or NULL if packed
+  const uint64_t* pack; // packed codes; see seq-pack.h
+  const uint64_t* nmask; // packed N-mask
+  size_t len; // length of the sequence
+  size_t next; // next base to look at
+  size_t pos; // where the current k-mer starts
+  unsigned int k;
+  unsigned int filled; // good bases since the last reset
+  uint64_t mask; // the low 2*k bits
+  uint64_t fwd; // current k-mer
+  uint64_t rev; // its reverse complement
+} Kmer_Iter;
 
-/* Takes the KHA* and FQ* seq
+/* init_kmer_iter
+   Args: Kmer_Iter* it - gets set up
+         const char* seq - the bases; need not be NUL-terminated
+         size_t len - how many
+         unsigned int k - k-mer length; 1 to MAX_KMER_LEN
+ */
+void init_kmer_iter( Kmer_Iter* it, const char* seq, size_t len,
+		     unsigned int k );
+
+/* init_kmer_iter_rec
+   Same as init_kmer_iter for the sequence of fq, using
+   fq->pack if the record was packed
+ */
+void init_kmer_iter_rec( Kmer_Iter* it, const FQ_Rec* fq, unsigned int k );
+
+/* next_kmer
+   Moves it to the next k-mer with no non-ACGT base.
+   Returns: 1 => it->pos, it->fwd, and it->rev are set to it;
+            0 => no more k-mers
+ */
+static inline int next_kmer( Kmer_Iter* it ) {
+  unsigned int c;
+  while( it->next < it->len ) {
+    if ( it->seq != NULL ) {
+      c = base_code[(unsigned char)it->seq[it->next]];
+    }
+    else {
+      c = packed_n( it->nmask, it->next ) ? KMER_BAD_BASE :
+	packed_base( it->pack, it->next );
+    }
+    it->next++;
+    if ( c == KMER_BAD_BASE ) {
+      it->filled = 0;
+      continue;
+    }
+    it->fwd = ((it->fwd << 2) | c) & it->mask;
+    it->rev = (it->rev >> 2) | ((uint64_t)(3 - c) << (2 * (it->k - 1)));
+    if ( it->filled < it->k ) {
+      it->filled++;
+    }
+    if ( it->filled == it->k ) {
+      it->pos = it->next - it->k;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* canonical_kmer
+   Returns the lesser of the current k-mer and its reverse
+   complement, so a k-mer and its reverse complement count as one
+ */
+static inline uint64_t canonical_kmer( const Kmer_Iter* it ) {
+  return ( it->fwd < it->rev ) ? it->fwd : it->rev;
+}
+
+/* revcomp_kmer
+   Returns the reverse complement of the k-mer kmer
+ */
+uint64_t revcomp_kmer( uint64_t kmer, unsigned int k );
+
+/* Takes the KHA* and FQ_Rec* seq
    Increments the correct length and k-mer for this sequence
    given the k value of KHA*. Uses the beginning and ending
-   kmer */
-int add_seq_to_KHA( KHA* kha, FQ* fq );
+   kmer. Returns 0 if the sequence is shorter than k, longer
+   than the KHA can index, or has a non-ACGT start or end kmer.
+   Uses fq->pack if the record was packed. */
+int add_seq_to_KHA( KHA* kha, const FQ_Rec* fq );
+
+/* Takes the kmer length k of a KHA made by init_KHA and FQ_Rec* seq
+   Returns 1 if add_seq_to_KHA would count the sequence, 0 if not,
+   without counting it. */
+int KHA_takes_seq( unsigned int k, const FQ_Rec* fq );
+
+/* Takes the KHA* and the two FQ_Rec* of a read pair
+   Increments the count of the pair of start kmers of read 1 and
+   read 2, for the insert length, so pairs are the same if they
+   start in the same places (and are the same length). If the
+   insert length is not known, pass 0; inserts longer than the
+   KHA can index share its last length. Returns 0 if either read
+   is shorter than k or has a non-ACGT start kmer. */
+int add_pair_to_KHA( KHA* kha, const FQ_Rec* fq1, const FQ_Rec* fq2,
+		     size_t insert_len );
 
-/* Initializes the KHA, returns pointer to it */
+/* pair_insert_len
+   Finds the insert length of a read pair from where read 2,
+   reverse complemented, overlaps the end of read 1: the
+   reverse complement of the last k-mer of read 2 is looked for in
+   read 1, and each hit is checked base by base over the whole
+   overlap, which must be PAIR_MIN_OVERLAP or more bases with at
+   most 1 mismatch per PAIR_MISMATCH_RATE bases.
+   Returns: the insert length of the longest such overlap, or 0
+   if the reads do not overlap (or the insert is shorter than
+   read 2, so it starts with adapter)
+*/
+size_t pair_insert_len( const FQ_Rec* fq1, const FQ_Rec* fq2,
+			unsigned int k );
+
+/* Takes the KHA*, the length of a sequence, and a hash of the
+   whole sequence (see read-hash.h), and increments the count of
+   that hash for that length, so sequences are only the same if
+   all their bases are. Sequences longer than the KHA can index
+   share its last length. Returns 0 if len is 0, else 1.
+   The k of the KHA does not matter. */
+int add_hash_to_KHA( KHA* kha, size_t len, uint64_t hash );
+
+/* KHA_bytes
+   Returns how many bytes the kmer arrays of kha take up
+*/
+size_t KHA_bytes( const KHA* kha );
+
+/* KA_bytes
+   Returns how many bytes ka and its tables take up
+*/
+size_t KA_bytes( const KA* ka );
+
+/* Initializes the KHA, returns pointer to it, or NULL if k is
+   not 1 to MAX_KHA_K */
 KHA* init_KHA( const unsigned int k );
 /* init_kmer_array 
-   Returns pointer for kmer array of size 2*k
+   Returns pointer to an empty kmer array for k-mers of length k
+   that keeps hist up to date, if it is not NULL
+*/
+KA* init_kmer_array( const unsigned int k, Dup_Hist* hist );
+
+/* inc_kmer_array
+   Adds one to the count of key in ka
+*/
+void inc_kmer_array( KA* ka, uint64_t key );
+
+/* add_kmer_array
+   Adds n to the count of key in ka
+*/
+void add_kmer_array( KA* ka, uint64_t key, uint64_t n );
+
+/* prefetch_kmer_array
+   Starts loading the home bucket of key in ka
+*/
+static inline void prefetch_kmer_array( const KA* ka, uint64_t key ) {
+  __builtin_prefetch( &ka->buckets[mix_key( key ) & (ka->n_buckets - 1)],
+		      1 );
+}
+
+/* bump_kmer_array
+   Adds n to the count of key in ka if it is there.
+   Returns: 1 if it was, 0 if not (and nothing is added)
+*/
+int bump_kmer_array( KA* ka, uint64_t key, uint64_t n );
+
+/* kmer_array_count
+   Returns the count of the key in bucket slot s of ka
+*/
+uint64_t kmer_array_count( const KA* ka, const KA_Bucket* bucket,
+			   unsigned int s );
+
+/* sorted_kmer_array
+   Returns every key of ka and its count, sorted by key, in an
+   array the caller frees; *n gets how many
+*/
+KA_Entry* sorted_kmer_array( KA* ka, size_t* n );
+
+/* finish_kmer_array
+   Moves whatever is left of the old table of ka, if any, so
+   every key and count is in ka->buckets
+*/
+void finish_kmer_array( KA* ka );
+
+/* free_kmer_array
+   Frees ka and its tables
+*/
+void free_kmer_array( KA* ka );
+
+/* init_count_bloom
+   Returns an empty Count_Bloom of at most bytes bytes (at least
+   one block)
+*/
+Count_Bloom* init_count_bloom( size_t bytes );
+
+/* add_count_bloom
+   Adds key to cb.
+   Returns: the bound on how many times key has been added, this
+   time included; 1 the first time, unless another key shares
+   all its counters
+*/
+unsigned int add_count_bloom( Count_Bloom* cb, uint64_t key );
+
+/* prefetch_count_bloom
+   Starts loading the block of key in cb, so adding a batch of
+   keys can overlap the cache misses
+*/
+static inline void prefetch_count_bloom( const Count_Bloom* cb,
+					 uint64_t key ) {
+  __builtin_prefetch( &cb->cells[(mix_key( key ) & (cb->n_blocks - 1)) * 64],
+		      1 );
+}
+
+void free_count_bloom( Count_Bloom* cb );
+
+/* merge_KHA
+   Adds the counts and entries of part, which must have the same
+   k, to total. Counts are summed key by key, so the result is
+   the same however the sequences were split between the two.
+*/
+void merge_KHA( KHA* total, KHA* part );
+
+/* free_KHA
+   Frees kha and all its kmer arrays
+*/
+void free_KHA( KHA* kha );
+
+/* kmer_table_hist
+   Args: KHA* kha - the counts
+         uint64_t* count - MAX_SEQ_COUNT + 1 entries; count[i] gets
+                           how many sequences were seen i times;
+                           count[MAX_SEQ_COUNT] is those seen
+                           MAX_SEQ_COUNT or more times
+         uint64_t* tail_seqs - gets the total count of those
+   Returns: the number of unique sequences
+   This is a copy of kha->hist, so it is cheap enough to call as
+   often as wanted while counting.
 */
-KA* init_kmer_array( const unsigned int k );
+uint64_t kmer_table_hist( KHA* kha, uint64_t* count,
+			  uint64_t* tail_seqs );
 
 /* 
  */
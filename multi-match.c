@@ -0,0 +1,127 @@
+#include "multi-match.h"
+
+Multi_Match* init_multi_match( const char** pats, size_t n_pats ) {
+  Multi_Match* mm;
+  size_t max_states = 1;
+  size_t p, i, head, tail;
+  int32_t* queue;
+  int32_t* fail;
+  int32_t s, t, f;
+  unsigned int c;
+
+  for( p = 0; p < n_pats; p++ ) {
+    max_states += strlen( pats[p] );
+  }
+  mm = (Multi_Match*)malloc(sizeof(Multi_Match));
+  mm->n_pats   = n_pats;
+  mm->lens     = (size_t*)malloc(sizeof(size_t) * (n_pats + 1));
+  mm->n_states = 1;
+  mm->go       = (int32_t*)malloc(sizeof(int32_t) * max_states * MM_ALPHA);
+  mm->out      = (int32_t*)malloc(sizeof(int32_t) * max_states);
+  mm->dict     = (int32_t*)malloc(sizeof(int32_t) * max_states);
+  for( c = 0; c < MM_ALPHA; c++ ) {
+    mm->go[c] = -1;
+  }
+  mm->out[0]  = -1;
+  mm->dict[0] = -1;
+
+  /* Build the trie; -1 is no transition yet */
+  for( p = 0; p < n_pats; p++ ) {
+    mm->lens[p] = strlen( pats[p] );
+    if ( mm->lens[p] == 0 ) {
+      fprintf( stderr, "Empty pattern\n" );
+      free_multi_match( mm );
+      return NULL;
+    }
+    s = 0;
+    for( i = 0; i < mm->lens[p]; i++ ) {
+      c = base_code[(unsigned char)pats[p][i]];
+      if ( c == KMER_BAD_BASE ) {
+	fprintf( stderr, "Pattern %s is not all A, C, G, or T\n", pats[p] );
+	free_multi_match( mm );
+	return NULL;
+      }
+      if ( mm->go[s * MM_ALPHA + c] < 0 ) {
+	t = mm->n_states++;
+	memset( &mm->go[t * MM_ALPHA], 0xff, sizeof(int32_t) * MM_ALPHA );
+	mm->out[t]  = -1;
+	mm->dict[t] = -1;
+	mm->go[s * MM_ALPHA + c] = t;
+      }
+      s = mm->go[s * MM_ALPHA + c];
+    }
+    if ( mm->out[s] >= 0 ) {
+      fprintf( stderr, "Pattern %s is given twice\n", pats[p] );
+      free_multi_match( mm );
+      return NULL;
+    }
+    mm->out[s] = (int32_t)p;
+  }
+
+  /* Breadth first, so the failure state of every state is done
+     before it is needed: a missing transition goes where the
+     failure state's does */
+  queue = (int32_t*)malloc(sizeof(int32_t) * mm->n_states);
+  fail  = (int32_t*)malloc(sizeof(int32_t) * mm->n_states);
+  head = tail = 0;
+  for( c = 0; c < MM_ALPHA; c++ ) {
+    t = mm->go[c];
+    if ( t < 0 ) {
+      mm->go[c] = 0;
+    }
+    else {
+      fail[t] = 0;
+      queue[tail++] = t;
+    }
+  }
+  while( head < tail ) {
+    s = queue[head++];
+    f = fail[s];
+    mm->dict[s] = ( mm->out[f] >= 0 ) ? f : mm->dict[f];
+    for( c = 0; c < MM_ALPHA; c++ ) {
+      t = mm->go[s * MM_ALPHA + c];
+      if ( t < 0 ) {
+	mm->go[s * MM_ALPHA + c] = mm->go[f * MM_ALPHA + c];
+      }
+      else {
+	fail[t] = mm->go[f * MM_ALPHA + c];
+	queue[tail++] = t;
+      }
+    }
+  }
+  free( queue );
+  free( fail );
+  return mm;
+}
+
+void free_multi_match( Multi_Match* mm ) {
+  free( mm->lens );
+  free( mm->go );
+  free( mm->out );
+  free( mm->dict );
+  free( mm );
+}
+
+/* Matches of the same pattern are found in order of where they
+   end, which is also the order of where they start, so the first
+   one found is the leftmost */
+size_t first_multi_match( const Multi_Match* mm, const char* seq,
+			  size_t len, long* first ) {
+  size_t i, n_found = 0;
+  int32_t s = 0, t;
+
+  for( i = 0; i < mm->n_pats; i++ ) {
+    first[i] = -1;
+  }
+  for( i = 0; i < len; i++ ) {
+    s = mm->go[s * MM_ALPHA + base_code[(unsigned char)seq[i]]];
+    for( t = ( mm->out[s] >= 0 ) ? s : mm->dict[s]; t >= 0;
+	 t = mm->dict[t] ) {
+      if ( first[mm->out[t]] < 0 ) {
+	first[mm->out[t]] = i + 1 - mm->lens[mm->out[t]];
+	n_found++;
+      }
+    }
+  }
+  return n_found;
+}
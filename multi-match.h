@@ -0,0 +1,55 @@
+#ifndef MULTI_MATCH
+#define MULTI_MATCH
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "kmer.h"
+#define MM_ALPHA (5) // A, C, G, T, and anything else (KMER_BAD_BASE)
+
+/* Multi_Match finds any of a set of patterns in a sequence in
+   one pass, however many patterns there are (Aho & Corasick,
+   1975). The patterns are put in a trie; each state of the trie
+   is the longest pattern prefix that the sequence read so far
+   ends with. Every state has a transition for every base, made
+   ahead of time by following the failure links while the trie
+   is built, so scanning a sequence is one table lookup a base.
+   A state that is the end of a pattern has out set; dict links
+   each state to the next shorter suffix of it that ends a
+   pattern, so all the patterns ending at a base are found by
+   following dict. Patterns are A, C, G, and T only, in either
+   case; anything else in the sequence matches nothing.
+ */
+typedef struct multi_match {
+  size_t n_pats;
+  size_t* lens; // of each pattern
+  size_t n_states; // state 0 is the root
+  int32_t* go; // n_states * MM_ALPHA transitions
+  int32_t* out; // pattern ending here, or -1
+  int32_t* dict; // next state on the failure path with out set, or -1
+} Multi_Match;
+
+/* init_multi_match
+   Args: const char** pats - the patterns
+         size_t n_pats - how many
+   Returns: the automaton, or NULL (with a message on stderr) if a
+   pattern is empty, has anything but A, C, G, or T in it, or is
+   the same as one before it
+*/
+Multi_Match* init_multi_match( const char** pats, size_t n_pats );
+
+void free_multi_match( Multi_Match* mm );
+
+/* first_multi_match
+   Args: const Multi_Match* mm - the patterns
+         const char* seq - sequence to look in
+         size_t len - its length
+         long* first - gets, for each pattern, where its first
+                       (leftmost) occurrence in seq starts, or -1
+   Returns: how many of the patterns are in seq
+*/
+size_t first_multi_match( const Multi_Match* mm, const char* seq,
+			  size_t len, long* first );
+
+#endif
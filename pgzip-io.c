@@ -0,0 +1,504 @@
+#include "pgzip-io.h"
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+/* is_bgzf
+   Args: const unsigned char* head - the first bytes of a file
+         size_t len - how many bytes are in head
+   Returns: true IFF head is a gzip header with the BC extra
+            subfield that marks a BGZF block
+*/
+int is_bgzf( const unsigned char* head, size_t len ) {
+  if ( len < 18 ) {
+    return 0;
+  }
+  return ( (head[0] == 0x1f) && (head[1] == 0x8b) &&
+	   (head[2] == 8) && (head[3] & 4) &&
+	   (head[12] == 'B') && (head[13] == 'C') &&
+	   (head[14] == 2) && (head[15] == 0) );
+}
+
+/* default_pgz_threads
+   Returns the number of online processors, kept between
+   1 and PGZ_MAX_THREADS
+*/
+int default_pgz_threads( void ) {
+  long n;
+  n = sysconf( _SC_NPROCESSORS_ONLN );
+  if ( n < 1 ) {
+    n = 1;
+  }
+  if ( n > PGZ_MAX_THREADS ) {
+    n = PGZ_MAX_THREADS;
+  }
+  return (int)n;
+}
+
+/* pgz_raw_read
+   Reads up to len bytes of compressed input, first from pgz->head
+   and then from pgz->fd. If full is true, keeps reading until len
+   bytes are read or the input ends.
+   Returns: number of bytes read; 0 => EOF or error
+*/
+static size_t pgz_raw_read( PGZ_Src* pgz, unsigned char* buf, size_t len,
+			    int full ) {
+  size_t got = 0;
+  ssize_t n;
+  if ( pgz->head_pos < pgz->head_len ) {
+    got = pgz->head_len - pgz->head_pos;
+    if ( got > len ) {
+      got = len;
+    }
+    memcpy( buf, &pgz->head[pgz->head_pos], got );
+    pgz->head_pos += got;
+  }
+  while( (got < len) && (full || (got == 0)) ) {
+    n = read( pgz->fd, &buf[got], len - got );
+    if ( n <= 0 ) {
+      if ( n < 0 ) {
+	perror( pgz->fn );
+      }
+      break;
+    }
+    got += n;
+  }
+  return got;
+}
+
+/* start_gz_stream
+   Sets pgz up to stream the rest of its input through inflate,
+   starting with the len bytes at start that were already read
+   from it. Called before the workers start, or with pgz->lock
+   held by the worker that read those bytes.
+   Returns: 0 => copacetic; -1 => zlib could not be set up
+*/
+static int start_gz_stream( PGZ_Src* pgz, const unsigned char* start,
+			    size_t len ) {
+  memset( &pgz->gz_strm, 0, sizeof( z_stream ) );
+  if ( inflateInit2( &pgz->gz_strm, 15 + 32 ) != Z_OK ) { // gzip or zlib header
+    fprintf( stderr, "Cannot set up inflating %s\n", pgz->fn );
+    return -1;
+  }
+  pgz->gz_in = (unsigned char*)malloc( PGZ_IN_CHUNK );
+  if ( len > 0 ) {
+    memcpy( pgz->gz_in, start, len );
+  }
+  pgz->gz_strm.next_in  = pgz->gz_in;
+  pgz->gz_strm.avail_in = len;
+  /* Bytes after BGZF blocks may be a new member or trailing junk */
+  pgz->gz_member_done = ( len > 0 );
+  pgz->is_bgzf = 0;
+  return 0;
+}
+
+/* read_bgzf_blocks
+   Reads up to PGZ_JOB_BLOCKS whole BGZF blocks from pgz->fd into
+   job->cdata. Called with pgz->lock held so blocks are read in
+   file order. Sets pgz->eof when the end of the file is reached.
+   At the first gzip member that is not a BGZF block, the job ends
+   and what was read of the member goes to start_gz_stream, so the
+   rest of the file is streamed by later jobs.
+   Returns: 0 => copacetic; -1 => malformed or truncated block.
+   Either way the first job->n_blocks blocks are whole.
+*/
+static int read_bgzf_blocks( PGZ_Src* pgz, PGZ_Job* job ) {
+  unsigned char* block;
+  size_t got;
+  size_t xlen;
+  size_t slen;
+  size_t bsize;
+  size_t i;
+
+  job->c_len    = 0;
+  job->n_blocks = 0;
+  while( job->n_blocks < PGZ_JOB_BLOCKS ) {
+    block = &job->cdata[job->c_len];
+    got = pgz_raw_read( pgz, block, 12, 1 );
+    if ( got == 0 ) {
+      pgz->eof = 1;
+      return 0;
+    }
+    xlen = 0;
+    if ( (got == 12) &&
+	 (block[0] == 0x1f) && (block[1] == 0x8b) && (block[3] & 4) ) {
+      xlen = block[10] | (block[11] << 8);
+    }
+    /* A BGZF block has an extra field and room for it, the
+       trailer and some data in BGZF_MAX_BLOCK */
+    if ( (xlen == 0) || (xlen > BGZF_MAX_BLOCK - 12 - 8) ) {
+      return start_gz_stream( pgz, block, got );
+    }
+    if ( pgz_raw_read( pgz, &block[12], xlen, 1 ) != xlen ) {
+      fprintf( stderr, "%s: truncated BGZF block\n", pgz->fn );
+      return -1;
+    }
+    /* Find the BC subfield, which holds the block size - 1 */
+    bsize = 0;
+    i = 12;
+    while( i + 6 <= 12 + xlen ) {
+      slen = block[i+2] | (block[i+3] << 8);
+      if ( (block[i] == 'B') && (block[i+1] == 'C') && (slen == 2) ) {
+	bsize = (block[i+4] | (block[i+5] << 8)) + 1;
+	break;
+      }
+      i += 4 + slen;
+    }
+    if ( bsize == 0 ) {
+      return start_gz_stream( pgz, block, 12 + xlen );
+    }
+    if ( (bsize < 12 + xlen + 8) || (bsize > BGZF_MAX_BLOCK) ) {
+      fprintf( stderr, "%s: bad BGZF block size\n", pgz->fn );
+      return -1;
+    }
+    if ( pgz_raw_read( pgz, &block[12 + xlen], bsize - 12 - xlen, 1 )
+	 != bsize - 12 - xlen ) {
+      fprintf( stderr, "%s: truncated BGZF block\n", pgz->fn );
+      return -1;
+    }
+    job->block_offs[job->n_blocks] = job->c_len + 12 + xlen;
+    job->block_lens[job->n_blocks] = bsize - 12 - xlen - 8;
+    job->n_blocks++;
+    job->c_len += bsize;
+  }
+  return 0;
+}
+
+/* inflate_bgzf_job
+   Inflates each raw deflate block in job->cdata into job->data and
+   checks it against the CRC32 and length in the block's trailer.
+   strm is this worker's raw inflate stream.
+   Returns: 0 => copacetic; -1 => corrupt block, with job->len
+            the bytes inflated from the blocks before it
+*/
+static int inflate_bgzf_job( PGZ_Job* job, z_stream* strm, void* dd ) {
+  const unsigned char* cblock;
+  const unsigned char* trailer;
+  size_t i;
+  size_t out_len;
+  unsigned long crc;
+  unsigned long isize;
+
+  job->len = 0;
+  for( i = 0; i < job->n_blocks; i++ ) {
+    cblock  = &job->cdata[job->block_offs[i]];
+    trailer = cblock + job->block_lens[i];
+    crc   = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) |
+      ((unsigned long)trailer[3] << 24);
+    isize = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) |
+      ((unsigned long)trailer[7] << 24);
+    if ( isize > BGZF_MAX_BLOCK ) {
+      return -1;
+    }
+#ifdef HAVE_LIBDEFLATE
+    if ( libdeflate_deflate_decompress( (struct libdeflate_decompressor*)dd,
+					cblock, job->block_lens[i],
+					&job->data[job->len], BGZF_MAX_BLOCK,
+					&out_len ) != LIBDEFLATE_SUCCESS ) {
+      return -1;
+    }
+#else
+    inflateReset( strm );
+    strm->next_in   = (unsigned char*)cblock;
+    strm->avail_in  = job->block_lens[i];
+    strm->next_out  = (unsigned char*)&job->data[job->len];
+    strm->avail_out = BGZF_MAX_BLOCK;
+    if ( inflate( strm, Z_FINISH ) != Z_STREAM_END ) {
+      return -1;
+    }
+    out_len = BGZF_MAX_BLOCK - strm->avail_out;
+#endif
+    if ( (out_len != isize) ||
+	 (crc32( crc32( 0L, Z_NULL, 0 ),
+		 (unsigned char*)&job->data[job->len], out_len ) != crc) ) {
+      return -1;
+    }
+    job->len += out_len;
+  }
+  return 0;
+}
+
+/* inflate_gz_chunk
+   Streams plain gzip input through inflate until len bytes have
+   been put in out or the input ends. Concatenated gzip members are
+   read one after another; anything after the last member that is
+   not a gzip header is ignored, as gzread does.
+   Returns: number of bytes put in out; *status is set to 0, or to
+            -1 if the input is corrupt or ends in the middle of a
+            member, in which case the bytes before that are returned
+*/
+static size_t inflate_gz_chunk( PGZ_Src* pgz, char* out, size_t len,
+				int* status ) {
+  z_stream* strm = &pgz->gz_strm;
+  size_t got;
+  int ret;
+
+  *status = 0;
+  strm->next_out  = (unsigned char*)out;
+  strm->avail_out = len;
+  while( strm->avail_out > 0 ) {
+    if ( strm->avail_in == 0 ) {
+      got = pgz_raw_read( pgz, pgz->gz_in, PGZ_IN_CHUNK, 0 );
+      if ( got == 0 ) {
+	if ( !pgz->gz_member_done ) {
+	  fprintf( stderr, "%s: unexpected end of gzip data\n", pgz->fn );
+	  *status = -1;
+	}
+	break;
+      }
+      strm->next_in  = pgz->gz_in;
+      strm->avail_in = got;
+    }
+    if ( pgz->gz_member_done ) {
+      if ( strm->next_in[0] != 0x1f ) {
+	/* Trailing junk; stop here */
+	strm->avail_in = 0;
+	break;
+      }
+      inflateReset( strm );
+      pgz->gz_member_done = 0;
+    }
+    ret = inflate( strm, Z_NO_FLUSH );
+    if ( ret == Z_STREAM_END ) {
+      pgz->gz_member_done = 1;
+    }
+    else if ( (ret != Z_OK) && (ret != Z_BUF_ERROR) ) {
+      fprintf( stderr, "%s: corrupt gzip data\n", pgz->fn );
+      *status = -1;
+      break;
+    }
+  }
+  return len - strm->avail_out;
+}
+
+/* pgz_worker
+   Thread body. Takes the next free job in file order, fills it
+   (BGZF: read the compressed blocks under the lock, then inflate
+   them without it; gzip: inflate without the lock, with gz_busy
+   keeping other workers from taking a job until it is done), and
+   marks it done for the reader. A job that hit a problem is
+   marked PGZ_ERROR, but still has the data from before it.
+*/
+static void* pgz_worker( void* arg ) {
+  PGZ_Src* pgz = (PGZ_Src*)arg;
+  PGZ_Job* job;
+  z_stream strm;
+  void* dd = NULL;
+  int bgzf = pgz->is_bgzf; // at the start; the input can turn to gzip
+  int status;
+
+  memset( &strm, 0, sizeof( z_stream ) );
+  if ( bgzf ) {
+    inflateInit2( &strm, -15 );
+#ifdef HAVE_LIBDEFLATE
+    dd = libdeflate_alloc_decompressor();
+#endif
+  }
+
+  pthread_mutex_lock( &pgz->lock );
+  while( 1 ) {
+    job = &pgz->jobs[pgz->next_in % pgz->n_jobs];
+    while( !pgz->quit && !pgz->eof &&
+	   ((job->state != PGZ_FREE) || pgz->gz_busy) ) {
+      pthread_cond_wait( &pgz->job_free, &pgz->lock );
+      job = &pgz->jobs[pgz->next_in % pgz->n_jobs];
+    }
+    if ( pgz->quit || pgz->eof ) {
+      break;
+    }
+    job->state = PGZ_BUSY;
+    job->len   = 0;
+    job->pos   = 0;
+    pgz->next_in++;
+
+    if ( pgz->is_bgzf ) {
+      status = read_bgzf_blocks( pgz, job );
+      if ( status ) {
+	pgz->eof = 1;
+      }
+      pthread_mutex_unlock( &pgz->lock );
+      /* Even after a bad block, the ones before it are good */
+      if ( inflate_bgzf_job( job, &strm, dd ) ) {
+	fprintf( stderr, "%s: corrupt BGZF block\n", pgz->fn );
+	status = -1;
+      }
+      pthread_mutex_lock( &pgz->lock );
+    }
+    else {
+      pgz->gz_busy = 1;
+      pthread_mutex_unlock( &pgz->lock );
+      job->len = inflate_gz_chunk( pgz, job->data, PGZ_GZ_CHUNK, &status );
+      pthread_mutex_lock( &pgz->lock );
+      pgz->gz_busy = 0;
+      if ( (job->len == 0) || status ) {
+	pgz->eof = 1;
+      }
+      /* The next job can be streamed now */
+      pthread_cond_broadcast( &pgz->job_free );
+    }
+    job->state = status ? PGZ_ERROR : PGZ_DONE;
+    pthread_cond_broadcast( &pgz->job_done );
+    if ( pgz->eof ) {
+      /* Wake other workers so they see eof too */
+      pthread_cond_broadcast( &pgz->job_free );
+    }
+  }
+  pthread_mutex_unlock( &pgz->lock );
+
+  if ( bgzf ) {
+    inflateEnd( &strm );
+#ifdef HAVE_LIBDEFLATE
+    libdeflate_free_decompressor( (struct libdeflate_decompressor*)dd );
+#endif
+  }
+  return NULL;
+}
+
+/* init_pgz_src
+   Args: const char fn[] - name of the input, for messages
+         int fd - where to read gzip (or BGZF) data from
+         const unsigned char* head - bytes already read from fd
+         size_t head_len - how many; at most PGZ_HEAD_LEN
+         int n_threads - number of inflate threads for BGZF;
+                         0 => one per processor
+   Returns: PGZ_Src* with its workers running; NULL => zlib could
+            not be set up
+   fd is not closed by close_pgz_src.
+*/
+PGZ_Src* init_pgz_src( const char fn[], int fd, const unsigned char* head,
+		       size_t head_len, int n_threads ) {
+  PGZ_Src* pgz;
+  size_t i;
+  size_t c_size, d_size;
+
+  pgz = (PGZ_Src*)malloc(sizeof( PGZ_Src ));
+  strcpy( pgz->fn, fn );
+  pgz->fd = fd;
+  memcpy( pgz->head, head, head_len );
+  pgz->head_len = head_len;
+  pgz->head_pos = 0;
+  pgz->gz_in    = NULL;
+  pgz->gz_busy  = 0;
+  pgz->is_bgzf  = is_bgzf( head, head_len );
+  if ( pgz->is_bgzf ) {
+    if ( n_threads <= 0 ) {
+      n_threads = default_pgz_threads();
+    }
+    pgz->n_threads = n_threads;
+    pgz->n_jobs    = 2 * n_threads + 2;
+    c_size = PGZ_JOB_BLOCKS * BGZF_MAX_BLOCK;
+    d_size = PGZ_JOB_BLOCKS * BGZF_MAX_BLOCK;
+  }
+  else {
+    if ( start_gz_stream( pgz, NULL, 0 ) != 0 ) {
+      free( pgz );
+      return NULL;
+    }
+    pgz->n_threads = 1;
+    pgz->n_jobs    = 2;
+    c_size = 0;
+    d_size = PGZ_GZ_CHUNK;
+  }
+
+  pgz->jobs = (PGZ_Job*)malloc(sizeof(PGZ_Job) * pgz->n_jobs);
+  for( i = 0; i < pgz->n_jobs; i++ ) {
+    pgz->jobs[i].state = PGZ_FREE;
+    pgz->jobs[i].cdata = c_size ? (unsigned char*)malloc( c_size ) : NULL;
+    pgz->jobs[i].data  = (char*)malloc( d_size );
+    pgz->jobs[i].len   = 0;
+    pgz->jobs[i].pos   = 0;
+  }
+  pgz->next_in  = 0;
+  pgz->next_out = 0;
+  pgz->eof      = 0;
+  pgz->quit     = 0;
+  pthread_mutex_init( &pgz->lock, NULL );
+  pthread_cond_init( &pgz->job_free, NULL );
+  pthread_cond_init( &pgz->job_done, NULL );
+  pgz->threads = (pthread_t*)malloc(sizeof(pthread_t) * pgz->n_threads);
+  for( i = 0; i < pgz->n_threads; i++ ) {
+    pthread_create( &pgz->threads[i], NULL, pgz_worker, pgz );
+  }
+  return pgz;
+}
+
+/* pgz_read
+   Args: PGZ_Src* pgz - the source to read from
+         char* buf - where to put the inflated data
+         size_t len - how many bytes to read
+   Returns: number of bytes put into buf (less than len only at the
+            end of the file or before a problem); 0 => EOF;
+            -1 => problem, once everything before it has been read
+   Takes inflated data from the jobs in file order, handing each
+   job back to the workers as soon as it has been used up.
+*/
+long pgz_read( PGZ_Src* pgz, char* buf, size_t len ) {
+  PGZ_Job* job;
+  size_t got = 0;
+  size_t n;
+
+  while( got < len ) {
+    pthread_mutex_lock( &pgz->lock );
+    job = &pgz->jobs[pgz->next_out % pgz->n_jobs];
+    while( ((pgz->next_out < pgz->next_in) && (job->state == PGZ_BUSY)) ||
+	   ((pgz->next_out == pgz->next_in) && !pgz->eof) ) {
+      pthread_cond_wait( &pgz->job_done, &pgz->lock );
+    }
+    if ( pgz->next_out == pgz->next_in ) {
+      /* Nothing more is coming */
+      pthread_mutex_unlock( &pgz->lock );
+      break;
+    }
+    pthread_mutex_unlock( &pgz->lock );
+    if ( (job->state == PGZ_ERROR) && (job->pos == job->len) ) {
+      /* The job is kept, so every later call says so too */
+      return ( got > 0 ) ? (long)got : -1;
+    }
+
+    /* This job is finished and only the reader touches it now */
+    n = job->len - job->pos;
+    if ( n > len - got ) {
+      n = len - got;
+    }
+    memcpy( &buf[got], &job->data[job->pos], n );
+    job->pos += n;
+    got += n;
+
+    if ( (job->pos == job->len) && (job->state == PGZ_DONE) ) {
+      pthread_mutex_lock( &pgz->lock );
+      job->state = PGZ_FREE;
+      pgz->next_out++;
+      pthread_cond_broadcast( &pgz->job_free );
+      pthread_mutex_unlock( &pgz->lock );
+    }
+  }
+  return (long)got;
+}
+
+/* close_pgz_src
+   Stops the workers and frees everything; does not close pgz->fd
+*/
+void close_pgz_src( PGZ_Src* pgz ) {
+  size_t i;
+  pthread_mutex_lock( &pgz->lock );
+  pgz->quit = 1;
+  pthread_cond_broadcast( &pgz->job_free );
+  pthread_mutex_unlock( &pgz->lock );
+  for( i = 0; i < pgz->n_threads; i++ ) {
+    pthread_join( pgz->threads[i], NULL );
+  }
+  for( i = 0; i < pgz->n_jobs; i++ ) {
+    free( pgz->jobs[i].cdata );
+    free( pgz->jobs[i].data );
+  }
+  free( pgz->jobs );
+  free( pgz->threads );
+  pthread_mutex_destroy( &pgz->lock );
+  pthread_cond_destroy( &pgz->job_free );
+  pthread_cond_destroy( &pgz->job_done );
+  if ( pgz->gz_in != NULL ) {
+    inflateEnd( &pgz->gz_strm );
+    free( pgz->gz_in );
+  }
+  free( pgz );
+}
@@ -0,0 +1,92 @@
+#ifndef PGZIP_IO
+#define PGZIP_IO
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifndef MAX_FN_LEN
+#define MAX_FN_LEN (2047)
+#endif
+#define PGZ_MAX_THREADS (64)
+#define BGZF_MAX_BLOCK (65536)   // largest BGZF block, compressed or not
+#define PGZ_JOB_BLOCKS (16)      // BGZF blocks inflated per job
+#define PGZ_GZ_CHUNK (1048576)   // bytes inflated per job for plain gzip
+#define PGZ_IN_CHUNK (262144)    // bytes read at a time for plain gzip
+#define PGZ_HEAD_LEN (18)        // bytes needed to tell BGZF from gzip
+
+/* Job states */
+#define PGZ_FREE (0)
+#define PGZ_BUSY (1)
+#define PGZ_DONE (2)
+#define PGZ_ERROR (3)
+
+/* A PGZ_Job is one slot in the ring of work handed between the
+   decompression threads and the reader. For BGZF, cdata holds up
+   to PGZ_JOB_BLOCKS whole compressed blocks; data gets what they
+   inflate to. For plain gzip, data is filled by streaming inflate.
+   pos is how much of data the reader has taken so far.
+ */
+typedef struct pgz_job {
+  int state;
+  unsigned char* cdata;
+  size_t c_len;
+  size_t block_offs[PGZ_JOB_BLOCKS];
+  size_t block_lens[PGZ_JOB_BLOCKS];
+  size_t n_blocks;
+  char* data;
+  size_t len;
+  size_t pos;
+} PGZ_Job;
+
+/* PGZ_Src decompresses gzip data from a file descriptor on worker
+   threads. The descriptor can be a pipe; head holds the bytes the
+   caller already read from it to sniff the format, and they are
+   used before anything more is read.
+   BGZF input (gzip made of independent blocks, as written by
+   bgzip and samtools) is split into jobs that n_threads workers
+   inflate in parallel. Any other gzip gets one worker that streams
+   it through inflate into alternating jobs (double buffering), so
+   inflating still overlaps with whatever the reader is doing.
+   A BGZF file can go on with plain gzip (e.g. cat a.bgzf.gz b.gz);
+   from the first member that is not a BGZF block, the rest is
+   streamed, one job at a time, by whichever worker is free.
+   Jobs are handed out and consumed in file order: next_in is the
+   number of the next job a worker will take, next_out is the
+   number of the next job the reader will consume.
+ */
+typedef struct pgz_src {
+  char fn[MAX_FN_LEN + 1];
+  int fd;
+  unsigned char head[PGZ_HEAD_LEN];
+  size_t head_len;
+  size_t head_pos;
+  int is_bgzf;
+  z_stream gz_strm;      // plain gzip: inflate state; one worker at a time
+  unsigned char* gz_in;  // plain gzip: compressed input buffer; NULL => none
+  int gz_member_done;    // plain gzip: between gzip members
+  int gz_busy;           // plain gzip: a worker is inflating into a job
+  int n_threads;
+  pthread_t* threads;
+  PGZ_Job* jobs;
+  size_t n_jobs;
+  size_t next_in;
+  size_t next_out;
+  int eof;      // all input has been handed to workers
+  int quit;
+  pthread_mutex_t lock;
+  pthread_cond_t job_free;
+  pthread_cond_t job_done;
+} PGZ_Src;
+
+/* Function prototypes */
+int is_bgzf( const unsigned char* head, size_t len );
+int default_pgz_threads( void );
+PGZ_Src* init_pgz_src( const char fn[], int fd, const unsigned char* head,
+		       size_t head_len, int n_threads );
+long pgz_read( PGZ_Src* pgz, char* buf, size_t len );
+void close_pgz_src( PGZ_Src* pgz );
+
+#endif
@@ -0,0 +1,81 @@
+#include <math.h>
+#include "read-hash.h"
+
+#define H_P0 (0xa0761d6478bd642fULL)
+#define H_P1 (0xe7037ed1a0b428dbULL)
+#define H_P2 (0x8ebc6af09c88c6e3ULL)
+#define H_P3 (0x589965cc75374cc3ULL)
+
+/* mum
+   Returns the high and low halves of the 128-bit product of a
+   and b XORed together
+*/
+static inline uint64_t mum( uint64_t a, uint64_t b ) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+uint64_t hash_seq( const char* seq, size_t len, uint64_t seed ) {
+  uint64_t h = seed ^ mum( len ^ H_P0, H_P1 );
+  uint64_t w;
+  size_t i;
+  for( i = 0; i + 8 <= len; i += 8 ) {
+    memcpy( &w, &seq[i], 8 );
+    h = mum( h ^ w ^ H_P2, H_P1 );
+  }
+  if ( i < len ) {
+    w = 0;
+    memcpy( &w, &seq[i], len - i );
+    h = mum( h ^ w ^ H_P3, H_P1 );
+  }
+  return mum( h ^ H_P0, H_P2 );
+}
+
+HLL* init_hll( unsigned int p ) {
+  HLL* hll;
+  if ( (p < HLL_MIN_P) || (p > HLL_MAX_P) ) {
+    return NULL;
+  }
+  hll      = (HLL*)malloc(sizeof(HLL));
+  hll->p   = p;
+  hll->m   = (size_t)1 << p;
+  hll->reg = (uint8_t*)calloc(hll->m, sizeof(uint8_t));
+  return hll;
+}
+
+void merge_hll( HLL* total, const HLL* part ) {
+  size_t i;
+  for( i = 0; i < total->m; i++ ) {
+    if ( part->reg[i] > total->reg[i] ) {
+      total->reg[i] = part->reg[i];
+    }
+  }
+}
+
+double estimate_hll( const HLL* hll ) {
+  double m = (double)hll->m;
+  double alpha;
+  double sum = 0.0;
+  double est;
+  size_t zeros = 0;
+  size_t i;
+
+  alpha = 0.7213 / (1.0 + 1.079 / m);
+  for( i = 0; i < hll->m; i++ ) {
+    sum += ldexp( 1.0, -(int)hll->reg[i] );
+    if ( hll->reg[i] == 0 ) {
+      zeros++;
+    }
+  }
+  est = alpha * m * m / sum;
+  /* With 64-bit hashes there is no large range correction */
+  if ( (est <= 2.5 * m) && (zeros > 0) ) {
+    est = m * log( m / (double)zeros );
+  }
+  return est;
+}
+
+void free_hll( HLL* hll ) {
+  free( hll->reg );
+  free( hll );
+}
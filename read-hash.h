@@ -0,0 +1,73 @@
+#ifndef READ_HASH
+#define READ_HASH
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#define HLL_DEF_P (14)  // 2^14 registers; about 0.8% standard error
+#define HLL_MIN_P (4)
+#define HLL_MAX_P (18)
+
+/* hash_seq
+   Args: const char* seq - the bytes to hash; need not be
+                           NUL-terminated
+         size_t len - how many
+         uint64_t seed - start value; passing the hash of one
+                         sequence as the seed of the next hashes
+                         the two together, e.g., a read pair
+   Returns: a 64-bit hash of seq. Reads 8 bytes at a time and
+   mixes each in with a 64x64->128-bit multiply, so it runs at
+   several bytes per cycle. Not for anything cryptographic.
+*/
+uint64_t hash_seq( const char* seq, size_t len, uint64_t seed );
+
+/* HLL is a HyperLogLog sketch: it estimates how many different
+   hashes it has seen in 2^p bytes, however many there are.
+   The top p bits of a hash pick a register; the register keeps
+   the most leading zeros (plus one) seen in the rest of the
+   bits of the hashes that went to it. Sketches with the same p
+   merge by taking the larger of each register, so sketches made
+   from parts of the input merge to the sketch of all of it.
+ */
+typedef struct hll {
+  unsigned int p;
+  size_t m; // 2^p registers
+  uint8_t* reg;
+} HLL;
+
+/* init_hll
+   Returns an empty HLL with 2^p registers, or NULL if p is
+   not HLL_MIN_P to HLL_MAX_P
+*/
+HLL* init_hll( unsigned int p );
+
+/* add_hll
+   Adds hash to hll
+*/
+static inline void add_hll( HLL* hll, uint64_t hash ) {
+  size_t i;
+  uint64_t rest;
+  uint8_t rank;
+  i    = hash >> (64 - hll->p);
+  rest = (hash << hll->p) | ((uint64_t)1 << (hll->p - 1));
+  rank = __builtin_clzll( rest ) + 1;
+  if ( rank > hll->reg[i] ) {
+    hll->reg[i] = rank;
+  }
+}
+
+/* merge_hll
+   Makes total the sketch of everything added to it or to part;
+   both must have the same p
+*/
+void merge_hll( HLL* total, const HLL* part );
+
+/* estimate_hll
+   Returns the estimated number of different hashes added to hll,
+   using linear counting while many registers are still 0
+*/
+double estimate_hll( const HLL* hll );
+
+void free_hll( HLL* hll );
+
+#endif
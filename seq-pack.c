@@ -0,0 +1,198 @@
+#include "seq-pack.h"
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(SEQ_PACK_NO_SIMD)
+#define SEQ_PACK_X86
+#include <immintrin.h>
+#endif
+
+/* Packing goes 32 bases (one code word) at a time. For each block
+   three 32-bit masks are made, with bit j for base j: hi and lo,
+   the two bits of the base's code, and bad, set for non-ACGT.
+   The code bits come straight from the ASCII:
+     hi = bit 2, lo = bit 1 XOR bit 2
+   which gives A=00, C=01, G=10, T=11 in upper or lower case.
+ */
+typedef void (*Block_Masks)( const char* seq, uint32_t* hi, uint32_t* lo,
+			     uint32_t* bad );
+
+/* block_masks_scalar_n
+   Makes the masks for the first n (at most 32) bases of seq
+*/
+static void block_masks_scalar_n( const char* seq, size_t n, uint32_t* hi,
+				  uint32_t* lo, uint32_t* bad ) {
+  uint32_t h = 0, l = 0, b = 0;
+  unsigned char c;
+  size_t j;
+  for( j = 0; j < n; j++ ) {
+    c = seq[j] | 0x20;
+    if ( (c == 'a') || (c == 'c') || (c == 'g') || (c == 't') ) {
+      h |= (uint32_t)((c >> 2) & 1) << j;
+      l |= (uint32_t)(((c >> 1) ^ (c >> 2)) & 1) << j;
+    }
+    else {
+      b |= (uint32_t)1 << j;
+    }
+  }
+  *hi  = h;
+  *lo  = l;
+  *bad = b;
+}
+
+#ifndef SEQ_PACK_X86
+static void block_masks_scalar( const char* seq, uint32_t* hi, uint32_t* lo,
+				uint32_t* bad ) {
+  block_masks_scalar_n( seq, 32, hi, lo, bad );
+}
+#else
+/* block_masks_sse2
+   Same as block_masks_scalar, 16 bases at a time. Shifting each
+   16-bit lane left by 5 (or 6) puts bit 2 (or 1) of every byte in
+   its top bit, where movemask picks it up.
+*/
+static void block_masks_sse2( const char* seq, uint32_t* hi, uint32_t* lo,
+			      uint32_t* bad ) {
+  const __m128i lower = _mm_set1_epi8( 0x20 );
+  __m128i v, lc, ok;
+  uint32_t h = 0, b1 = 0, good = 0;
+  int half;
+  for( half = 0; half < 2; half++ ) {
+    v  = _mm_loadu_si128( (const __m128i*)&seq[16 * half] );
+    lc = _mm_or_si128( v, lower );
+    ok = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( lc, _mm_set1_epi8('a') ),
+				     _mm_cmpeq_epi8( lc, _mm_set1_epi8('c') ) ),
+		       _mm_or_si128( _mm_cmpeq_epi8( lc, _mm_set1_epi8('g') ),
+				     _mm_cmpeq_epi8( lc, _mm_set1_epi8('t') ) ) );
+    h    |= (uint32_t)_mm_movemask_epi8( _mm_slli_epi16( v, 5 ) ) << (16 * half);
+    b1   |= (uint32_t)_mm_movemask_epi8( _mm_slli_epi16( v, 6 ) ) << (16 * half);
+    good |= (uint32_t)_mm_movemask_epi8( ok ) << (16 * half);
+  }
+  *hi  = h & good;
+  *lo  = (b1 ^ h) & good;
+  *bad = ~good;
+}
+
+/* block_masks_avx2
+   Same as block_masks_sse2, all 32 bases at once
+*/
+__attribute__((target("avx2")))
+static void block_masks_avx2( const char* seq, uint32_t* hi, uint32_t* lo,
+			      uint32_t* bad ) {
+  __m256i v, lc, ok;
+  uint32_t h, b1, good;
+  v  = _mm256_loadu_si256( (const __m256i*)seq );
+  lc = _mm256_or_si256( v, _mm256_set1_epi8( 0x20 ) );
+  ok = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( lc, _mm256_set1_epi8('a') ),
+					 _mm256_cmpeq_epi8( lc, _mm256_set1_epi8('c') ) ),
+			_mm256_or_si256( _mm256_cmpeq_epi8( lc, _mm256_set1_epi8('g') ),
+					 _mm256_cmpeq_epi8( lc, _mm256_set1_epi8('t') ) ) );
+  h    = (uint32_t)_mm256_movemask_epi8( _mm256_slli_epi16( v, 5 ) );
+  b1   = (uint32_t)_mm256_movemask_epi8( _mm256_slli_epi16( v, 6 ) );
+  good = (uint32_t)_mm256_movemask_epi8( ok );
+  *hi  = h & good;
+  *lo  = (b1 ^ h) & good;
+  *bad = ~good;
+}
+#endif
+
+/* pick_block_masks
+   Returns the fastest block_masks this processor can run
+*/
+static Block_Masks pick_block_masks( void ) {
+#ifdef SEQ_PACK_X86
+  if ( __builtin_cpu_supports( "avx2" ) ) {
+    return block_masks_avx2;
+  }
+  return block_masks_sse2;
+#else
+  return block_masks_scalar;
+#endif
+}
+
+/* pack_seq_impl
+   Returns the name of the block_masks pack_seq uses here
+*/
+const char* pack_seq_impl( void ) {
+#ifdef SEQ_PACK_X86
+  if ( __builtin_cpu_supports( "avx2" ) ) {
+    return "avx2";
+  }
+  return "sse2";
+#else
+  return "scalar";
+#endif
+}
+
+/* spread32
+   Returns x with a 0 put in front of each of its bits, so bit j
+   moves to bit 2j
+*/
+static inline uint64_t spread32( uint32_t x ) {
+  uint64_t y = x;
+  y = (y | (y << 16)) & 0x0000ffff0000ffffULL;
+  y = (y | (y << 8))  & 0x00ff00ff00ff00ffULL;
+  y = (y | (y << 4))  & 0x0f0f0f0f0f0f0f0fULL;
+  y = (y | (y << 2))  & 0x3333333333333333ULL;
+  y = (y | (y << 1))  & 0x5555555555555555ULL;
+  return y;
+}
+
+/* reverse_pairs
+   Returns x with the order of its 32 2-bit pairs reversed
+*/
+static inline uint64_t reverse_pairs( uint64_t x ) {
+  x = __builtin_bswap64( x );
+  x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+  x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+  return x;
+}
+
+/* reverse_bits32
+   Returns x with the order of its 32 bits reversed
+*/
+static inline uint32_t reverse_bits32( uint32_t x ) {
+  x = __builtin_bswap32( x );
+  x = ((x >> 4) & 0x0f0f0f0fU) | ((x & 0x0f0f0f0fU) << 4);
+  x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+  x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+  return x;
+}
+
+/* store_block
+   Turns the masks for block b into code word b and its half of
+   N-mask word b/2
+*/
+static inline void store_block( uint64_t* pack, uint64_t* nmask, size_t b,
+				uint32_t hi, uint32_t lo, uint32_t bad ) {
+  pack[b] = reverse_pairs( (spread32( hi ) << 1) | spread32( lo ) );
+  if ( b % 2 == 0 ) {
+    nmask[b / 2] = (uint64_t)reverse_bits32( bad ) << 32;
+  }
+  else {
+    nmask[b / 2] |= reverse_bits32( bad );
+  }
+}
+
+/* pack_seq
+   Args: const char* seq - the bases; need not be NUL-terminated
+         size_t len - how many
+         uint64_t* pack - gets PACK_CODE_WORDS(len) words of codes
+         uint64_t* nmask - gets PACK_MASK_WORDS(len) words of N-mask
+   Bits past the end of the sequence are 0.
+*/
+void pack_seq( const char* seq, size_t len, uint64_t* pack,
+	       uint64_t* nmask ) {
+  Block_Masks block_masks;
+  uint32_t hi, lo, bad;
+  size_t n_full;
+  size_t b;
+
+  block_masks = pick_block_masks();
+  n_full = len / 32;
+  for( b = 0; b < n_full; b++ ) {
+    block_masks( &seq[32 * b], &hi, &lo, &bad );
+    store_block( pack, nmask, b, hi, lo, bad );
+  }
+  if ( len % 32 ) {
+    block_masks_scalar_n( &seq[32 * b], len % 32, &hi, &lo, &bad );
+    store_block( pack, nmask, b, hi, lo, bad );
+  }
+}
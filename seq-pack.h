@@ -0,0 +1,71 @@
+#ifndef SEQ_PACK
+#define SEQ_PACK
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* A packed sequence is 2 bits per base in 64-bit words, using the
+   same formula as kmer.h: A=00, C=01, G=10, T=11 (either case).
+   Base i is in word i/32, first base in the most significant bits,
+   so any k bases read off the words are already the k-mer index.
+   The N-mask has one bit per base, base i in word i/64 (again most
+   significant bit first); the bit is set if the base is anything
+   but A, C, G or T, and the code of such a base is 00.
+   PACK_WORDS(len) words hold both: the codes then the N-mask.
+ */
+#define PACK_CODE_WORDS(len) (((len) + 31) / 32)
+#define PACK_MASK_WORDS(len) (((len) + 63) / 64)
+#define PACK_WORDS(len) (PACK_CODE_WORDS(len) + PACK_MASK_WORDS(len))
+
+/* Function prototypes */
+void pack_seq( const char* seq, size_t len, uint64_t* pack,
+	       uint64_t* nmask );
+const char* pack_seq_impl( void );
+
+/* packed_base
+   Returns the 2-bit code of base i
+*/
+static inline unsigned int packed_base( const uint64_t* pack, size_t i ) {
+  return (pack[i / 32] >> (62 - 2 * (i % 32))) & 3;
+}
+
+/* packed_n
+   Returns true IFF base i is not A, C, G or T
+*/
+static inline int packed_n( const uint64_t* nmask, size_t i ) {
+  return (nmask[i / 64] >> (63 - (i % 64))) & 1;
+}
+
+/* packed_kmer
+   Args: const uint64_t* pack, nmask - a packed sequence
+         size_t i - where the k-mer starts
+         unsigned int k - k-mer length; 1 to 32
+         uint64_t* inx - gets the k-mer index
+   Returns: 1 if copacetic; 0 if there is a non-ACGT base in it
+   The caller makes sure the k bases are all in the sequence.
+*/
+static inline int packed_kmer( const uint64_t* pack, const uint64_t* nmask,
+			       size_t i, unsigned int k, uint64_t* inx ) {
+  size_t w;
+  unsigned int off;
+  uint64_t x;
+
+  w   = i / 32;
+  off = 2 * (i % 32);
+  x   = pack[w] << off;
+  if ( off + 2 * k > 64 ) {
+    x |= pack[w+1] >> (64 - off);
+  }
+  *inx = x >> (64 - 2 * k);
+
+  w   = i / 64;
+  off = i % 64;
+  x   = nmask[w] << off;
+  if ( off + k > 64 ) {
+    x |= nmask[w+1] >> (64 - off);
+  }
+  return ( (x >> (64 - k)) == 0 );
+}
+
+#endif
@@ -4,17 +4,57 @@
 #include <string.h>
 #include <getopt.h>
 #include "fastq-io.h"
+#include "multi-match.h"
 
 #define DEBUG (0)
 #define NUM_SEQ (100000)
 #define ADAPT_LEN (65)
-#define VERSION (4)
+#define VERSION (5)
+#define MAX_ADAPTERS (256)
+
+/* Adapter roots looked for with -p: the start of the 3' adapter
+   read into when the insert is shorter than the read */
+#define N_PANEL (3)
+static const char* panel_names[N_PANEL] = {
+  "TruSeq", "Nextera", "TruSeq_small_RNA" };
+static const char* panel_roots[N_PANEL] = {
+  "AGATCGGAAGAGC", "CTGTCTCTTATACACATCT", "TGGAATTCTCGGGTGCCAAGG" };
+
+/* Adapter_Hits is what is known about one adapter root of a panel
+   after the reads are scanned */
+typedef struct adapter_hits {
+  const char* name;
+  const char* root;
+  int order; // in the panel
+  size_t n_reads; // with the root in them
+  uint64_t pos_sum; // of where the root first starts in them
+  size_t* pos_hist; // how many reads have it first starting at each position
+} Adapter_Hits;
+
+int add_adapter( const char* name, const char* root, const char** names,
+		 const char** roots, int n_adapters );
+int read_adapter_panel( const char* fn, const char** names,
+			const char** roots, int n_adapters );
+int cmp_adapter_hits( const void* a, const void* b );
+const char* find_root( const char* seq, size_t len, const char* root,
+		       size_t root_len );
+void scan_adapter_panel( FQ_Src* fq_source, const char** names,
+			 const char** roots, int n_adapters, int num_seq,
+			 int verbose );
 
 void help( char* adapter_root ) {
+  int ich;
   printf( "what-adapter VERSION %d\n", VERSION );
   printf( "-f <fastq input file>\n" );
   printf( "-n <number of fastq sequences to examine; default = %d>\n", NUM_SEQ );
   printf( "-r <adapter root; default = %s>\n", adapter_root );
+  printf( "   may be given more than once to look for all of them\n" );
+  printf( "-a <file of adapter roots to look for, one per line,\n" );
+  printf( "    each a name and a root, separated by white space>\n" );
+  printf( "-p look for a panel of common adapter roots:\n" );
+  for( ich = 0; ich < N_PANEL; ich++ ) {
+    printf( "   %s %s\n", panel_names[ich], panel_roots[ich] );
+  }
   printf( "-l <length of adapter to report; default = %d>\n", ADAPT_LEN );
   printf( "-v Verbose mode; report a bunch of stuff\n" );
   printf( "Report the adapter sequences seen in an input\n" );
@@ -27,6 +67,12 @@ void help( char* adapter_root ) {
   printf( "This program is especially useful for situations where you\n" );
   printf( "have a short insert library and many reads have partial or\n" );
   printf( "adapter sequence.\n" );
+  printf( "With more than one root (-r more than once, -a, or -p), all\n" );
+  printf( "of them are looked for in one pass over the reads, and a\n" );
+  printf( "table of them is reported instead, most often seen first,\n" );
+  printf( "with how many reads had each, and where in the reads it\n" );
+  printf( "starts (mean and median of its first place in each read).\n" );
+  printf( "The top one is the most likely adapter of the library.\n" );
   exit( 0 );
 }
 
@@ -35,11 +81,14 @@ int main ( int argc, char* argv[] ) {
   char fq_in[MAX_FN_LEN+1] = {'\0'};
   int num_seq, adapt_len;
   char* adapter_root;
-  char* adapter;
-  FILE* fq;
-  gzFile fqgz;
+  const char* adapter;
+  size_t root_len, tail_len, i;
+  const char* names[MAX_ADAPTERS];
+  const char* roots[MAX_ADAPTERS];
+  int n_adapters    = 0;
+  int use_panel     = 0;
   FQ_Src* fq_source;
-  FQ fq_seq;
+  FQ_Rec fq_seq;
   int ich;
   int verbose       = 0;
   int num_seen      = 0;
@@ -54,7 +103,7 @@ int main ( int argc, char* argv[] ) {
   verbose = 0;
 
   /* Process input arguments */
-  while( (ich=getopt( argc, argv, "f:n:l:r:v" )) != -1 ) {
+  while( (ich=getopt( argc, argv, "f:n:l:r:a:pv" )) != -1 ) {
     switch(ich) {
     case 'f' :
       strcpy( fq_in, optarg );
@@ -68,6 +117,18 @@ int main ( int argc, char* argv[] ) {
       break;
     case 'r' :
       strcpy( adapter_root, optarg );
+      n_adapters = add_adapter( optarg, optarg, names, roots, n_adapters );
+      break;
+    case 'a' :
+      n_adapters = read_adapter_panel( optarg, names, roots, n_adapters );
+      use_panel = 1;
+      break;
+    case 'p' :
+      for( ich = 0; ich < N_PANEL; ich++ ) {
+	n_adapters = add_adapter( panel_names[ich], panel_roots[ich],
+				  names, roots, n_adapters );
+      }
+      use_panel = 1;
       break;
     case 'v' :
       verbose = 1;
@@ -86,18 +147,36 @@ int main ( int argc, char* argv[] ) {
   if ( fq_source == NULL ) {
     help(adapter_root);
   }
+  if ( use_panel || (n_adapters > 1) ) {
+    scan_adapter_panel( fq_source, names, roots, n_adapters, num_seq,
+			verbose );
+    exit( 0 );
+  }
   num_seen = 0;
+  root_len = strlen( adapter_root );
+  for( i = 0; i < root_len; i++ ) {
+    adapter_root[i] = toupper( adapter_root[i] );
+  }
   
-  while( (get_next_fq( fq_source, &fq_seq ) == 0) &&
+  while( (get_next_fq_rec( fq_source, &fq_seq ) == 0) &&
 	 (num_seen < num_seq) ) {
     num_seen++;
-    adapter = strstr( fq_seq.seq, adapter_root );
+    adapter = find_root( fq_seq.seq, fq_seq.len, adapter_root, root_len );
     if ( adapter != NULL ) {
       num_seen_root++;
-      adapter[adapt_len] = '\0';
-      printf( "%s\n", adapter );
+      tail_len = fq_seq.len - (adapter - fq_seq.seq);
+      if ( tail_len > adapt_len ) {
+	tail_len = adapt_len;
+      }
+      for( i = 0; i < tail_len; i++ ) {
+	putchar( toupper( adapter[i] ) );
+      }
+      putchar( '\n' );
     }
   }
+  if ( fq_source->error ) {
+    exit( 1 );
+  }
 
   if ( verbose ) {
     fprintf( stderr,
@@ -109,3 +188,214 @@ int main ( int argc, char* argv[] ) {
   exit( 0 );
 }
 
+
+/* find_root
+   Args: const char* seq - a read, in any case
+         size_t len - its length
+         const char* root - an upper case adapter root
+         size_t root_len - its length
+   Returns: where root first starts in seq, ignoring case; NULL if
+            it is not there
+*/
+const char* find_root( const char* seq, size_t len, const char* root,
+		       size_t root_len ) {
+  size_t i, j;
+  for( i = 0; i + root_len <= len; i++ ) {
+    for( j = 0; (j < root_len) && (toupper( seq[i+j] ) == root[j]); j++ ) {
+      ;
+    }
+    if ( j == root_len ) {
+      return &seq[i];
+    }
+  }
+  return NULL;
+}
+
+/* add_adapter
+   Args: const char* name, root - the adapter to add; kept, not copied
+         const char** names, roots - the adapters so far
+         int n_adapters - how many are in names and roots
+   A root that is already there (in either case) is not added
+   again; the first name given for it is kept. Past MAX_ADAPTERS,
+   nothing more is added. Either way, it says so on stderr.
+   Returns: how many are in names and roots now
+*/
+int add_adapter( const char* name, const char* root, const char** names,
+		 const char** roots, int n_adapters ) {
+  int i;
+  for( i = 0; i < n_adapters; i++ ) {
+    if ( strcasecmp( roots[i], root ) == 0 ) {
+      fprintf( stderr, "Adapter root %s (%s) is already in as %s\n",
+	       root, name, names[i] );
+      return n_adapters;
+    }
+  }
+  if ( n_adapters >= MAX_ADAPTERS ) {
+    fprintf( stderr, "Only the first %d adapters are used; not %s\n",
+	     MAX_ADAPTERS, name );
+    return n_adapters;
+  }
+  names[n_adapters] = name;
+  roots[n_adapters] = root;
+  return n_adapters + 1;
+}
+
+/* read_adapter_panel
+   Args: const char* fn - file of adapters, a name and a root on
+                          each line; blank lines and lines starting
+                          with # are skipped. A line with just a
+                          root is named for the root.
+         const char** names, roots - get the adapters
+         int n_adapters - how many are already in names and roots
+   Returns: how many are in names and roots now; exits if fn
+   cannot be read
+*/
+int read_adapter_panel( const char* fn, const char** names,
+			const char** roots, int n_adapters ) {
+  FILE* in;
+  char line[MAX_FQ_LEN+1];
+  char name[MAX_FQ_LEN+1];
+  char root[MAX_FQ_LEN+1];
+  char* name_copy;
+  char* root_copy;
+  int n, n_before;
+
+  in = fopen( fn, "r" );
+  if ( in == NULL ) {
+    fprintf( stderr, "Cannot read adapters from %s\n", fn );
+    exit( 1 );
+  }
+  while( fgets( line, MAX_FQ_LEN, in ) != NULL ) {
+    if ( line[0] == '#' ) {
+      continue;
+    }
+    n = sscanf( line, "%s %s", name, root );
+    if ( n <= 0 ) {
+      continue;
+    }
+    if ( n == 1 ) {
+      strcpy( root, name );
+    }
+    name_copy  = strdup( name );
+    root_copy  = strdup( root );
+    n_before   = n_adapters;
+    n_adapters = add_adapter( name_copy, root_copy, names, roots,
+			      n_adapters );
+    if ( n_adapters == n_before ) {
+      free( name_copy );
+      free( root_copy );
+    }
+  }
+  fclose( in );
+  return n_adapters;
+}
+
+/* Most reads first; ties keep the order they were given in */
+int cmp_adapter_hits( const void* a, const void* b ) {
+  const Adapter_Hits* ha = (const Adapter_Hits*)a;
+  const Adapter_Hits* hb = (const Adapter_Hits*)b;
+  if ( ha->n_reads != hb->n_reads ) {
+    return ( ha->n_reads > hb->n_reads ) ? -1 : 1;
+  }
+  return ha->order - hb->order;
+}
+
+/* scan_adapter_panel
+   Looks for all the roots in the first num_seq reads of fq_source
+   with one Multi_Match scan of each read, and writes the table of
+   how many reads had each and where it starts in them
+*/
+void scan_adapter_panel( FQ_Src* fq_source, const char** names,
+			 const char** roots, int n_adapters, int num_seq,
+			 int verbose ) {
+  Multi_Match* mm;
+  Adapter_Hits* hits;
+  FQ_Rec fq_seq;
+  long* first;
+  size_t max_pos = MAX_FQ_LEN;
+  size_t pos, half, n_below;
+  int i;
+  int num_seen      = 0;
+  int num_seen_root = 0;
+
+  if ( n_adapters == 0 ) {
+    fprintf( stderr, "No adapter roots to look for\n" );
+    exit( 1 );
+  }
+  mm = init_multi_match( roots, n_adapters );
+  if ( mm == NULL ) {
+    exit( 1 );
+  }
+  first = (long*)malloc(sizeof(long) * n_adapters);
+  hits  = (Adapter_Hits*)malloc(sizeof(Adapter_Hits) * n_adapters);
+  for( i = 0; i < n_adapters; i++ ) {
+    hits[i].name     = names[i];
+    hits[i].root     = roots[i];
+    hits[i].order    = i;
+    hits[i].n_reads  = 0;
+    hits[i].pos_sum  = 0;
+    hits[i].pos_hist = (size_t*)calloc( max_pos + 1, sizeof(size_t) );
+  }
+
+  while( (num_seen < num_seq) &&
+	 (get_next_fq_rec( fq_source, &fq_seq ) == 0) ) {
+    num_seen++;
+    if ( first_multi_match( mm, fq_seq.seq, fq_seq.len, first ) == 0 ) {
+      continue;
+    }
+    num_seen_root++;
+    for( i = 0; i < n_adapters; i++ ) {
+      if ( first[i] < 0 ) {
+	continue;
+      }
+      /* Reads can be longer than MAX_FQ_LEN; those go in the last bin */
+      pos = ( (size_t)first[i] < max_pos ) ? (size_t)first[i] : max_pos;
+      hits[i].n_reads++;
+      hits[i].pos_sum += first[i];
+      hits[i].pos_hist[pos]++;
+    }
+  }
+  if ( fq_source->error ) {
+    exit( 1 );
+  }
+
+  qsort( hits, n_adapters, sizeof(Adapter_Hits), cmp_adapter_hits );
+  printf( "#adapter root reads fraction mean_pos median_pos\n" );
+  for( i = 0; i < n_adapters; i++ ) {
+    printf( "%s %s %lu %.4f ", hits[i].name, hits[i].root, hits[i].n_reads,
+	    ( num_seen > 0 ) ? (float)hits[i].n_reads / (float)num_seen : 0.0 );
+    if ( hits[i].n_reads == 0 ) {
+      printf( "NA NA\n" );
+      continue;
+    }
+    half = (hits[i].n_reads + 1) / 2;
+    n_below = 0;
+    for( pos = 0; pos < max_pos; pos++ ) {
+      n_below += hits[i].pos_hist[pos];
+      if ( n_below >= half ) {
+	break;
+      }
+    }
+    printf( "%.1f %lu\n", (double)hits[i].pos_sum / (double)hits[i].n_reads,
+	    pos );
+  }
+  if ( hits[0].n_reads > 0 ) {
+    printf( "#Most likely adapter: %s\n", hits[0].name );
+  }
+  else {
+    printf( "#No adapter root seen\n" );
+  }
+
+  if ( verbose ) {
+    fprintf( stderr,
+	     "%d examined\n%d (%.3f) had an adapter root\n",
+	     num_seen, num_seen_root,
+	     (float)num_seen_root / (float)num_seen );
+  }
+  for( i = 0; i < n_adapters; i++ ) {
+    free( hits[i].pos_hist );
+  }
+  free( hits );
+  free( first );
+  free_multi_match( mm );
+}
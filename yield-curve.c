@@ -0,0 +1,186 @@
+#include "yield-curve.h"
+
+/* cf_new
+   Returns the expected new distinct sequences with t times as many
+   reads again, from the first n_terms terms of the continued
+   fraction: t c0 / (1 - cf[0] t / (1 - cf[1] t / (1 - ...))).
+   NAN if it has a pole on the way.
+*/
+static double cf_new( const Yield_Curve* yc, unsigned int n_terms,
+		      double t ) {
+  double d = 1.0;
+  unsigned int r;
+  for( r = n_terms; r > 0; r-- ) {
+    if ( d == 0.0 ) {
+      return NAN;
+    }
+    d = 1.0 - yc->cf[r - 1] * t / d;
+  }
+  if ( d <= 0.0 ) {
+    return NAN;
+  }
+  return t * yc->c0 / d;
+}
+
+/* qd_terms
+   Turns the power series c[0] + c[1] t + ... + c[n] t^n into the
+   continued fraction c[0] / (1 - cf[0] t / (1 - cf[1] t / ...))
+   with the quotient-difference algorithm.
+   Returns: how many terms of cf could be made. Term r only
+   depends on c[0] to c[r], so a 0 that would be divided by in
+   the table just means the higher coefficients are dropped.
+*/
+static unsigned int qd_terms( const double* c, unsigned int n,
+			      double* cf ) {
+  double q[YC_MAX_TERMS + 1];
+  double e[YC_MAX_TERMS + 1];
+  unsigned int r, k, got = 0;
+
+  /* q and e hold one column of the table each: q[k] is
+     q_r^(k), e[k] is e_r^(k) */
+  for( k = 0; k < n; k++ ) {
+    if ( c[k] == 0.0 ) {
+      n = k;
+      break;
+    }
+    q[k] = c[k + 1] / c[k];
+    e[k] = 0.0;
+  }
+  e[n] = 0.0;
+  for( r = 1; got < n; r++ ) {
+    /* q_r^(0) is the next term */
+    cf[got++] = q[0];
+    if ( (got == n) || (n < 2 * r) ) {
+      break;
+    }
+    /* e_r^(k) = q_r^(k+1) - q_r^(k) + e_(r-1)^(k+1) */
+    for( k = 0; k + 2 * r <= n; k++ ) {
+      e[k] = q[k + 1] - q[k] + e[k + 1];
+    }
+    cf[got++] = e[0];
+    if ( (got == n) || (n < 2 * r + 1) ) {
+      break;
+    }
+    /* q_(r+1)^(k) = q_r^(k+1) e_r^(k+1) / e_r^(k) */
+    for( k = 0; k + 2 * r + 1 <= n; k++ ) {
+      if ( e[k] == 0.0 ) {
+	if ( k == 0 ) {
+	  return got;
+	}
+	/* Only c[0] to c[k + 2r - 1] can be used */
+	n = k + 2 * r - 1;
+	break;
+      }
+      q[k] = q[k + 1] * e[k + 1] / e[k];
+    }
+  }
+  return got;
+}
+
+/* stable
+   Returns true IFF the first n_terms of the continued fraction give
+   a curve that goes up, but no faster than one new sequence per
+   read and ever more slowly, from t = 0 to max_t
+*/
+static int stable( const Yield_Curve* yc, unsigned int n_terms,
+		   double max_t ) {
+  double prev = 0.0, prev_slope = yc->c0 / yc->n_reads, y, slope;
+  double step = max_t / YC_GRID;
+  unsigned int i;
+  for( i = 1; i <= YC_GRID; i++ ) {
+    y = cf_new( yc, n_terms, step * i );
+    if ( isnan( y ) || isinf( y ) ) {
+      return 0;
+    }
+    slope = (y - prev) / (step * yc->n_reads);
+    if ( (slope < 0.0) || (slope > 1.0) ||
+	 (slope > prev_slope * (1.0 + 1e-9)) ) {
+      return 0;
+    }
+    prev = y;
+    prev_slope = slope;
+  }
+  return 1;
+}
+
+/* fit_lander_waterman
+   Finds the library size L with L (1 - exp(-N / L)) = D by
+   bisection; D / L goes down as L goes up
+*/
+static double fit_lander_waterman( double n_reads, double n_distinct ) {
+  double lo, hi, mid;
+  int i;
+  if ( n_distinct >= n_reads ) {
+    return 0.0;
+  }
+  lo = n_distinct;
+  hi = n_distinct;
+  while( hi * (1.0 - exp( -n_reads / hi )) < n_distinct ) {
+    hi *= 2.0;
+  }
+  for( i = 0; i < 200; i++ ) {
+    mid = (lo + hi) / 2.0;
+    if ( mid * (1.0 - exp( -n_reads / mid )) < n_distinct ) {
+      lo = mid;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return (lo + hi) / 2.0;
+}
+
+int fit_yield_curve( const uint64_t* hist, size_t max_count,
+		     double n_reads, double max_fold, Yield_Curve* yc ) {
+  double c[YC_MAX_TERMS + 1];
+  unsigned int n, got;
+  size_t j;
+
+  yc->model      = YC_NONE;
+  yc->n_reads    = n_reads;
+  yc->n_distinct = 0.0;
+  yc->n_terms    = 0;
+  yc->lib_size   = 0.0;
+  for( j = 1; j <= max_count; j++ ) {
+    yc->n_distinct += (double)hist[j];
+  }
+  if ( yc->n_reads == 0.0 ) {
+    return YC_NONE;
+  }
+
+  /* Good-Toulmin: new(t) = t (n1 - n2 t + n3 t^2 - ...); the
+     terms stop at the first count of 0 */
+  for( n = 0; (n <= YC_MAX_TERMS) && (n + 1 < max_count) &&
+	 (hist[n + 1] > 0); n++ ) {
+    c[n] = ( n % 2 ) ? -(double)hist[n + 1] : (double)hist[n + 1];
+  }
+  if ( n > 0 ) {
+    yc->c0 = c[0];
+    got = qd_terms( c, n - 1, yc->cf );
+    for( ; got >= YC_MIN_TERMS; got-- ) {
+      if ( stable( yc, got, max_fold - 1.0 ) ) {
+	yc->n_terms = got;
+	yc->model   = YC_RATIONAL;
+	return YC_RATIONAL;
+      }
+    }
+  }
+  yc->lib_size = fit_lander_waterman( yc->n_reads, yc->n_distinct );
+  yc->model    = YC_LANDER_WATERMAN;
+  return YC_LANDER_WATERMAN;
+}
+
+double yield_at( const Yield_Curve* yc, double fold ) {
+  double reads = fold * yc->n_reads;
+  switch( yc->model ) {
+  case YC_RATIONAL :
+    return yc->n_distinct + cf_new( yc, yc->n_terms, fold - 1.0 );
+  case YC_LANDER_WATERMAN :
+    if ( yc->lib_size == 0.0 ) {
+      return reads;
+    }
+    return yc->lib_size * (1.0 - exp( -reads / yc->lib_size ));
+  default :
+    return yc->n_distinct;
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef YIELD_CURVE
+#define YIELD_CURVE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#define YC_MAX_TERMS (40)   // most continued fraction terms tried
+#define YC_MIN_TERMS (3)
+#define YC_GRID (200)       // points the fit is checked at
+
+/* How the extrapolation is made */
+#define YC_NONE (0)
+#define YC_RATIONAL (1)
+#define YC_LANDER_WATERMAN (2)
+
+/* Yield_Curve predicts how many distinct sequences there would be
+   if more reads were sequenced from the same library, from the
+   duplication histogram of the reads seen so far:
+   hist[j] = how many distinct sequences were seen j times.
+   The expected number of new distinct sequences if t times as many
+   reads again were sequenced is (Good & Toulmin, 1956)
+     new(t) = n1 t - n2 t^2 + n3 t^3 - ...
+   which only converges for t < 1. As in preseq (Daley & Smith,
+   2013) the series is turned into a continued fraction, a rational
+   function that stays sensible far past t = 1. The longest
+   continued fraction that gives a curve that only goes up, ever
+   more slowly, out to the furthest depth asked for, is used. If
+   there is none, the curve is from the Lander-Waterman model,
+   distinct = L (1 - exp(-reads / L)), with the library size L
+   set so it goes through the reads seen so far.
+ */
+typedef struct yield_curve {
+  int model; // YC_NONE, YC_RATIONAL, or YC_LANDER_WATERMAN
+  double n_reads;
+  double n_distinct;
+  unsigned int n_terms; // continued fraction terms
+  double c0;
+  double cf[YC_MAX_TERMS];
+  double lib_size; // for YC_LANDER_WATERMAN; 0 => infinite
+} Yield_Curve;
+
+/* fit_yield_curve
+   Args: const uint64_t* hist - the duplication histogram
+         size_t max_count - last entry of hist; it may hold
+                            everything seen max_count or more times
+         double n_reads - how many reads hist is from
+         double max_fold - furthest depth wanted, as a multiple of
+                           n_reads; more than 1
+         Yield_Curve* yc - gets the fit
+   Returns: the model used
+*/
+int fit_yield_curve( const uint64_t* hist, size_t max_count,
+		     double n_reads, double max_fold, Yield_Curve* yc );
+
+/* yield_at
+   Returns the expected number of distinct sequences with fold
+   times as many reads as yc was fit with; fold >= 1
+*/
+double yield_at( const Yield_Curve* yc, double fold );
+
+#endif